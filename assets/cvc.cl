@@ -361,6 +361,8 @@ __kernel void cvc_float_nv(__global const float* lImgR,
     const int x = get_global_id(0);
     const int y = get_global_id(1);
     const int d = get_global_id(2);
+    if(x >= width || y >= height) //global size rounded up to the work-group size
+        return;
 
     /* Offset calculates the position in the linear data for the row and the column. */
     const int offset = y * width + x;
@@ -390,23 +392,17 @@ __kernel void cvc_float_nv(__global const float* lImgR,
 
     clrDiff = clrDiff > TAU_1_32F ? TAU_1_32F : clrDiff; 
     grdDiff = grdDiff > TAU_2_32F ? TAU_2_32F : grdDiff; 
-    lcostVol[costVol_offset] = ( ALPHA * clrDiff + (1-ALPHA) * grdDiff );
+    const float cost = ( ALPHA * clrDiff + (1-ALPHA) * grdDiff );
+    lcostVol[costVol_offset] = cost;
 
 
 	/* *************** Right to Left Cost Volume Construction ********************** */
-    clrDiff = 0;
-    grdDiff = 0;
-
+    // The cost is symmetric in its two pixels, so the right cost at x - d is the left cost at x
+    // (a shear of the left slice) and only the right border is computed here.
     if(x >= d)
-    {
-        // three color diff
-        clrDiff = (fabs(rImgR[offset] - lImgR[offset + d]) 
-				+ fabs(rImgG[offset] - lImgG[offset + d]) 
-				+ fabs(rImgB[offset] - lImgB[offset + d]))/3;
-        // gradient diff
-        grdDiff = fabs(rGrdX[offset] - lGrdX[offset + d]);
-    }
-    else
+        rcostVol[costVol_offset - d] = cost;
+
+    if(x + d >= width)
     {
         // three color diff at img boundary
         clrDiff = (fabs(rImgR[offset] - 1.0f) 
@@ -414,17 +410,29 @@ __kernel void cvc_float_nv(__global const float* lImgR,
 				+ fabs(rImgB[offset] - 1.0f))/3;
         // gradient diff
         grdDiff = fabs(rGrdX[offset] - 1.0f);
+
+        clrDiff = clrDiff > TAU_1_32F ? TAU_1_32F : clrDiff; 
+        grdDiff = grdDiff > TAU_2_32F ? TAU_2_32F : grdDiff; 
+        rcostVol[costVol_offset] = ( ALPHA * clrDiff + (1-ALPHA) * grdDiff );
     }
+}
 
-    clrDiff = clrDiff > TAU_1_32F ? TAU_1_32F : clrDiff; 
-    grdDiff = grdDiff > TAU_2_32F ? TAU_2_32F : grdDiff; 
-    rcostVol[costVol_offset] = ( ALPHA * clrDiff + (1-ALPHA) * grdDiff );
+//Matching cost of colour a & gradient ga against colour b & gradient gb, as in cvc_float_nv
+inline float cvc_cost(const float3 a, const float3 b, const float ga, const float gb)
+{
+	const float3 c = fabs(a - b);
+	const float clrDiff = min((c.x + c.y + c.z)/3, TAU_1_32F);
+	const float grdDiff = min(fabs(ga - gb), TAU_2_32F);
+	return ALPHA * clrDiff + (1-ALPHA) * grdDiff;
 }
 
+#define CVC_PIXEL(R, G, B, o) ((float3)(R[o], G[o], B[o]))
+
 /**
- * \brief Cost Volume Construction kernel function.
- * \param[in] lImg - Left Input image data.
- * \param[in] rImg - Right Input image data.
+ * \brief Cost Volume Construction kernel function, four pixels of a row per work-item.
+ *        Takes the same arguments as cvc_float_nv, global size (ceil(width/4), height, maxDis).
+ * \param[in] lImgR, lImgG, lImgB - Left Input image planes.
+ * \param[in] rImgR, rImgG, rImgB - Right Input image planes.
  * \param[in] lGrdX - Left Input X dim gradient data.
  * \param[in] rGrdX - Right Input X dim gradient data.
  * \param[in] height - Height of the image.
@@ -432,100 +440,178 @@ __kernel void cvc_float_nv(__global const float* lImgR,
  * \param[out] lcostVol - Calculated pixel cost for Cost Volume.
  * \param[out] rcostVol - Calculated pixel cost for Cost Volume.
  */
-__kernel void cvc_float_v4(__global const float* restrict lImg,
-						      __global const float* restrict rImg,
-						      __global const float* restrict lGrdX,
-						      __global const float* restrict rGrdX,
-						      const int height,
-						      const int width,
-						      __global float* restrict lcostVol,
-						      __global float* restrict rcostVol)
+__kernel void cvc_float_v4(__global const float* lImgR,
+							__global const float* lImgG,
+							__global const float* lImgB,
+					        __global const float* rImgR,
+					        __global const float* rImgG,
+					        __global const float* rImgB,
+					        __global const float* lGrdX,
+							__global const float* rGrdX,
+                  			const int height,
+                  			const int width,
+                  			__global float* lcostVol,
+                  			__global float* rcostVol)
 {
-    /* [Kernel size] */
-    /*
-     * Each kernel calculates a single output pixels in the same row.
-     * column (x) is in the range [0, width].
-     * row (y) is in the range [0, height].
-     */
     const int x = get_global_id(0) * 4;
     const int y = get_global_id(1);
     const int d = get_global_id(2);
+    if(x >= width || y >= height)
+        return;
 
-    /* Offset calculates the position in the linear data for the row and the column. */
-    int img_offset = y * width + x;
+    const int offset = y * width + x;
     const int costVol_offset = ((d * height) + y) * width + x;
 
-///	/* *************** Left to Right Cost Volume Construction ********************** */
-    // Set addresses for lImg, rImg, lGrdX and rGrdX.
-    float16 rC, lC = vload16(0, lImg + (img_offset * 3));
-    float4 rGX, lGX = vload4(0, lGrdX + img_offset);
-
-    float4 clrDiff = 0;
-    float4 grdDiff = 0;
-
-    if(x - d >= 0)
+    //Left costs, each also stored as the right cost at x - d (the right slice is a shear of the left)
+    if(x + 4 <= width && x >= d)
     {
-		img_offset = y * width + x - d;
-    	rC = vload16(0, rImg + (img_offset * 3));
-    	rGX = vload4(0, rGrdX + img_offset);
-
-        // three color diff
-        lC = fabs(lC - rC);
-        // gradient diff
-        grdDiff = fabs(lGX - rGX);
+        const float4 clrDiff = (fabs(vload4(0, lImgR + offset) - vload4(0, rImgR + offset - d))
+                              + fabs(vload4(0, lImgG + offset) - vload4(0, rImgG + offset - d))
+                              + fabs(vload4(0, lImgB + offset) - vload4(0, rImgB + offset - d)))/3;
+        const float4 grdDiff = fabs(vload4(0, lGrdX + offset) - vload4(0, rGrdX + offset - d));
+        const float4 cost = ALPHA * min(clrDiff, TAU_1_32F) + (1-ALPHA) * min(grdDiff, TAU_2_32F);
+        vstore4(cost, 0, lcostVol + costVol_offset);
+        vstore4(cost, 0, rcostVol + costVol_offset - d);
     }
     else
     {
-        // three color diff at img boundary
-        lC = fabs(lC - 1.0f); //BORDER_CONSTANT = 1.0
-        // gradient diff
-        grdDiff = fabs(lGX - 1.0f); //BORDER_CONSTANT = 1.0
+        //Left border & the end of the row, one pixel at a time
+        for(int i = 0; i < 4 && x + i < width; i++)
+        {
+            const int o = offset + i;
+            if(x + i >= d)
+            {
+                const float cost = cvc_cost(CVC_PIXEL(lImgR, lImgG, lImgB, o), CVC_PIXEL(rImgR, rImgG, rImgB, o - d), lGrdX[o], rGrdX[o - d]);
+                lcostVol[costVol_offset + i] = cost;
+                rcostVol[costVol_offset + i - d] = cost;
+            }
+            else
+                lcostVol[costVol_offset + i] = cvc_cost(CVC_PIXEL(lImgR, lImgG, lImgB, o), (float3)1.0f, lGrdX[o], 1.0f);
+        }
     }
-    clrDiff = (float4)(lC.s0 + lC.s1 + lC.s2,
-					lC.s3 + lC.s4 + lC.s5,
-					lC.s6 + lC.s7 + lC.s8,
-					lC.s9 + lC.sa + lC.sb) * 0.3333333333f;
 
-    clrDiff = clrDiff > 0.028f ? 0.028f : clrDiff;
-    grdDiff = grdDiff > 0.008f ? 0.008f : grdDiff;
-    vstore4(0.9f * clrDiff + 0.1f * grdDiff, 0, lcostVol + costVol_offset); //data, offset, addr
-//	*(lcostVol + costVol_offset + 4) = 0.9 * clrDiff.s4 + 0.1 * grdDiff.s4;
+    //Right border, the pixels without a left pair
+    for(int i = 0; i < 4 && x + i < width; i++)
+    {
+        const int o = offset + i;
+        if(x + i + d >= width)
+            rcostVol[costVol_offset + i] = cvc_cost(CVC_PIXEL(rImgR, rImgG, rImgB, o), (float3)1.0f, rGrdX[o], 1.0f);
+    }
+}
 
+/**
+ * \brief Cost Volume Construction kernel function, all disparities of a pixel per work-item.
+ *        Takes the arguments of cvc_float_nv plus maxDis, global size (width, height).
+ * \param[in] maxDis - Number of disparity slices.
+ */
+__kernel void cvc_float_dl(__global const float* lImgR,
+							__global const float* lImgG,
+							__global const float* lImgB,
+					        __global const float* rImgR,
+					        __global const float* rImgG,
+					        __global const float* rImgB,
+					        __global const float* lGrdX,
+							__global const float* rGrdX,
+                  			const int height,
+                  			const int width,
+                  			__global float* lcostVol,
+                  			__global float* rcostVol,
+                  			const int maxDis)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    if(x >= width || y >= height)
+        return;
 
-///	/* *************** Right to Left Cost Volume Construction ********************** */
-	// Set addresses for lImg, rImg, lGrdX and rGrdX.
-    img_offset = y * width + x;
-    lC  = vload16(0, rImg + (img_offset * 3));
-    lGX = vload4(0, rGrdX + img_offset);
+    const int offset = y * width + x;
+    const int sliceSize = width * height;
+    const float3 l = CVC_PIXEL(lImgR, lImgG, lImgB, offset);
+    const float lGX = lGrdX[offset];
+    const float lBorder = cvc_cost(l, (float3)1.0f, lGX, 1.0f);
+    const float rBorder = cvc_cost(CVC_PIXEL(rImgR, rImgG, rImgB, offset), (float3)1.0f, rGrdX[offset], 1.0f);
+
+    //Each left cost is also the right cost at x - d (the right slice is a shear of the left),
+    //so only the right border is computed for the right view
+    __global float* lCost = lcostVol + offset;
+    __global float* rCost = rcostVol + offset;
+    for(int d = 0; d < maxDis; d++, lCost += sliceSize, rCost += sliceSize)
+    {
+        if(x >= d)
+        {
+            const float cost = cvc_cost(l, CVC_PIXEL(rImgR, rImgG, rImgB, offset - d), lGX, rGrdX[offset - d]);
+            *lCost = cost;
+            rCost[-d] = cost;
+        }
+        else
+            *lCost = lBorder;
+        if(x + d >= width)
+            *rCost = rBorder;
+    }
+}
 
-    grdDiff = 0;
+//Grey level as cvtColor(CV_RGB2GRAY)
+inline float cvc_gray(const float3 c)
+{
+	return 0.299f * c.x + 0.587f * c.y + 0.114f * c.z;
+}
 
-    if(x + d < width)
-    {
-		img_offset = y * width + x + d;
-    	rC  = vload16(0, lImg + (img_offset * 3));
-    	rGX = vload4(0, lGrdX + img_offset);
+//Writes the planes of pixel x and its X gradient as Sobel(dx = 1, ksize = 1) + 0.5,
+//c0 & c2 are the left & right neighbours (reflected at the image border)
+inline void cvc_store(const float3 c0, const float3 c1, const float3 c2, const int offset,
+						__global float* ImgR, __global float* ImgG, __global float* ImgB, __global float* GrdX)
+{
+	ImgR[offset] = c1.x;
+	ImgG[offset] = c1.y;
+	ImgB[offset] = c1.z;
+	GrdX[offset] = cvc_gray(c2) - cvc_gray(c0) + 0.5f;
+}
 
-        // three color diff
-        lC = fabs(lC - rC);
-        // gradient diff
-        grdDiff = fabs(lGX - rGX);
-    }
-    else
-    {
-        // three color diff at img boundary
-        lC = fabs(lC - 1.0f); //BORDER_CONSTANT = 1.0
-        // gradient diff
-        grdDiff = fabs(lGX - 1.0f); //BORDER_CONSTANT = 1.0
-    }
-    clrDiff = (float4)(lC.s0 + lC.s1 + lC.s2,
-					lC.s3 + lC.s4 + lC.s5,
-					lC.s6 + lC.s7 + lC.s8,
-					lC.s9 + lC.sa + lC.sb) * 0.3333333333f;
-
-    clrDiff = clrDiff > 0.028f ? 0.028f : clrDiff;
-    grdDiff = grdDiff > 0.008f ? 0.008f : grdDiff;
-	vstore4(0.9f * clrDiff + 0.1f * grdDiff, 0, rcostVol + costVol_offset); //data, offset, addr
-	//*(rcostVol + costVol_offset + 4) = 0.9 * clrDiff.s4 + 0.1 * grdDiff.s4;
+/**
+ * \brief Splits an interleaved 3-channel float frame into planes and computes its X gradient.
+ * \param[in] img - Interleaved input frame.
+ * \param[in] height - Height of the image.
+ * \param[in] width - Width of the image.
+ * \param[out] ImgR, ImgG, ImgB - Colour planes.
+ * \param[out] GrdX - X dim gradient.
+ */
+__kernel void cvc_split_float(__global const float* img,
+							const int height,
+							const int width,
+							__global float* ImgR,
+							__global float* ImgG,
+							__global float* ImgB,
+							__global float* GrdX)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int offset = y * width + x;
+	const int x0 = x > 0 ? x - 1 : min(1, width - 1);
+	const int x2 = x < width - 1 ? x + 1 : max(width - 2, 0);
+
+	cvc_store(vload3(y * width + x0, img), vload3(offset, img), vload3(y * width + x2, img), offset,
+				ImgR, ImgG, ImgB, GrdX);
 }
 
+/**
+ * \brief As cvc_split_float for an 8-bit frame, scaled to [0, 1] on the device.
+ */
+__kernel void cvc_split_uchar(__global const uchar* img,
+							const int height,
+							const int width,
+							__global float* ImgR,
+							__global float* ImgG,
+							__global float* ImgB,
+							__global float* GrdX)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int offset = y * width + x;
+	const int x0 = x > 0 ? x - 1 : min(1, width - 1);
+	const int x2 = x < width - 1 ? x + 1 : max(width - 2, 0);
+	const float scale = 1.0f / UCHAR_MAX;
+
+	cvc_store(convert_float3(vload3(y * width + x0, img)) * scale,
+				convert_float3(vload3(offset, img)) * scale,
+				convert_float3(vload3(y * width + x2, img)) * scale, offset,
+				ImgR, ImgG, ImgB, GrdX);
+}
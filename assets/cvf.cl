@@ -8,676 +8,302 @@
   ---------------------------------------------------------------------------*/
 
 //#########################################################################################
-//# Float Kernel Versions (_32F)
+//# Fused Guided Filter Kernels (_32F)
 //#########################################################################################
+//
+// Each work-group filters a GIF_TILE x GIF_TILE tile: the tile plus a GIF_R halo is
+// loaded into local memory once (edges clamped), summed along the rows and then along
+// the columns, so every box mean is formed without a full-size intermediate buffer.
+// GIF_TILE must match CVF_TILE in CVF_cl.h.
+//
+#define GIF_R 4
+#define GIF_TILE 16
+#define GIF_TS (GIF_TILE + 2*GIF_R)
+#define GIF_SCALE (1.0f / (float)((2*GIF_R + 1) * (2*GIF_R + 1)))
 
 /**
- * \brief Kernel function for element-wise multiplication of 3D and 3D Matricies.
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
+ * \brief Guide statistics: box means of I and the 3x3 covariance matrix of I.
+ * \param[in] Ir, Ig, Ib - Guide image planes.
  * \param[in] width - Image Width.
  * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
+ * \param[out] mean_Ir, mean_Ig, mean_Ib - Box means of the guide.
+ * \param[out] var_Irr ... var_Ibb - Upper triangle of Sigma (no eps).
  */
-
-__kernel void EWMul_SameDim_32F(__global const float* pIn_a,
-								__global const float* pIn_b,
-								const int width,
-								const int height,
-			              		__global float* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset = (((d * height) + y) * width) + x;
-
-	pOut[offset] = pIn_a[offset] * pIn_b[offset];
-}
-
-/**
- * \brief Kernel function for element-wise multiplication of 2D and 3D Matricies.
- * \param[in] pIn_a -  First Input Matrix (2D).
- * \param[in] pIn_b -  Second Input Matrix (3D).
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-
-__kernel void EWMul_DiffDim_32F(__global const float* pIn_a,
-								__global const float* pIn_b,
-								const int width,
-								const int height,
-			              		__global float* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset2D = (y * width) + x;
-    const int offset3D = (((d * height) + y) * width) + x;
-
-	pOut[offset3D] = pIn_a[offset2D] * pIn_b[offset3D];
-}
-
-/**
- * \brief Kernel function for element-wise division of 3D and 3D Matricies.
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-
-__kernel void EWDiv_SameDim_32F(__global const float* pIn_a,
-								__global const float* pIn_b,
-								const int width,
-								const int height,
-			              		__global float* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset = (((d * height) + y) * width) + x;
-
-	pOut[offset] = pIn_a[offset] / pIn_b[offset];
-}
-
-/**
- * \brief Kernel function for channel division of an RGB image
- * \param[in] pImg -  3-channel RGB Input image.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pIr -  Red channel output.
- * \param[out] pIg -  Green channel output.
- * \param[out] pIb -  Blue channel output.
- */
-
-__kernel void Split_32F(__global const float* pImg,
-						const int width,
-						__global float* pIr,
-						__global float* pIg,
-						__global float* pIb)
-{
-    const int x = get_global_id(0) * 12;
-    const int y = get_global_id(1);
-
-    const int offset = (y * width) + x;
-
-	pIr[offset] = pImg[offset];
-	pIg[offset] = pImg[offset + 1];
-	pIb[offset] = pImg[offset + 2];
-
-	pIr[offset + 1] = pImg[offset + 3];
-	pIg[offset + 1] = pImg[offset + 4];
-	pIb[offset + 1] = pImg[offset + 5];
-
-	pIr[offset + 2] = pImg[offset + 6];
-	pIg[offset + 2] = pImg[offset + 7];
-	pIb[offset + 2] = pImg[offset + 8];
-
-	pIr[offset + 3] = pImg[offset + 9];
-	pIg[offset + 3] = pImg[offset + 10];
-	pIb[offset + 3] = pImg[offset + 11];
-}
-
-/**
- * \brief Kernel function for the subtraction of 2 matricies
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-
-__kernel void Subtract_32F(__global const float* pIn_a,
-						__global const float* pIn_b,
-						const int width,
-						const int height,
-    	              	__global float* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset = (((d * height) + y) * width) + x;
-
-	pOut[offset] = pIn_a[offset] - pIn_b[offset];
-}
-
-/**
- * \brief Kernel function for the addition of 2 matricies
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-
-__kernel void Add_32F(__global const float* pIn_a,
-					__global const float* pIn_b,
-					const int width,
-					const int height,
-					__global float* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset = (((d * height) + y) * width) + x;
-
-	pOut[offset] = pIn_a[offset] + pIn_b[offset];
-}
-
-/**
- * \brief Volume BoxFiltering kernel function.
- * \param[in] pIn -  Input data.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output filtered data.
- */
-__kernel void BoxFilter_32F(__global const float* pIn,
+__kernel void GIF_Guide_32F(__global const float* Ir,
+							__global const float* Ig,
+							__global const float* Ib,
 							const int width,
 							const int height,
-		              		__global float* pOut)
+							__global float* mean_Ir,
+							__global float* mean_Ig,
+							__global float* mean_Ib,
+							__global float* var_Irr,
+							__global float* var_Irg,
+							__global float* var_Irb,
+							__global float* var_Igg,
+							__global float* var_Igb,
+							__global float* var_Ibb)
 {
-    int load_rows = 9;
-
-    /* [Kernel size] */
-    /* Each kernel calculates a single output pixel.
-     * column (x) is in the range [0, width].
-     * row (y) is in the range [0, height].
-     * disparity (d) is in the range [0, maxDis].
-     */
-    const int x = get_global_id(0) * 16;
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
+	__local float tI[3][GIF_TS][GIF_TS];
+	__local float rs[9][GIF_TS][GIF_TILE];
 
-    const int offset = (((d * height) + y) * width) + x;
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lid = ly * GIF_TILE + lx;
+	const int x0 = get_group_id(0) * GIF_TILE - GIF_R;
+	const int y0 = get_group_id(1) * GIF_TILE - GIF_R;
 
-	float16 row[9][9];
-	float16 res;
-
-	for (int r=0; r<load_rows; r++)
+	for(int i = lid; i < GIF_TS * GIF_TS; i += GIF_TILE * GIF_TILE)
 	{
-			row[r][0] = vload16(0, pIn + offset + width*r);
-			row[r][8] = vload16(0, pIn + offset + width*r + 8);
-			row[r][1] = (float16)(row[r][0].s12345678, row[r][8].s12345678);
-			row[r][2] = (float16)(row[r][0].s23456789, row[r][8].s23456789);
-			row[r][3] = (float16)(row[r][0].s3456789a, row[r][8].s3456789a);
-			row[r][4] = (float16)(row[r][0].s456789ab, row[r][8].s456789ab);
-			row[r][5] = (float16)(row[r][0].s56789abc, row[r][8].s56789abc);
-			row[r][6] = (float16)(row[r][0].s6789abcd, row[r][8].s6789abcd);
-			row[r][7] = (float16)(row[r][0].s789abcde, row[r][8].s789abcde);
+		const int ty = i / GIF_TS;
+		const int tx = i - ty * GIF_TS;
+		const int offset = clamp(y0 + ty, 0, height - 1) * width + clamp(x0 + tx, 0, width - 1);
+		tI[0][ty][tx] = Ir[offset];
+		tI[1][ty][tx] = Ig[offset];
+		tI[2][ty][tx] = Ib[offset];
 	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-	for (int r=0; r<9; r++)
+	//Row sums of I and of the six products I_i * I_j
+	for(int i = lid; i < GIF_TS * GIF_TILE; i += GIF_TILE * GIF_TILE)
 	{
-		for (int c=0; c<9; c++)
+		const int ty = i / GIF_TILE;
+		const int tx = i - ty * GIF_TILE;
+		float s[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+		for(int k = 0; k <= 2 * GIF_R; k++)
 		{
-			res += row[r][c];
+			const float r = tI[0][ty][tx + k];
+			const float g = tI[1][ty][tx + k];
+			const float b = tI[2][ty][tx + k];
+			s[0] += r; s[1] += g; s[2] += b;
+			s[3] += r * r; s[4] += r * g; s[5] += r * b;
+			s[6] += g * g; s[7] += g * b; s[8] += b * b;
 		}
+		for(int c = 0; c < 9; c++)
+			rs[c][ty][tx] = s[c];
 	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-	vstore16(res/81, 0, pOut + offset + 4);
-}
-
-/**
- * \brief Volume Cost Volume Filter kernel function.
- */
-__kernel void var_math_32F(__global const float* mean_Ir,
-							__global const float* mean_Ig,
-							__global const float* mean_Ib,
-							__global const float* mean_Irr,
-							__global const float* mean_Irg,
-							__global const float* mean_Irb,
-							__global const float* mean_Igg,
-							__global const float* mean_Igb,
-							__global const float* mean_Ibb,
-							const int width,
-							const int height,
-					  		__global float* var_Irr,
-					  		__global float* var_Irg,
-					  		__global float* var_Irb,
-					  		__global float* var_Igg,
-					  		__global float* var_Igb,
-					  		__global float* var_Ibb)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-	
-    const int offset = (((d * height) + y) * width) + x;
-	
-	var_Irr[offset] = mean_Irr[offset] - (mean_Ir[offset] * mean_Ir[offset]);
-	var_Irg[offset] = mean_Irg[offset] - (mean_Ir[offset] * mean_Ig[offset]);
-	var_Irb[offset] = mean_Irb[offset] - (mean_Ir[offset] * mean_Ib[offset]);
-	var_Igg[offset] = mean_Igg[offset] - (mean_Ig[offset] * mean_Ig[offset]);
-	var_Igb[offset] = mean_Igb[offset] - (mean_Ig[offset] * mean_Ib[offset]);
-	var_Ibb[offset] = mean_Ibb[offset] - (mean_Ib[offset] * mean_Ib[offset]);
-	
-}
-
-__kernel void cent_filter_32F(__global const float* mean_Ir,
-								__global const float* mean_Ig,
-								__global const float* mean_Ib,
-								__global const float* var_Irr,
-								__global const float* var_Irg,
-								__global const float* var_Irb,
-								__global const float* var_Igg,
-								__global const float* var_Igb,
-								__global const float* var_Ibb,
-								__global const float* cov_Ip_r,
-								__global const float* cov_Ip_g,
-								__global const float* cov_Ip_b,
-								const int width,
-								const int height,
-								__global float* a_r,
-								__global float* a_g,
-								__global float* a_b,
-								__global float* mean_cv)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-	const float eps = 0.0001f;
-	
-    const int offset3D = (((d * height) + y) * width) + x;
-    const int offset2D = (y * width) + x;
-	
-	float c0 = cov_Ip_r[offset3D];
-	float c1 = cov_Ip_g[offset3D];
-	float c2 = cov_Ip_b[offset3D];
-	float a11 = var_Irr[offset2D] + eps;
-	float a12 = var_Irg[offset2D];
-	float a13 = var_Irb[offset2D];
-	float a21 = var_Irg[offset2D];
-	float a22 = var_Igg[offset2D] + eps;
-	float a23 = var_Igb[offset2D];
-	float a31 = var_Irb[offset2D];
-	float a32 = var_Igb[offset2D];
-	float a33 = var_Ibb[offset2D] + eps;
-
-	float DET = 1/ ( a11 * ( a33 * a22 - a32 * a23 ) -
-		a21 * ( a33 * a12 - a32 * a13 ) +
-		a31 * ( a23 * a12 - a22 * a13 ) );
-
-	a_r[offset3D] = DET * (
-		c0 * ( a33 * a22 - a32 * a23 ) +
-		c1 * ( a31 * a23 - a33 * a21 ) +
-		c2 * ( a32 * a21 - a31 * a22 )
-		);
-	a_g[offset3D] = DET * (
-		c0 * ( a32 * a13 - a33 * a12 ) +
-		c1 * ( a33 * a11 - a31 * a13 ) +
-		c2 * ( a31 * a12 - a32 * a11 )
-		);
-	a_b[offset3D] = DET * (
-		c0 * ( a23 * a12 - a22 * a13 ) +
-		c1 * ( a21 * a13 - a23 * a11 ) +
-		c2 * ( a22 * a11 - a21 * a12 )
-		);
-
-	mean_cv[offset3D] = mean_cv[offset3D] - (
-		(a_r[offset3D] * mean_Ir[offset2D]) + 
-		(a_g[offset3D] * mean_Ig[offset2D]) + 
-		(a_b[offset3D] * mean_Ib[offset2D])
-		);
-}
-
-//#########################################################################################
-//# Unsigned Char Kernel Versions (_8U)
-//#########################################################################################
-
-/**
- * \brief Kernel function for element-wise multiplication of 3D and 3D Matricies.
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-__kernel void EWMul_SameDim_8U(__global const uchar* pIn_a,
-							__global const uchar* pIn_b,
-							const int width,
-							const int height,
-    	              		__global uchar* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset = mul24(mul24(d, height) + y, width) + x;
-
-	pOut[offset] = mul24(pIn_a[offset], pIn_b[offset]);
-	
-}
-
-/**
- * \brief Kernel function for element-wise multiplication of 2D and 3D Matricies.
- * \param[in] pIn_a -  First Input Matrix (2D).
- * \param[in] pIn_b -  Second Input Matrix (3D).
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-__kernel void EWMul_DiffDim_8U(__global const uchar* pIn_a,
-							__global const uchar* pIn_b,
-							const int width,
-							const int height,
-    	              		__global uchar* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset2D = mul24(y, width) + x;
-    const int offset3D = mul24(mul24(d, height) + y, width) + x;
+	float m[9];
+	for(int c = 0; c < 9; c++)
+	{
+		float sum = 0;
+		for(int k = 0; k <= 2 * GIF_R; k++)
+			sum += rs[c][ly + k][lx];
+		m[c] = sum * GIF_SCALE;
+	}
 
-	pOut[offset3D] = mul24(pIn_a[offset2D], pIn_b[offset3D]);
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if(x >= width || y >= height)
+		return;
+
+	const int offset = y * width + x;
+	mean_Ir[offset] = m[0];
+	mean_Ig[offset] = m[1];
+	mean_Ib[offset] = m[2];
+	var_Irr[offset] = m[3] - m[0] * m[0];
+	var_Irg[offset] = m[4] - m[0] * m[1];
+	var_Irb[offset] = m[5] - m[0] * m[2];
+	var_Igg[offset] = m[6] - m[1] * m[1];
+	var_Igb[offset] = m[7] - m[1] * m[2];
+	var_Ibb[offset] = m[8] - m[2] * m[2];
 }
 
 /**
- * \brief Kernel function for element-wise division of 3D and 3D Matricies.
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
+ * \brief Guided filter coefficients for a chunk of cost volume slices.
+ *        Forms mean_p and mean_Ip, the covariance cov_Ip and solves (Sigma + eps*U) a = cov_Ip.
+ * \param[in] costVol - Cost Volume (p), slices d0 .. d0 + get_global_size(2) - 1 are read.
+ * \param[in] Ir, Ig, Ib - Guide image planes.
+ * \param[in] mean_Ir ... var_Ibb - Guide statistics from GIF_Guide_32F.
  * \param[in] width - Image Width.
  * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
+ * \param[in] d0 - First disparity of the chunk.
+ * \param[in] eps - Regularisation.
+ * \param[out] a_r, a_g, a_b, b - Coefficients, slice z of the chunk at z * width * height.
  */
-__kernel void EWDiv_SameDim_8U(__global const uchar* pIn_a,
-							__global const uchar* pIn_b,
+__kernel void GIF_Coeffs_32F(__global const float* costVol,
+							__global const float* Ir,
+							__global const float* Ig,
+							__global const float* Ib,
+							__global const float* mean_Ir,
+							__global const float* mean_Ig,
+							__global const float* mean_Ib,
+							__global const float* var_Irr,
+							__global const float* var_Irg,
+							__global const float* var_Irb,
+							__global const float* var_Igg,
+							__global const float* var_Igb,
+							__global const float* var_Ibb,
 							const int width,
 							const int height,
-    	              		__global uchar* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset = mul24(mul24(d, height) + y, width) + x;
-
-	pOut[offset] = pIn_a[offset] / pIn_b[offset];
-}
-
-/**
- * \brief Kernel function for channel division of an RGB image
- * \param[in] pImg -  3-channel RGB Input image.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pIr -  Red channel output.
- * \param[out] pIg -  Green channel output.
- * \param[out] pIb -  Blue channel output.
- */
-__kernel void Split_8U(__global const uchar* pImg,
-					const int width,
-					__global uchar* pIr,
-					__global uchar* pIg,
-					__global uchar* pIb)
-{
-    const int x = get_global_id(0) * 12;
-    const int y = get_global_id(1);
-
-    const int offset = (y * width) + x;
-
-	pIr[offset] = pImg[offset];
-	pIg[offset] = pImg[offset + 1];
-	pIb[offset] = pImg[offset + 2];
-
-	pIr[offset + 1] = pImg[offset + 3];
-	pIg[offset + 1] = pImg[offset + 4];
-	pIb[offset + 1] = pImg[offset + 5];
-
-	pIr[offset + 2] = pImg[offset + 6];
-	pIg[offset + 2] = pImg[offset + 7];
-	pIb[offset + 2] = pImg[offset + 8];
-
-	pIr[offset + 3] = pImg[offset + 9];
-	pIg[offset + 3] = pImg[offset + 10];
-	pIb[offset + 3] = pImg[offset + 11];
-}
-
-/**
- * \brief Kernel function for the subtraction of 2 matricies
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-__kernel void Subtract_8U(__global const uchar* pIn_a,
-						__global const uchar* pIn_b,
-						const int width,
-						const int height,
-    	              	__global uchar* pOut)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-
-    const int offset = mul24(mul24(d, height) + y, width) + x;
-
-	pOut[offset] = pIn_a[offset] - pIn_b[offset];
-}
-
-/**
- * \brief Kernel function for the addition of 2 matricies
- * \param[in] pIn_a -  First Input Matrix.
- * \param[in] pIn_b -  Second Input Matrix.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] pOut - Output Matrix.
- */
-__kernel void Add_8U(__global const uchar* pIn_a,
-					__global const uchar* pIn_b,
-					const int width,
-					const int height,
-					__global uchar* pOut)
+							const int d0,
+							const float eps,
+							__global float* a_r,
+							__global float* a_g,
+							__global float* a_b,
+							__global float* b)
 {
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
+	__local float tP[4][GIF_TS][GIF_TS];
+	__local float rs[4][GIF_TS][GIF_TILE];
+
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lid = ly * GIF_TILE + lx;
+	const int x0 = get_group_id(0) * GIF_TILE - GIF_R;
+	const int y0 = get_group_id(1) * GIF_TILE - GIF_R;
+	const int z = get_global_id(2);
+	__global const float* p = costVol + (d0 + z) * height * width;
+
+	//p, Ir*p, Ig*p, Ib*p
+	for(int i = lid; i < GIF_TS * GIF_TS; i += GIF_TILE * GIF_TILE)
+	{
+		const int ty = i / GIF_TS;
+		const int tx = i - ty * GIF_TS;
+		const int offset = clamp(y0 + ty, 0, height - 1) * width + clamp(x0 + tx, 0, width - 1);
+		const float pv = p[offset];
+		tP[0][ty][tx] = pv;
+		tP[1][ty][tx] = Ir[offset] * pv;
+		tP[2][ty][tx] = Ig[offset] * pv;
+		tP[3][ty][tx] = Ib[offset] * pv;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-    const int offset = mul24(mul24(d, height) + y, width) + x;
+	for(int i = lid; i < 4 * GIF_TS * GIF_TILE; i += GIF_TILE * GIF_TILE)
+	{
+		const int c = i / (GIF_TS * GIF_TILE);
+		const int j = i - c * (GIF_TS * GIF_TILE);
+		const int ty = j / GIF_TILE;
+		const int tx = j - ty * GIF_TILE;
+		float sum = 0;
+		for(int k = 0; k <= 2 * GIF_R; k++)
+			sum += tP[c][ty][tx + k];
+		rs[c][ty][tx] = sum;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-	pOut[offset] = pIn_a[offset] + pIn_b[offset];
-}
+	float m[4];
+	for(int c = 0; c < 4; c++)
+	{
+		float sum = 0;
+		for(int k = 0; k <= 2 * GIF_R; k++)
+			sum += rs[c][ly + k][lx];
+		m[c] = sum * GIF_SCALE;
+	}
 
-/**
- * \brief Variance Calculation kernel function.
- * \param[in] meanIx -  BoxFiltered Image Channel Matricies.
- * \param[in] meanIxx - BoxFiltered Cross-channel multiplied Image Matricies.
- * \param[in] width - Image Width.
- * \param[in] height - Image Height.
- * \param[out] var_Ixx - Cross-channel Variance Image Matricies.
- */
-__kernel void var_math_8U(__global const uchar* mean_Ir,
-							__global const uchar* mean_Ig,
-							__global const uchar* mean_Ib,
-							__global const uchar* mean_Irr,
-							__global const uchar* mean_Irg,
-							__global const uchar* mean_Irb,
-							__global const uchar* mean_Igg,
-							__global const uchar* mean_Igb,
-							__global const uchar* mean_Ibb,
-							const int width,
-							const int height,
-					  		__global uchar* var_Irr,
-					  		__global uchar* var_Irg,
-					  		__global uchar* var_Irb,
-					  		__global uchar* var_Igg,
-					  		__global uchar* var_Igb,
-					  		__global uchar* var_Ibb)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-	
-    const int offset = mul24(mul24(d, height) + y, width) + x;
-	
-	var_Irr[offset] = mean_Irr[offset] - mul24(mean_Ir[offset] , mean_Ir[offset]);
-	var_Irg[offset] = mean_Irg[offset] - mul24(mean_Ir[offset] , mean_Ig[offset]);
-	var_Irb[offset] = mean_Irb[offset] - mul24(mean_Ir[offset] , mean_Ib[offset]);
-	var_Igg[offset] = mean_Igg[offset] - mul24(mean_Ig[offset] , mean_Ig[offset]);
-	var_Igb[offset] = mean_Igb[offset] - mul24(mean_Ig[offset] , mean_Ib[offset]);
-	var_Ibb[offset] = mean_Ibb[offset] - mul24(mean_Ib[offset] , mean_Ib[offset]);
-	
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if(x >= width || y >= height)
+		return;
+
+	const int offset2D = (y * width) + x;
+	const int offset3D = (((z * height) + y) * width) + x;
+
+	const float mIr = mean_Ir[offset2D];
+	const float mIg = mean_Ig[offset2D];
+	const float mIb = mean_Ib[offset2D];
+	const float c0 = m[1] - mIr * m[0];
+	const float c1 = m[2] - mIg * m[0];
+	const float c2 = m[3] - mIb * m[0];
+
+	const float a11 = var_Irr[offset2D] + eps;
+	const float a12 = var_Irg[offset2D];
+	const float a13 = var_Irb[offset2D];
+	const float a22 = var_Igg[offset2D] + eps;
+	const float a23 = var_Igb[offset2D];
+	const float a33 = var_Ibb[offset2D] + eps;
+
+	//Sigma is symmetric: solve with its cofactors
+	const float i11 = a33 * a22 - a23 * a23;
+	const float i12 = a13 * a23 - a33 * a12;
+	const float i13 = a23 * a12 - a22 * a13;
+	const float i22 = a33 * a11 - a13 * a13;
+	const float i23 = a13 * a12 - a23 * a11;
+	const float i33 = a22 * a11 - a12 * a12;
+	const float DET = 1 / (a11 * i11 + a12 * i12 + a13 * i13);
+
+	const float ar = DET * (c0 * i11 + c1 * i12 + c2 * i13);
+	const float ag = DET * (c0 * i12 + c1 * i22 + c2 * i23);
+	const float ab = DET * (c0 * i13 + c1 * i23 + c2 * i33);
+
+	a_r[offset3D] = ar;
+	a_g[offset3D] = ag;
+	a_b[offset3D] = ab;
+	b[offset3D] = m[0] - (ar * mIr + ag * mIg + ab * mIb);
 }
 
 /**
- * \brief Central Cost Volume Filter kernel function.
- * \param[in] meanIx -  BoxFiltered Image Channel Matricies.
- * \param[in] var_Ixx - Cross-channel Variance Image Matricies.
- * \param[in] cov_Ix - Covariance Image Channel Matricies.
+ * \brief Guided filter output: q = mean_a . I + mean_b, written over the chunk's cost volume slices.
+ * \param[in] a_r, a_g, a_b, b - Coefficients from GIF_Coeffs_32F.
+ * \param[in] Ir, Ig, Ib - Guide image planes.
  * \param[in] width - Image Width.
  * \param[in] height - Image Height.
- * \param[out] a_x - GIF Image Matricies.
+ * \param[in] d0 - First disparity of the chunk.
+ * \param[out] costVol - Filtered Cost Volume.
  */
-__kernel void cent_filter_8U(__global const uchar* mean_Ir,
-							__global const uchar* mean_Ig,
-							__global const uchar* mean_Ib,
-							__global const uchar* var_Irr,
-							__global const uchar* var_Irg,
-							__global const uchar* var_Irb,
-							__global const uchar* var_Igg,
-							__global const uchar* var_Igb,
-							__global const uchar* var_Ibb,
-							__global const uchar* cov_Ip_r,
-							__global const uchar* cov_Ip_g,
-							__global const uchar* cov_Ip_b,
+__kernel void GIF_Output_32F(__global const float* a_r,
+							__global const float* a_g,
+							__global const float* a_b,
+							__global const float* b,
+							__global const float* Ir,
+							__global const float* Ig,
+							__global const float* Ib,
 							const int width,
 							const int height,
-							__global uchar* a_r,
-							__global uchar* a_g,
-							__global uchar* a_b,
-							__global uchar* mean_cv)
-{
-    const int x = get_global_id(0);
-    const int y = get_global_id(1);
-    const int d = get_global_id(2);
-	const int eps = 1;
-
-    const int offset3D = (((d * height) + y) * width) + x;
-    const int offset2D = (y * width) + x;
-	
-	uchar c0 = cov_Ip_r[offset3D];
-	uchar c1 = cov_Ip_g[offset3D];
-	uchar c2 = cov_Ip_b[offset3D];
-	uchar a11 = var_Irr[offset2D] + eps;
-	uchar a12 = var_Irg[offset2D];
-	uchar a13 = var_Irb[offset2D];
-	uchar a21 = var_Irg[offset2D];
-	uchar a22 = var_Igg[offset2D] + eps;
-	uchar a23 = var_Igb[offset2D];
-	uchar a31 = var_Irb[offset2D];
-	uchar a32 = var_Igb[offset2D];
-	uchar a33 = var_Ibb[offset2D] + eps;
-
-	uchar DET = 1/ ( a11 * ( a33 * a22 - a32 * a23 ) -
-		a21 * ( a33 * a12 - a32 * a13 ) +
-		a31 * ( a23 * a12 - a22 * a13 ) );
-
-	a_r[offset3D] = DET * (
-		c0 * ( a33 * a22 - a32 * a23 ) +
-		c1 * ( a31 * a23 - a33 * a21 ) +
-		c2 * ( a32 * a21 - a31 * a22 )
-		);
-	a_g[offset3D] = DET * (
-		c0 * ( a32 * a13 - a33 * a12 ) +
-		c1 * ( a33 * a11 - a31 * a13 ) +
-		c2 * ( a31 * a12 - a32 * a11 )
-		);
-	a_b[offset3D] = DET * (
-		c0 * ( a23 * a12 - a22 * a13 ) +
-		c1 * ( a21 * a13 - a23 * a11 ) +
-		c2 * ( a22 * a11 - a21 * a12 )
-		);
-
-	mean_cv[offset3D] = mean_cv[offset3D] - (
-		(a_r[offset3D] * mean_Ir[offset2D]) + 
-		(a_g[offset3D] * mean_Ig[offset2D]) + 
-		(a_b[offset3D] * mean_Ib[offset2D])
-		);
-}
-
-// Row summation filter kernel with rescaling
-//*****************************************************************
-__kernel void BoxRows_32F(__global const float* fSource,
-						__global float* fDest,
-                        unsigned int uiWidth,
-						unsigned int uiHeight,
-						int iRadius,
-             			float fScale)
+							const int d0,
+							__global float* costVol)
 {
-    // Row to process (note:  1 dimensional workgroup and ND range used for row kernel)
-    size_t globalPosY = get_global_id(0);
-    size_t globalPosD = get_global_id(2);
-    size_t offset = ((globalPosD * uiHeight) + globalPosY) * uiWidth;
-    //size_t offset = mul24(mul24(globalPosD, uiHeight) + globalPosY, uiWidth);
-
-    // accumulator
-    float sum = 0;
-
-    // Do the left boundary
-    for(int x = -iRadius; x <= iRadius; x++)
-    {
-        sum += fSource[offset + x];
-    }
-    fDest[offset] = sum * fScale;
+	__local float tC[4][GIF_TS][GIF_TS];
+	__local float rs[4][GIF_TS][GIF_TILE];
+
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lid = ly * GIF_TILE + lx;
+	const int x0 = get_group_id(0) * GIF_TILE - GIF_R;
+	const int y0 = get_group_id(1) * GIF_TILE - GIF_R;
+	const int z = get_global_id(2);
+	const int sliceOffset = z * height * width;
+
+	for(int i = lid; i < GIF_TS * GIF_TS; i += GIF_TILE * GIF_TILE)
+	{
+		const int ty = i / GIF_TS;
+		const int tx = i - ty * GIF_TS;
+		const int offset = sliceOffset + clamp(y0 + ty, 0, height - 1) * width + clamp(x0 + tx, 0, width - 1);
+		tC[0][ty][tx] = a_r[offset];
+		tC[1][ty][tx] = a_g[offset];
+		tC[2][ty][tx] = a_b[offset];
+		tC[3][ty][tx] = b[offset];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-    // Do the rest of the image
-    for(uint x = 1; x < uiWidth; x++) 
-    {
-        sum += fSource[offset + x + iRadius];
-        sum -= fSource[offset + x - iRadius - 1];
-        fDest[offset + x] = sum * fScale;
-    }  
-}
+	for(int i = lid; i < 4 * GIF_TS * GIF_TILE; i += GIF_TILE * GIF_TILE)
+	{
+		const int c = i / (GIF_TS * GIF_TILE);
+		const int j = i - c * (GIF_TS * GIF_TILE);
+		const int ty = j / GIF_TILE;
+		const int tx = j - ty * GIF_TILE;
+		float sum = 0;
+		for(int k = 0; k <= 2 * GIF_R; k++)
+			sum += tC[c][ty][tx + k];
+		rs[c][ty][tx] = sum;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-// Column kernel using coalesced global memory reads
-//*****************************************************************
-__kernel void BoxCols_32F(__global float* fInputImage, 
-						__global float* fOutputImage, 
-						unsigned int uiWidth, 
-						unsigned int uiHeight, 
-						int iRadius, 
-						float fScale)
-{
-	size_t globalPosX = get_global_id(0);
-	size_t globalPosD = get_global_id(2);
-    size_t offset = mul24(mul24(globalPosD, uiHeight), uiWidth) + globalPosX;
-    fInputImage = &fInputImage[offset];
-    fOutputImage = &fOutputImage[offset];
+	float m[4];
+	for(int c = 0; c < 4; c++)
+	{
+		float sum = 0;
+		for(int k = 0; k <= 2 * GIF_R; k++)
+			sum += rs[c][ly + k][lx];
+		m[c] = sum * GIF_SCALE;
+	}
 
-    // do left edge
-    float fSum;
-    fSum = fInputImage[0] * (float)(iRadius);
-    for (int y = 0; y < iRadius + 1; y++) 
-    {
-        fSum += fInputImage[y * uiWidth];
-    }
-    fOutputImage[0] = fSum * fScale;
-    for(int y = 1; y < iRadius + 1; y++) 
-    {
-        fSum += fInputImage[(y + iRadius) * uiWidth];
-        fSum -= fInputImage[0];
-        fOutputImage[y * uiWidth] = fSum * fScale;
-    }
-    
-    // main loop
-    for(int y = iRadius + 1; y < uiHeight - iRadius; y++) 
-    {
-        fSum += fInputImage[(y + iRadius) * uiWidth];
-        fSum -= fInputImage[((y - iRadius) * uiWidth) - uiWidth];
-        fOutputImage[y * uiWidth] = fSum * fScale;
-    }
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if(x >= width || y >= height)
+		return;
 
-    // do right edge
-    for (int y = uiHeight - iRadius; y < uiHeight; y++) 
-    {
-        fSum += fInputImage[(uiHeight - 1) * uiWidth];
-        fSum -= fInputImage[((y - iRadius) * uiWidth) - uiWidth];
-        fOutputImage[y * uiWidth] = fSum * fScale;
-    }
+	const int offset2D = (y * width) + x;
+	costVol[(((d0 + z) * height) + y) * width + x] =
+		m[0] * Ir[offset2D] + m[1] * Ig[offset2D] + m[2] * Ib[offset2D] + m[3];
 }
@@ -0,0 +1,389 @@
+/*---------------------------------------------------------------------------
+   fgf.cl - OpenCL Fast Guided Filter Kernels
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+   All rights reserved.
+  ---------------------------------------------------------------------------*/
+
+//#########################################################################################
+//# Fast Guided Filter Kernels (_32F)
+//#########################################################################################
+//
+// The guide and the cost slices are sampled on the nearest-neighbour grid (xIdx, yIdx) of
+// the subsampled image, the coefficients are computed and box filtered at that resolution
+// and bilinearly upsampled (xofs/xalpha, yofs/yalpha) only to evaluate the output, as in
+// the CPU FastGuidedFilter. Box sums are formed in local memory tiles of FGF_TILE x FGF_TILE
+// pixels with a halo of radius <= FGF_RMAX, borders are reflected (BORDER_REFLECT_101).
+// FGF_TILE and FGF_RMAX must match those in FGF_cl.h.
+//
+#define FGF_TILE 16
+#define FGF_RMAX 8
+#define FGF_TS (FGF_TILE + 2*FGF_RMAX)
+
+inline int reflect101(int i, const int n)
+{
+	if(i < 0) i = -i;
+	if(i >= n) i = 2 * n - 2 - i;
+	return clamp(i, 0, n - 1);
+}
+
+//Row sums of the first 'planes' planes of tile (ts x ts) into rows (ts x FGF_TILE)
+inline void boxRows(__local const float* tile, __local float* rows, const int planes,
+					const int ts, const int radius, const int lid)
+{
+	for(int i = lid; i < planes * ts * FGF_TILE; i += FGF_TILE * FGF_TILE)
+	{
+		const int c = i / (ts * FGF_TILE);
+		const int j = i - c * (ts * FGF_TILE);
+		const int ty = j / FGF_TILE;
+		const int tx = j - ty * FGF_TILE;
+		__local const float* src = tile + (c * FGF_TS + ty) * FGF_TS + tx;
+		float sum = 0;
+		for(int k = 0; k <= 2 * radius; k++)
+			sum += src[k];
+		rows[(c * FGF_TS + ty) * FGF_TILE + tx] = sum;
+	}
+}
+
+//Column sum of plane c of rows at the work-item's pixel, normalised
+inline float boxCol(__local const float* rows, const int c, const int radius, const int lx, const int ly)
+{
+	__local const float* src = rows + (c * FGF_TS + ly) * FGF_TILE + lx;
+	float sum = 0;
+	for(int k = 0; k <= 2 * radius; k++)
+		sum += src[k * FGF_TILE];
+	return sum / (float)((2 * radius + 1) * (2 * radius + 1));
+}
+
+/**
+ * \brief Subsampled guide statistics: box means of I and the inverse of (Sigma + eps*U).
+ * \param[in] Ir, Ig, Ib - Full resolution guide image planes.
+ * \param[in] width - Image Width.
+ * \param[in] xIdx, yIdx - Full resolution column/row of each subsampled column/row.
+ * \param[in] lw, lh - Subsampled width & height.
+ * \param[in] radius - Box radius at the subsampled resolution.
+ * \param[in] eps - Regularisation.
+ * \param[out] mean_Ir, mean_Ig, mean_Ib - Box means of the guide.
+ * \param[out] inv_rr ... inv_bb - Upper triangle of the (symmetric) inverse.
+ */
+__kernel void FGF_Guide_32F(__global const float* Ir,
+							__global const float* Ig,
+							__global const float* Ib,
+							const int width,
+							__global const int* xIdx,
+							__global const int* yIdx,
+							const int lw,
+							const int lh,
+							const int radius,
+							const float eps,
+							__global float* mean_Ir,
+							__global float* mean_Ig,
+							__global float* mean_Ib,
+							__global float* inv_rr,
+							__global float* inv_rg,
+							__global float* inv_rb,
+							__global float* inv_gg,
+							__global float* inv_gb,
+							__global float* inv_bb)
+{
+	//The guide tile is only needed by the row pass, so the row sums of the nine
+	//statistics reuse its storage once every work-item holds its own in registers
+	__local float buf[9 * FGF_TS * FGF_TILE];
+	__local float* tI = buf;
+
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lid = ly * FGF_TILE + lx;
+	const int ts = FGF_TILE + 2 * radius;
+	const int x0 = get_group_id(0) * FGF_TILE - radius;
+	const int y0 = get_group_id(1) * FGF_TILE - radius;
+
+	for(int i = lid; i < ts * ts; i += FGF_TILE * FGF_TILE)
+	{
+		const int ty = i / ts;
+		const int tx = i - ty * ts;
+		const int offset = yIdx[reflect101(y0 + ty, lh)] * width + xIdx[reflect101(x0 + tx, lw)];
+		tI[(0 * FGF_TS + ty) * FGF_TS + tx] = Ir[offset];
+		tI[(1 * FGF_TS + ty) * FGF_TS + tx] = Ig[offset];
+		tI[(2 * FGF_TS + ty) * FGF_TS + tx] = Ib[offset];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//Row sums of I and of the six products I_i * I_j (at most two rows per work-item)
+	float s[2][9];
+	for(int n = 0, i = lid; n < 2; n++, i += FGF_TILE * FGF_TILE)
+	{
+		for(int c = 0; c < 9; c++)
+			s[n][c] = 0;
+		if(i >= ts * FGF_TILE)
+			continue;
+		const int ty = i / FGF_TILE;
+		const int tx = i - ty * FGF_TILE;
+		for(int k = 0; k <= 2 * radius; k++)
+		{
+			const float r = tI[(0 * FGF_TS + ty) * FGF_TS + tx + k];
+			const float g = tI[(1 * FGF_TS + ty) * FGF_TS + tx + k];
+			const float b = tI[(2 * FGF_TS + ty) * FGF_TS + tx + k];
+			s[n][0] += r; s[n][1] += g; s[n][2] += b;
+			s[n][3] += r * r; s[n][4] += r * g; s[n][5] += r * b;
+			s[n][6] += g * g; s[n][7] += g * b; s[n][8] += b * b;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int n = 0, i = lid; n < 2 && i < ts * FGF_TILE; n++, i += FGF_TILE * FGF_TILE)
+	{
+		const int ty = i / FGF_TILE;
+		const int tx = i - ty * FGF_TILE;
+		for(int c = 0; c < 9; c++)
+			buf[(c * FGF_TS + ty) * FGF_TILE + tx] = s[n][c];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	float m[9];
+	for(int c = 0; c < 9; c++)
+		m[c] = boxCol(buf, c, radius, lx, ly);
+
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if(x >= lw || y >= lh)
+		return;
+
+	const float a11 = m[3] - m[0] * m[0] + eps;
+	const float a12 = m[4] - m[0] * m[1];
+	const float a13 = m[5] - m[0] * m[2];
+	const float a22 = m[6] - m[1] * m[1] + eps;
+	const float a23 = m[7] - m[1] * m[2];
+	const float a33 = m[8] - m[2] * m[2] + eps;
+
+	const float i11 = a22 * a33 - a23 * a23;
+	const float i12 = a23 * a13 - a12 * a33;
+	const float i13 = a12 * a23 - a22 * a13;
+	const float i22 = a11 * a33 - a13 * a13;
+	const float i23 = a13 * a12 - a11 * a23;
+	const float i33 = a11 * a22 - a12 * a12;
+	const float det = i11 * a11 + i12 * a12 + i13 * a13;
+
+	const int offset = y * lw + x;
+	mean_Ir[offset] = m[0];
+	mean_Ig[offset] = m[1];
+	mean_Ib[offset] = m[2];
+	inv_rr[offset] = i11 / det;
+	inv_rg[offset] = i12 / det;
+	inv_rb[offset] = i13 / det;
+	inv_gg[offset] = i22 / det;
+	inv_gb[offset] = i23 / det;
+	inv_bb[offset] = i33 / det;
+}
+
+/**
+ * \brief Subsampled coefficients a = (Sigma + eps*U)^-1 cov_Ip and b = mean_p - a.mean_I
+ *        for a chunk of cost volume slices.
+ * \param[in] costVol - Full resolution Cost Volume, slices d0 .. d0 + get_global_size(2) - 1 are read.
+ * \param[in] Ir, Ig, Ib - Full resolution guide image planes.
+ * \param[in] width - Image Width.
+ * \param[in] height - Image Height.
+ * \param[in] xIdx, yIdx - Full resolution column/row of each subsampled column/row.
+ * \param[in] lw, lh - Subsampled width & height.
+ * \param[in] radius - Box radius at the subsampled resolution.
+ * \param[in] d0 - First disparity of the chunk.
+ * \param[in] mean_Ir ... inv_bb - Guide statistics from FGF_Guide_32F.
+ * \param[out] a_r, a_g, a_b, b - Coefficients, slice z of the chunk at z * lw * lh.
+ */
+__kernel void FGF_Coeffs_32F(__global const float* costVol,
+							__global const float* Ir,
+							__global const float* Ig,
+							__global const float* Ib,
+							const int width,
+							const int height,
+							__global const int* xIdx,
+							__global const int* yIdx,
+							const int lw,
+							const int lh,
+							const int radius,
+							const int d0,
+							__global const float* mean_Ir,
+							__global const float* mean_Ig,
+							__global const float* mean_Ib,
+							__global const float* inv_rr,
+							__global const float* inv_rg,
+							__global const float* inv_rb,
+							__global const float* inv_gg,
+							__global const float* inv_gb,
+							__global const float* inv_bb,
+							__global float* a_r,
+							__global float* a_g,
+							__global float* a_b,
+							__global float* b)
+{
+	__local float tP[4 * FGF_TS * FGF_TS];
+	__local float rs[4 * FGF_TS * FGF_TILE];
+
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lid = ly * FGF_TILE + lx;
+	const int ts = FGF_TILE + 2 * radius;
+	const int x0 = get_group_id(0) * FGF_TILE - radius;
+	const int y0 = get_group_id(1) * FGF_TILE - radius;
+	const int z = get_global_id(2);
+	__global const float* p = costVol + (d0 + z) * height * width;
+
+	//p, Ir*p, Ig*p, Ib*p
+	for(int i = lid; i < ts * ts; i += FGF_TILE * FGF_TILE)
+	{
+		const int ty = i / ts;
+		const int tx = i - ty * ts;
+		const int offset = yIdx[reflect101(y0 + ty, lh)] * width + xIdx[reflect101(x0 + tx, lw)];
+		const float pv = p[offset];
+		tP[(0 * FGF_TS + ty) * FGF_TS + tx] = pv;
+		tP[(1 * FGF_TS + ty) * FGF_TS + tx] = Ir[offset] * pv;
+		tP[(2 * FGF_TS + ty) * FGF_TS + tx] = Ig[offset] * pv;
+		tP[(3 * FGF_TS + ty) * FGF_TS + tx] = Ib[offset] * pv;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	boxRows(tP, rs, 4, ts, radius, lid);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	float m[4];
+	for(int c = 0; c < 4; c++)
+		m[c] = boxCol(rs, c, radius, lx, ly);
+
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if(x >= lw || y >= lh)
+		return;
+
+	const int offset2D = (y * lw) + x;
+	const int offset3D = (((z * lh) + y) * lw) + x;
+
+	const float mIr = mean_Ir[offset2D];
+	const float mIg = mean_Ig[offset2D];
+	const float mIb = mean_Ib[offset2D];
+	const float c0 = m[1] - mIr * m[0];
+	const float c1 = m[2] - mIg * m[0];
+	const float c2 = m[3] - mIb * m[0];
+
+	const float irg = inv_rg[offset2D];
+	const float irb = inv_rb[offset2D];
+	const float igb = inv_gb[offset2D];
+	const float ar = inv_rr[offset2D] * c0 + irg * c1 + irb * c2;
+	const float ag = irg * c0 + inv_gg[offset2D] * c1 + igb * c2;
+	const float ab = irb * c0 + igb * c1 + inv_bb[offset2D] * c2;
+
+	a_r[offset3D] = ar;
+	a_g[offset3D] = ag;
+	a_b[offset3D] = ab;
+	b[offset3D] = m[0] - ar * mIr - ag * mIg - ab * mIb;
+}
+
+/**
+ * \brief Box filter the subsampled coefficients of a chunk of slices.
+ * \param[in] a_r, a_g, a_b, b - Coefficients from FGF_Coeffs_32F.
+ * \param[in] lw, lh - Subsampled width & height.
+ * \param[in] radius - Box radius at the subsampled resolution.
+ * \param[out] mean_ar, mean_ag, mean_ab, mean_b - Box filtered coefficients.
+ */
+__kernel void FGF_BoxCoeffs_32F(__global const float* a_r,
+								__global const float* a_g,
+								__global const float* a_b,
+								__global const float* b,
+								const int lw,
+								const int lh,
+								const int radius,
+								__global float* mean_ar,
+								__global float* mean_ag,
+								__global float* mean_ab,
+								__global float* mean_b)
+{
+	__local float tC[4 * FGF_TS * FGF_TS];
+	__local float rs[4 * FGF_TS * FGF_TILE];
+
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lid = ly * FGF_TILE + lx;
+	const int ts = FGF_TILE + 2 * radius;
+	const int x0 = get_group_id(0) * FGF_TILE - radius;
+	const int y0 = get_group_id(1) * FGF_TILE - radius;
+	const int sliceOffset = get_global_id(2) * lh * lw;
+
+	for(int i = lid; i < ts * ts; i += FGF_TILE * FGF_TILE)
+	{
+		const int ty = i / ts;
+		const int tx = i - ty * ts;
+		const int offset = sliceOffset + reflect101(y0 + ty, lh) * lw + reflect101(x0 + tx, lw);
+		tC[(0 * FGF_TS + ty) * FGF_TS + tx] = a_r[offset];
+		tC[(1 * FGF_TS + ty) * FGF_TS + tx] = a_g[offset];
+		tC[(2 * FGF_TS + ty) * FGF_TS + tx] = a_b[offset];
+		tC[(3 * FGF_TS + ty) * FGF_TS + tx] = b[offset];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	boxRows(tC, rs, 4, ts, radius, lid);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if(x >= lw || y >= lh)
+		return;
+
+	const int offset = sliceOffset + y * lw + x;
+	mean_ar[offset] = boxCol(rs, 0, radius, lx, ly);
+	mean_ag[offset] = boxCol(rs, 1, radius, lx, ly);
+	mean_ab[offset] = boxCol(rs, 2, radius, lx, ly);
+	mean_b[offset] = boxCol(rs, 3, radius, lx, ly);
+}
+
+/**
+ * \brief Bilinear upsample of the box filtered coefficients and evaluation of
+ *        q = mean_a.I + mean_b, written over the chunk's full resolution cost volume slices.
+ * \param[in] mean_ar, mean_ag, mean_ab, mean_b - Coefficients from FGF_BoxCoeffs_32F.
+ * \param[in] Ir, Ig, Ib - Full resolution guide image planes.
+ * \param[in] width - Image Width.
+ * \param[in] height - Image Height.
+ * \param[in] lw, lh - Subsampled width & height.
+ * \param[in] xofs, xalpha, yofs, yalpha - Source positions and weights (cv::resize INTER_LINEAR).
+ * \param[in] d0 - First disparity of the chunk.
+ * \param[out] costVol - Filtered Cost Volume.
+ */
+__kernel void FGF_Upsample_32F(__global const float* mean_ar,
+								__global const float* mean_ag,
+								__global const float* mean_ab,
+								__global const float* mean_b,
+								__global const float* Ir,
+								__global const float* Ig,
+								__global const float* Ib,
+								const int width,
+								const int height,
+								const int lw,
+								const int lh,
+								__global const int* xofs,
+								__global const float* xalpha,
+								__global const int* yofs,
+								__global const float* yalpha,
+								const int d0,
+								__global float* costVol)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int z = get_global_id(2);
+
+	const int sliceOffset = z * lh * lw;
+	const int sy = yofs[y];
+	const int r0 = sliceOffset + sy * lw;
+	const int r1 = sliceOffset + min(sy + 1, lh - 1) * lw;
+	const int sx = xofs[x];
+	const int sx1 = min(sx + 1, lw - 1);
+	const float by = yalpha[y], by0 = 1.f - by;
+	const float ax = xalpha[x], ax0 = 1.f - ax;
+
+	//Vertical then horizontal interpolation, as the CPU filter
+	#define FGF_LERP(c) ((c[r0 + sx] * by0 + c[r1 + sx] * by) * ax0 + (c[r0 + sx1] * by0 + c[r1 + sx1] * by) * ax)
+	const int offset2D = y * width + x;
+	float q = FGF_LERP(mean_ar) * Ir[offset2D];
+	q += FGF_LERP(mean_ag) * Ig[offset2D];
+	q += FGF_LERP(mean_ab) * Ib[offset2D];
+	q += FGF_LERP(mean_b);
+	#undef FGF_LERP
+
+	costVol[(((d0 + z) * height) + y) * width + x] = q;
+}
@@ -0,0 +1,207 @@
+/*---------------------------------------------------------------------------
+   pp.cl - OpenCL Post Processing Kernels
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+   All rights reserved.
+  ---------------------------------------------------------------------------*/
+
+//PP_TILE and PP_RMAX must match those in PP_cl.h
+#define PP_TILE 16
+#define PP_RMAX 9
+#define PP_TS (PP_TILE + 2*PP_RMAX)
+#define PP_BINS 16	//labels per coarse bin & coarse bins, maxDis <= PP_BINS * PP_BINS
+
+/**
+ * \brief Left-right consistency check, as lrCheck() in PP.cpp.
+ * \param[in] ldispMap, rdispMap - Disparity Maps.
+ * \param[in] width - Image Width.
+ * \param[out] lValid, rValid - 1 where the views agree (and d >= 2), else 0.
+ * \param[out] validCount - Incremented once per consistent pixel of either view.
+ */
+__kernel void PP_LRCheck(__global const uchar* ldispMap,
+						__global const uchar* rdispMap,
+						const int width,
+						__global uchar* lValid,
+						__global uchar* rValid,
+						__global int* validCount)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int row = y * width;
+
+	const int lDep = ldispMap[row + x];
+	const uchar lv = (lDep == rdispMap[row + (x - lDep + width) % width] && lDep >= 2);
+	const int rDep = rdispMap[row + x];
+	const uchar rv = (rDep == ldispMap[row + (x + rDep + width) % width] && rDep >= 2);
+
+	lValid[row + x] = lv;
+	rValid[row + x] = rv;
+	if(lv + rv)
+		atomic_add(validCount, lv + rv);
+}
+
+/**
+ * \brief Fill the invalid pixels of a row with the lower of the nearest valid disparities
+ *        to their left and right, as fillInv() in PP.cpp. One work-item per row of either map.
+ * \param[in,out] ldispMap, rdispMap - Disparity Maps.
+ * \param[in] lValid, rValid - Valid Maps.
+ * \param[in] width - Image Width.
+ * \param[in] height - Image Height.
+ */
+__kernel void PP_FillInv(__global uchar* ldispMap,
+						__global uchar* rdispMap,
+						__global const uchar* lValid,
+						__global const uchar* rValid,
+						const int width,
+						const int height)
+{
+	const int i = get_global_id(0);
+	const int y = i < height ? i : i - height;
+	__global uchar* dis = (i < height ? ldispMap : rdispMap) + y * width;
+	__global const uchar* valid = (i < height ? lValid : rValid) + y * width;
+
+	int xFirst = 0, xLast = width - 1;
+	while(xFirst < width && !valid[xFirst]) xFirst++;
+	if(xFirst == width) return; //no valid pixel, the row is left as it is
+	while(!valid[xLast]) xLast--;
+
+	//The backward sweep parks the nearest valid value to the right in the invalid pixels,
+	//the forward sweep then takes the lower of it and the nearest one to the left
+	uchar carry = dis[xLast];
+	for(int x = width - 1; x >= 0; x--)
+	{
+		if(valid[x]) carry = dis[x];
+		else dis[x] = carry;
+	}
+	carry = dis[xFirst];
+	for(int x = 0; x < width; x++)
+	{
+		if(valid[x]) carry = dis[x];
+		else dis[x] = min(carry, dis[x]);
+	}
+}
+
+/**
+ * \brief Weighted median of the disparities in a (2*radius+1)^2 window (clipped to the image),
+ *        each neighbour weighted by exp(-|I_p - I_q|^2 * divider) of its colour distance.
+ *        The median label is found with a two-level histogram (PP_BINS coarse bins of PP_BINS
+ *        labels) in private memory, so the cost per pixel is independent of maxDis.
+ * \param[in] dispMap - Disparity Map.
+ * \param[in] Ir, Ig, Ib - Guide image planes.
+ * \param[in] keep - Pixels to copy through unfiltered (ignored unless useKeep).
+ * \param[in] useKeep - Selective filtering.
+ * \param[in] width - Image Width.
+ * \param[in] height - Image Height.
+ * \param[in] radius - Window radius.
+ * \param[in] divider - 1/(2*sigma^2) of the colour weight.
+ * \param[out] outMap - Filtered Disparity Map.
+ */
+__kernel void PP_WeightedMedian(__global const uchar* dispMap,
+								__global const float* Ir,
+								__global const float* Ig,
+								__global const float* Ib,
+								__global const uchar* keep,
+								const int useKeep,
+								const int width,
+								const int height,
+								const int radius,
+								const float divider,
+								__global uchar* outMap)
+{
+	__local float tI[3][PP_TS][PP_TS];
+	__local uchar tD[PP_TS][PP_TS];
+
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lid = ly * PP_TILE + lx;
+	const int ts = PP_TILE + 2 * radius;
+	const int x0 = get_group_id(0) * PP_TILE - radius;
+	const int y0 = get_group_id(1) * PP_TILE - radius;
+
+	for(int i = lid; i < ts * ts; i += PP_TILE * PP_TILE)
+	{
+		const int ty = i / ts;
+		const int tx = i - ty * ts;
+		const int offset = clamp(y0 + ty, 0, height - 1) * width + clamp(x0 + tx, 0, width - 1);
+		tI[0][ty][tx] = Ir[offset];
+		tI[1][ty][tx] = Ig[offset];
+		tI[2][ty][tx] = Ib[offset];
+		tD[ty][tx] = dispMap[offset];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if(x >= width || y >= height)
+		return;
+
+	const int offset = y * width + x;
+	if(useKeep && keep[offset])
+	{
+		outMap[offset] = dispMap[offset];
+		return;
+	}
+
+	//Window clipped to the image, in tile coordinates
+	const int txs = max(x - radius, 0) - x0, txe = min(x + radius, width - 1) - x0;
+	const int tys = max(y - radius, 0) - y0, tye = min(y + radius, height - 1) - y0;
+	const float pr = tI[0][ly + radius][lx + radius];
+	const float pg = tI[1][ly + radius][lx + radius];
+	const float pb = tI[2][ly + radius][lx + radius];
+
+	//Coarse histogram
+	float hist[PP_BINS];
+	for(int k = 0; k < PP_BINS; k++)
+		hist[k] = 0;
+	float total = 0;
+	for(int ty = tys; ty <= tye; ty++)
+	{
+		for(int tx = txs; tx <= txe; tx++)
+		{
+			const float dr = tI[0][ty][tx] - pr;
+			const float dg = tI[1][ty][tx] - pg;
+			const float db = tI[2][ty][tx] - pb;
+			const float w = native_exp(-(dr * dr + dg * dg + db * db) * divider);
+			hist[tD[ty][tx] / PP_BINS] += w;
+			total += w;
+		}
+	}
+
+	const float half = total * 0.5f;
+	float cum = 0;
+	int bin = 0;
+	for(; bin < PP_BINS - 1; bin++)
+	{
+		if(cum + hist[bin] >= half)
+			break;
+		cum += hist[bin];
+	}
+
+	//Fine histogram of the labels in the median's coarse bin
+	for(int k = 0; k < PP_BINS; k++)
+		hist[k] = 0;
+	for(int ty = tys; ty <= tye; ty++)
+	{
+		for(int tx = txs; tx <= txe; tx++)
+		{
+			const int d = tD[ty][tx];
+			if(d / PP_BINS != bin)
+				continue;
+			const float dr = tI[0][ty][tx] - pr;
+			const float dg = tI[1][ty][tx] - pg;
+			const float db = tI[2][ty][tx] - pb;
+			hist[d - bin * PP_BINS] += native_exp(-(dr * dr + dg * dg + db * db) * divider);
+		}
+	}
+
+	int label = 0;
+	for(; label < PP_BINS - 1; label++)
+	{
+		cum += hist[label];
+		if(cum >= half)
+			break;
+	}
+	outMap[offset] = (uchar)(bin * PP_BINS + label);
+}
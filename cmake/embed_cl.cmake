@@ -0,0 +1,28 @@
+#Writes the OpenCL kernel sources into a C++ source file so the library does not depend on
+#the location of assets/ at run time. Invoked by the build as:
+#  cmake -DOUTPUT=<file.cpp> -DSOURCES="<a.cl>|<b.cl>|..." -P embed_cl.cmake
+string(REPLACE "|" ";" SOURCES "${SOURCES}")
+
+set(content "//Generated from the OpenCL kernel sources by cmake/embed_cl.cmake, do not edit.\n")
+string(APPEND content "#include <string.h>\n#include <stddef.h>\n\n")
+string(APPEND content "struct EmbeddedCL{const char* name; const char* source;};\n\n")
+string(APPEND content "static const EmbeddedCL embedded_cl[] = {\n")
+foreach(src ${SOURCES})
+	get_filename_component(name ${src} NAME)
+	file(READ ${src} text)
+	string(APPEND content "\t{\"${name}\", R\"CLSRC(${text})CLSRC\"},\n")
+endforeach()
+string(APPEND content "\t{NULL, NULL}\n};\n\n")
+string(APPEND content "const char* embeddedCLSource(const char* name)\n{\n")
+string(APPEND content "\tfor(const EmbeddedCL* e = embedded_cl; e->name; ++e)\n")
+string(APPEND content "\t\tif(!strcmp(e->name, name))\n\t\t\treturn e->source;\n")
+string(APPEND content "\treturn NULL;\n}\n")
+
+#Only touch the output when it changes, so unrelated reconfigures do not rebuild the library
+set(previous "")
+if(EXISTS ${OUTPUT})
+	file(READ ${OUTPUT} previous)
+endif()
+if(NOT previous STREQUAL content)
+	file(WRITE ${OUTPUT} "${content}")
+endif()
@@ -6,6 +6,7 @@
    Copyright (c) 2016 Charlie Leech, University of Southampton.
   ---------------------------------------------------------------------------*/
 #include "ComFunc.h"
+#include "CostVolume.h"
 
 // CVPR 11
 #define BORDER_THRES 0.011764
@@ -24,6 +25,32 @@
 #define ALPHA_32UI (unsigned int)(0.9f*UINT_MAX)
 #define ALPHA_16U 0.9
 
+//Planar frame layout used by the vectorised kernels: colour channels 0-2 + GrdX
+#define CVC_PLANES 4
+
+//Row kernels, cost[i] = f(a[p][i], b[p][i]) / f(a[p][i], BC_32F) for i in [0, n)
+typedef void (*cvc_row_fn)(const float* const a[CVC_PLANES], const float* const b[CVC_PLANES], int n, float* cost);
+typedef void (*cvc_border_fn)(const float* const a[CVC_PLANES], int n, float* cost);
+
+struct CVC_Kernels{
+	cvc_row_fn row;
+	cvc_border_fn border;
+	const char* name;
+};
+
+//Best kernels for the running CPU (AVX-512, AVX2 or scalar), see CVC_simd.cpp
+const CVC_Kernels& cvcKernels(void);
+
+//Subsampled grid of FastGuidedFilter (cv::resize INTER_NN to cols/s x rows/s)
+//Costs built on it equal the full resolution costs at the sampled pixels
+struct CVC_SubGrid{
+	int s;
+	std::vector<int> xIdx; //full resolution column of each subsampled column
+	std::vector<int> yIdx; //full resolution row of each subsampled row
+	cv::Mat lSub[CVC_PLANES];  //sampled reference pixels of each view (the planes themselves at s == 1)
+	cv::Mat rSub[CVC_PLANES];
+};
+
 //
 // TAD + GRD for Cost Computation
 //
@@ -33,21 +60,50 @@ public:
     CVC(void);
     ~CVC(void);
 
-	int preprocess(const Mat& Img, Mat& GrdX);
+	int preprocess(const cv::Mat& Img, cv::Mat& GrdX);
+	//As above, also splitting Img into Planes[0-2] with Planes[3] = GrdX
+	int preprocess(const cv::Mat& Img, cv::Mat& GrdX, cv::Mat* Planes);
 
 	static void *buildCV_left_thread(void *thread_arg);
 	static void *buildCV_right_thread(void *thread_arg);
 
-	int buildCV_left(const Mat& lImg, const Mat& rImg, const Mat& lGrdX, const Mat& rGrdX, const int d, Mat& costVol);
-	int buildCV_right(const Mat& lImg, const Mat& rImg, const Mat& lGrdX, const Mat& rGrdX, const int d, Mat& costVol);
+	int buildCV_left(const cv::Mat& lImg, const cv::Mat& rImg, const cv::Mat& lGrdX, const cv::Mat& rGrdX, const int d, cv::Mat& costVol);
+	int buildCV_right(const cv::Mat& lImg, const cv::Mat& rImg, const cv::Mat& lGrdX, const cv::Mat& rGrdX, const int d, cv::Mat& costVol);
+
+	//Subsampled construction on planar frames, vectorised - only the pixels FastGuidedFilter samples
+	//are computed. gather is the caller's per-task scratch, grown to CVC_PLANES subsampled rows.
+	//At s == 1 the grid is the whole frame and the right view is a shear copy of the left.
+	static void *buildCV_band_thread(void *thread_arg);
+
+	int setupSubGrid(const cv::Mat* lPlanes, const cv::Mat* rPlanes, int s, CVC_SubGrid& grid);
+	int buildCV_sub(const CVC_SubGrid& grid, const cv::Mat* lPlanes, const cv::Mat* rPlanes, const int d, cv::Mat& lcost, cv::Mat& rcost,
+					std::vector<float>& gather);
+	int buildCV_band_sub(const CVC_SubGrid& grid, const cv::Mat* lPlanes, const cv::Mat* rPlanes, int yStart, int yEnd,
+						int dStart, int dEnd, CostVolume* lcostVol, CostVolume* rcostVol, std::vector<float>& gather);
 };
 
 //CVC thread data struct
 struct buildCV_TD{
-	Mat* lImg;
-	Mat* rImg;
-	Mat* lGrdX;
-	Mat* rGrdX;
+	cv::Mat* lImg;
+	cv::Mat* rImg;
+	cv::Mat* lGrdX;
+	cv::Mat* rGrdX;
 	int d;
-	Mat* costVol;
+	cv::Mat* costVol;
+};
+
+//Band thread data struct - rows [yStart, yEnd) of slices [dStart, dEnd) of both volumes
+//of the subsampled volumes on grid
+struct buildCV_band_TD{
+	CVC* constructor;
+	const CVC_SubGrid* grid;
+	const cv::Mat* lPlanes;
+	const cv::Mat* rPlanes;
+	int yStart;
+	int yEnd;
+	int dStart;
+	int dEnd;
+	CostVolume* lcostVol;
+	CostVolume* rcostVol;
+	std::vector<float>* gather;
 };
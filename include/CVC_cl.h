@@ -9,7 +9,9 @@
 #include "ComFunc.h"
 #include "oclUtil.h"
 
-#define FILE_CVC_PROG BASE_DIR "assets/cvc.cl"
+#define CVC_SLOTS 2 //upload buffer sets, one per frame in flight
+#define CVC_TUNE_FILE "cvc_tuning.txt" //autotuning results in clCacheDir()
+#define CVC_TUNE_REPS 3 //timed runs per candidate, the fastest counts
 
 //
 // TAD + GRD for Cost Computation
@@ -19,10 +21,7 @@ class CVC_cl
 public:
 
     //Data Variables
-    Mat lGray, rGray;
-	Mat lGrdX, rGrdX;
 	int maxDis;
-	Mat *lImgRGB, *rImgRGB;
 
 	//OpenCL Variables
     cl_context* context;
@@ -30,15 +29,49 @@ public:
     cl_program program;
     char kernel_name[128];
     cl_kernel kernel;
+    cl_kernel kernel_split_32f, kernel_split_8u;
     cl_int errorNumber;
     cl_event event;
 
     cl_int width, height, channels;
     size_t bufferSize_2D, bufferSize_3D;
-    size_t globalWorksize[3];
+    size_t globalWorksize[3], globalWorksize_2D[2];
 
-    CVC_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, Mat* I, const int d);
+    //Construction kernel variant & work-group size, from the tuning cache or autotuned on the
+    //first frame unless PRIME_CL_TUNE=0. A zero localWorksize leaves it to the runtime.
+    cl_device_id device;
+    int variant;
+    size_t localWorksize[2];
+    bool tuned;
+
+    //Persistent upload buffers for the interleaved frames, reallocated when the input type changes.
+    //Each slot keeps its host frames referenced and its split events until the slot is reused.
+    cl_command_queue* uploadQueue;
+    int inputType;
+    size_t bufferSize_input;
+    cl_mem lInput[CVC_SLOTS], rInput[CVC_SLOTS];
+    cv::Mat lFrame[CVC_SLOTS], rFrame[CVC_SLOTS];
+    cl_event inputFree[CVC_SLOTS][2];
+
+    CVC_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, cv::Mat* I, const int d);
     ~CVC_cl(void);
 
-	int buildCV(const Mat& lImg, const Mat& rImg, cl_mem* memoryObjects);
+	//Uploads the interleaved frames (CV_32FC3 or CV_8UC3) into the given slot and enqueues the split,
+	//gradient and construction kernels without waiting for them, doneEvent (if given) completes with
+	//the cost volumes and must be released by the caller
+	int buildCV(const cv::Mat& lImg, const cv::Mat& rImg, cl_mem* memoryObjects, cl_event* doneEvent = NULL, int slot = 0);
+	//Queue used for the uploads (the compute queue unless set)
+	void setUploadQueue(cl_command_queue* queue) {uploadQueue = queue;};
+
+private:
+	int setVariant(int v, const size_t* local);
+	int setKernelArgs(cl_mem* memoryObjects);
+	int enqueueCV(cl_uint numWaitEvents, const cl_event* waitEvents, cl_event* cvEvent);
+	std::string tuningKey(void);
+	bool loadTuning(void);
+	void saveTuning(void);
+	int tuneKernel(cl_mem* memoryObjects);
+	int allocInput(int type);
+	int splitInput(cl_mem* input, cl_event writeEvent, cl_mem* memoryObjects, int view, cl_event* splitEvent);
+	void releaseSlot(int slot);
 };
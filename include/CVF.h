@@ -19,10 +19,10 @@ public:
 	~CVF();
 
 	static void *filterCV_thread(void *thread_arg);
-	int preprocess(const Mat& Img, Mat* Img_rgb, Mat* mean_Img, Mat* var_Img);
-	int filterCV(const Mat* Img_rgb, const Mat* mean_Img, const Mat* var_Img, Mat& costVol);
+	int preprocess(const cv::Mat& Img, cv::Mat* Img_rgb, cv::Mat* mean_Img, cv::Mat* var_Img);
+	int filterCV(const cv::Mat* Img_rgb, const cv::Mat* mean_Img, const cv::Mat* var_Img, cv::Mat& costVol);
 };
-Mat GuidedFilter_cv(const Mat* rgb, const Mat* mean_I, const Mat* var_I, const Mat& p);
+cv::Mat GuidedFilter_cv(const cv::Mat* rgb, const cv::Mat* mean_I, const cv::Mat* var_I, const cv::Mat& p);
 
 //CVF thread data struct
-struct filterCV_TD{Mat* Img_rgb; Mat* mean_Img; Mat* var_Img; Mat* costVol;};
+struct filterCV_TD{cv::Mat* Img_rgb; cv::Mat* mean_Img; cv::Mat* var_Img; cv::Mat* costVol;};
@@ -34,10 +34,9 @@
 #endif
 #include <CL/cl_ext.h>
 
-//OpenCV Header
-#include <opencv2/opencv.hpp>
-
-#define BASE_DIR "../"
+//OpenCV Headers - the library only uses the core and imgproc modules
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
 
 //Algorithm Definitions
 #define STEREO_SGBM 0
@@ -49,6 +48,8 @@
 #define GIF_R_WIN 8
 #define GIF_EPS 0.0001f
 
+#define STRIPE_ROWS 64 //default stripe height of the tiled CPU executor
+
 #define MAX_CPU_THREADS 8
 #define MIN_CPU_THREADS 1
 
@@ -57,17 +58,15 @@
 
 #define OCL_STATS 0
 
-using namespace cv;
-
 #ifndef COMFUNC_H
 #define COMFUNC_H
 
 enum buff_id {CVC_LIMGR, CVC_LIMGG, CVC_LIMGB, CVC_RIMGR, CVC_RIMGG, CVC_RIMGB, CVC_LGRDX, CVC_RGRDX, CV_LCV, CV_RCV, DS_LDM, DS_RDM};
 
-static float get_rt(){
+static double get_rt(){
 	struct timespec realtime;
 	clock_gettime(CLOCK_MONOTONIC,&realtime);
-	return (float)(realtime.tv_sec*1000000+realtime.tv_nsec/1000);
+	return (double)(realtime.tv_sec*1000000+realtime.tv_nsec/1000);
 }
 
 #endif // COMFUNC_H
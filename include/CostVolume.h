@@ -0,0 +1,61 @@
+/*---------------------------------------------------------------------------
+   CostVolume.h - Aligned Cost Volume Container Header
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+  ---------------------------------------------------------------------------*/
+#ifndef COSTVOLUME_H
+#define COSTVOLUME_H
+
+#include "ComFunc.h"
+
+#define COSTVOL_ALIGN 64 //bytes - cache line & AVX-512 vector
+
+//
+// Single-allocation 3D cost volume with padded rows, laid out [d][y][x] so each disparity
+// slice is a padded 2D image. Element (d,y,x) is at data()[d*dStep + y*rowStep + x].
+// Instantiated for float (CostVolume) and uint16_t (CostVolume16U) costs, see CostVolume.cpp.
+//
+template<typename T>
+class CostVolume_
+{
+public:
+	CostVolume_(int h, int w, int d);
+	~CostVolume_(void);
+	//Owns its buffer, so it is not copyable
+	CostVolume_(const CostVolume_&) = delete;
+	CostVolume_& operator=(const CostVolume_&) = delete;
+
+	const int hei;
+	const int wid;
+	const int maxDis;
+
+	//Strides in elements
+	size_t dStep;
+	size_t rowStep;
+
+	T* data(void) {return buf;};
+	const T* data(void) const {return buf;};
+	size_t bytes(void) const {return allocSize;};
+
+	//CV_32FC1 (CV_16UC1) header of slice d (shares the volume memory)
+	cv::Mat& operator[](int d) {return slices[d];};
+	const cv::Mat& operator[](int d) const {return slices[d];};
+
+	T* ptr(int d, int y) {return buf + d*dStep + y*rowStep;};
+	const T* ptr(int d, int y) const {return buf + d*dStep + y*rowStep;};
+
+	//Copy from a packed OpenCL volume of T laid out as ((d*hei)+y)*wid+x
+	int download(cl_command_queue queue, cl_mem clVol);
+
+private:
+	T* buf;
+	size_t allocSize;
+	cv::Mat* slices;
+};
+
+typedef CostVolume_<float> CostVolume;
+typedef CostVolume_<uint16_t> CostVolume16U;
+
+#endif //COSTVOLUME_H
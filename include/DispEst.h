@@ -5,16 +5,100 @@
    Email: cl19g10 [at] ecs.soton.ac.uk
    Copyright (c) 2016 Charlie Leech, University of Southampton.
   ---------------------------------------------------------------------------*/
+#ifndef DISPEST_H
+#define DISPEST_H
+
 #include "ComFunc.h"
 #include "CVC.h"
 #include "CVC_cl.h"
 #include "CVF.h"
 #include "CVF_cl.h"
+#include "FGF_cl.h"
 #include "DispSel.h"
 #include "DispSel_cl.h"
 #include "PP.h"
+#include "PP_cl.h"
+#include "OCLRuntime.h"
 #include "oclUtil.h"
 #include "fastguidedfilter.h"
+#include "ThreadPool.h"
+#include "CostVolume.h"
+
+//Per-stage execution times of the last compute() call (us)
+//In streaming & stripe modes cvf covers the fused construction, filtering & selection,
+//with OpenCL double buffering pp covers the wait for the previous frame's maps
+struct DE_Times{
+	double cvc;
+	double cvf;
+	double dispsel;
+	double pp;
+	double pp_skip; //fraction of pixels kept by the selective PP's left-right check
+};
+
+//FGF thread data struct - filters slices [dStart, dEnd) of a cost volume
+struct FGF_TD{
+	FastGuidedFilter* fgf;
+	FastGuidedFilterWorkspace* ws;
+	CostVolume* srcVol; //subsampled raw costs
+	CostVolume* costVol;
+	int dStart;
+	int dEnd;
+};
+
+//Streaming filter-and-select thread data - disparities [dStart, dEnd) of both views
+struct FS_TD{
+	CVC* constructor;
+	FastGuidedFilter* lfgf;
+	FastGuidedFilter* rfgf;
+	FastGuidedFilterWorkspace* lws;
+	FastGuidedFilterWorkspace* rws;
+	cv::Mat* lPlanes;
+	cv::Mat* rPlanes;
+	const CVC_SubGrid* grid;
+	int dStart;
+	int dEnd;
+	cv::Mat* lsub;
+	cv::Mat* rsub;
+	cv::Mat* lminCost;
+	cv::Mat* lminDis;
+	cv::Mat* rminCost;
+	cv::Mat* rminDis;
+	std::vector<float>* gather;
+};
+
+//Stripe executor state kept across frames (filters, workspaces and buffers of one stripe)
+struct Stripe_Buf{
+	FastGuidedFilter* lfgf;
+	FastGuidedFilter* rfgf;
+	FastGuidedFilterWorkspace lws;
+	FastGuidedFilterWorkspace rws;
+	CVC_SubGrid grid;
+	std::vector<float> gather;
+	cv::Mat lsub;
+	cv::Mat rsub;
+	cv::Mat lminCost;
+	cv::Mat rminCost;
+	cv::Mat lminDis;
+	cv::Mat rminDis;
+};
+
+//Stripe executor thread data - rows [yStart, yEnd) of both views, built over [yStart-halo, yEnd+halo)
+struct Stripe_TD{
+	CVC* constructor;
+	cv::Mat* lImg;
+	cv::Mat* rImg;
+	cv::Mat* lPlanes;
+	cv::Mat* rPlanes;
+	cv::Mat* lDisMap;
+	cv::Mat* rDisMap;
+	int yStart;
+	int yEnd;
+	int halo;
+	int maxDis;
+	int subsample_rate;
+	Stripe_Buf* buf;
+};
+
 //
 // Top-level Disparity Estimation Class
 //
@@ -32,9 +116,29 @@ public:
 	int setInputImages(cv::Mat l, cv::Mat r);
 	int setThreads(unsigned int newThreads);
 	void setSubsampleRate(unsigned int newRate) {subsample_rate = newRate;};
+	int setMode(int newMode);
+	int setStreamingMode(bool enable);
+	//Run CVC, FGF & WTA per horizontal stripe of the given height (0 = whole frame)
+	int setStripeRows(int rows);
+	//Weighted-median filter only the pixels failing the left-right check
+	int setSelectivePP(bool enable);
+	//OpenCL: keep two frames in flight so uploads & readbacks overlap the kernels of the
+	//neighbouring frames, compute() then returns the maps of the previous call's frame
+	int setDoubleBuffering(bool enable);
+	//Also keep the second-best cost of each pixel from the selection, for confidence estimation
+	//(CPU cost volume pipeline only, not in streaming, stripe or OpenCL mode)
+	int setSecondCost(bool enable);
 	int printCV(void);
 
-    int CostConst();
+	//Run the complete pipeline (CVC, CVF, DispSel, PP) on the current inputs
+	int compute(void);
+	const cv::Mat& getLeftDispMap(void) const {return lDisMap;};
+	const cv::Mat& getRightDispMap(void) const {return rDisMap;};
+	//CV_32FC1, empty unless setSecondCost(true) and the last frame ran the CPU cost volume pipeline
+	const cv::Mat& getLeftSecondCost(void) const {return lSecondCost;};
+	const cv::Mat& getRightSecondCost(void) const {return rSecondCost;};
+	DE_Times getTimes(void) const {return times;};
+
     int CostConst_CPU();
     int CostConst_GPU();
 
@@ -42,6 +146,15 @@ public:
     int CostFilter_CPU();
     int CostFilter_GPU();
     int CostFilter_FGF();
+    static void *CostFilter_FGF_thread(void *thread_arg);
+
+    //Streaming mode: CVC, FGF and WTA fused per slice, no cost volumes
+    int CostFilterSelect_FGF();
+    static void *CostFilterSelect_thread(void *thread_arg);
+
+    //Stripe mode: the streaming pipeline run on cache-sized horizontal stripes with halos
+    int CostFilterSelect_Stripes();
+    static void *CostFilterSelect_stripe_thread(void *thread_arg);
 
 
     int DispSelect_CPU();
@@ -50,6 +163,9 @@ public:
     int PostProcess_CPU();
     int PostProcess_GPU();
 
+    //Double-buffered OpenCL pipeline: enqueue this frame, then collect the previous one
+    int Pipeline_GPU();
+
 private:
     //Private Variable
     cv::Mat lImg;
@@ -60,16 +176,42 @@ private:
     int maxDis;
     int threads;
     bool useOCL;
+    int de_mode;
+    bool streaming;
+    int stripe_rows;
+    bool doubleBuffer;
+    bool secondCost;
     unsigned int subsample_rate = 4;
+    DE_Times times;
 
 	//CVC
     cv::Mat lGrdX;
     cv::Mat rGrdX;
+    cv::Mat lPlanes[CVC_PLANES];
+    cv::Mat rPlanes[CVC_PLANES];
 	//CVC & CVF
 //    Mat lcostVol_cvc;
 //    Mat rcostVol_cvc;
-    cv::Mat* lcostVol;
-    cv::Mat* rcostVol;
+    CostVolume* lcostVol;
+    CostVolume* rcostVol;
+    //Raw costs are only built on the grid FastGuidedFilter subsamples
+    CVC_SubGrid subGrid;
+    CostVolume* lcostVolSub;
+    CostVolume* rcostVolSub;
+    //Streaming mode per-task running min/argmin
+    cv::Mat fsCost[2*MAX_CPU_THREADS];
+    cv::Mat fsDis[2*MAX_CPU_THREADS];
+    cv::Mat fsSub[2*MAX_CPU_THREADS];
+    //CVC - per-task gather rows of the subsampled construction
+    std::vector<std::vector<float> > cvcGather;
+    //CVF - guide statistics and per-task scratch, reused across frames
+    FastGuidedFilter* lfgf;
+    FastGuidedFilter* rfgf;
+    unsigned int fgf_rate;
+    FastGuidedFilterWorkspace fgfWS[2*MAX_CPU_THREADS];
+    Stripe_Buf* stripeBufs;
+    int nStripeBufs;
+    unsigned int stripe_rate;
     //CVF
 //    Mat* lImg_rgb;
 //    Mat* rImg_rgb;
@@ -77,10 +219,15 @@ private:
 //    Mat* mean_rImg;
 //    Mat* var_lImg;
 //    Mat* var_rImg;
+    //DispSel - second-best costs, when enabled
+    cv::Mat lSecondCost;
+    cv::Mat rSecondCost;
     //PP
     cv::Mat lValid;
     cv::Mat rValid;
 
+    ThreadPool* pool;
+
     CVC* constructor;
     CVF* filter;
     DispSel* selector;
@@ -88,7 +235,9 @@ private:
 
     CVC_cl* constructor_cl;
 	CVF_cl* filter_cl;
+	FGF_cl* fgf_cl; //subsample_rate > 1
     DispSel_cl* selector_cl;
+    PP_cl* postProcessor_cl;
 
 	//OpenCL Variables
 	cl_context context;
@@ -98,6 +247,20 @@ private:
     cl_mem memoryObjects[12]; //OpenCL Memory Buffers
     cl_int errorNumber;
     cl_event event;
+    //Completion of the construction, filtering & selection stages, each stage is enqueued behind
+    //the previous one so the host only synchronises on the final disparity map readback
+    cl_event cvcEvent, cvfEvent, dsEvent;
+    //Double buffering: uploads go through uploadQueue & readbacks through readQueue, frames alternate
+    //between the CVC_cl & PP_cl slots and the maps are read back into the slot's host maps
+    cl_command_queue uploadQueue;
+    cl_command_queue readQueue;
+    int dbSlot;
+    int dbPending; //slot of the frame still in flight, -1 if none
+    bool dbPrimed; //the first frame after enabling is waited for
+    cv::Mat lSlotDisMap[PP_SLOTS];
+    cv::Mat rSlotDisMap[PP_SLOTS];
+    int finishSlot(int slot);
+    int drainPipeline(void);
 
     cl_int width, height, channels;
 	size_t bufferSize_2D_8UC1; //DispMap,
@@ -105,5 +268,13 @@ private:
 	size_t bufferSize_3D; //costVol
 
     //Private Methods
-    //None
+    int allocCostVolumes(void);
+    void releaseCostVolumes(void);
+    int allocSubCostVolumes(void);
+    void releaseSubCostVolumes(void);
+    int updateFilters(void);
+    void releaseStripes(void);
+    void releaseOCL(void);
 };
+
+#endif //DISPEST_H
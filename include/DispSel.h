@@ -6,6 +6,23 @@
    Copyright (c) 2016 Charlie Leech, University of Southampton.
   ---------------------------------------------------------------------------*/
 #include "ComFunc.h"
+#include "ThreadPool.h"
+#include "CostVolume.h"
+
+#define WTA_TILE 64 //pixels reduced together over the disparity axis
+
+//Row kernels - disp[x] = argmin_{d >= 1} costs[d*dStep + x], second[x] = second-best cost (optional)
+typedef void (*wta_f32_fn)(const float* costs, size_t dStep, int maxDis, int wid, uchar* disp, float* second);
+typedef void (*wta_u16_fn)(const uint16_t* costs, size_t dStep, int maxDis, int wid, uchar* disp, uint16_t* second);
+
+struct WTA_Kernels{
+	wta_f32_fn f32;
+	wta_u16_fn u16;
+	const char* name;
+};
+
+//Best kernels for the running CPU (AVX-512, AVX2 or default), see DispSel_simd.cpp
+const WTA_Kernels& wtaKernels(void);
 
 class DispSel
 {
@@ -13,8 +30,14 @@ public:
 	DispSel();
 	~DispSel();
 
-	int CVSelect(cv::Mat* costVol, const unsigned int maxDis, cv::Mat& dispMap);
-	int CVSelect_thread(cv::Mat* costVol, const unsigned int maxDis, cv::Mat& dispMap, int threads);
+	//secondCost (CV_32FC1, optional) receives the second-best cost for confidence estimation
+	int CVSelect(CostVolume& costVol, const unsigned int maxDis, cv::Mat& dispMap, cv::Mat* secondCost = NULL);
+	int CVSelect_thread(CostVolume& costVol, const unsigned int maxDis, cv::Mat& dispMap, ThreadPool* pool, cv::Mat* secondCost = NULL);
+	//16-bit costs, secondCost is CV_16UC1
+	int CVSelect(CostVolume16U& costVol, const unsigned int maxDis, cv::Mat& dispMap, cv::Mat* secondCost = NULL);
+
+	//Streaming selection - merge a partial min/argmin over higher disparities into the running one
+	int CVMerge(const cv::Mat& srcCost, const cv::Mat& srcDisp, cv::Mat& minCost, cv::Mat& dispMap);
 };
 
-struct DS_X_TD{Mat* costVol; cv::Mat* dispMap; int y; unsigned int maxDis;};
+struct DS_X_TD{CostVolume* costVol; cv::Mat* dispMap; cv::Mat* secondCost; int yStart; int yEnd; unsigned int maxDis;};
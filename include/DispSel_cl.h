@@ -9,8 +9,6 @@
 #include "ComFunc.h"
 #include "oclUtil.h"
 
-#define FILE_DS_PROG BASE_DIR "assets/dispsel.cl"
-
 class DispSel_cl
 {
 public:
@@ -30,9 +28,11 @@ public:
 	size_t bufferSize_2D_8UC1, bufferSize_3D_8UC1;
     size_t globalWorksize[2];
 
-	DispSel_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, Mat* I, const int d);
+	DispSel_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, cv::Mat* I, const int d);
 	~DispSel_cl(void);
 
-	int CVSelect(cl_mem* memoryObjects, Mat& ldispMap, Mat& rdispMap);
+	//Enqueued behind waitEvents without blocking, the maps stay on the device for PP_cl;
+	//doneEvent (retained, release it when done) completes when both maps are selected
+	int CVSelect(cl_mem* memoryObjects, cl_event* doneEvent, cl_uint numWaitEvents = 0, const cl_event* waitEvents = NULL);
 };
 
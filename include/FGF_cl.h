@@ -0,0 +1,60 @@
+/*---------------------------------------------------------------------------
+   FGF_cl.h - OpenCL Fast Guided Filter Header
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+   All rights reserved.
+  ---------------------------------------------------------------------------*/
+#include "ComFunc.h"
+#include "oclUtil.h"
+
+#define FGF_TILE 16	//work-group tile edge, must match FGF_TILE in fgf.cl
+#define FGF_RMAX 8	//largest subsampled box radius, must match FGF_RMAX in fgf.cl
+#define FGF_SLICES 16	//coefficient buffers hold the size of FGF_SLICES full resolution slices
+
+//
+// Subsampled GIF for Cost Computation (as FastGuidedFilter on the CPU)
+//
+class FGF_cl
+{
+public:
+	FGF_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, cv::Mat* I, const int d, const int s);
+	~FGF_cl(void);
+
+	//Reallocates the subsampled buffers & sampling maps when s changes
+	int setSubsampleRate(int s);
+	//False when the kernels could not be built or cannot run FGF_TILE x FGF_TILE work-groups
+	bool isUsable(void) const {return usable;};
+
+	//Kernels are enqueued behind waitEvent without blocking; doneEvent (retained, release
+	//it when done) completes when the filtered volume is ready
+	int preprocess(cl_mem* Ir, cl_mem* Ig, cl_mem* Ib, cl_event waitEvent = 0);
+	int filterCV(cl_mem* cl_costVol, cl_event* doneEvent = NULL);
+
+private:
+	bool usable;
+
+	//OpenCL Variables
+    cl_context* context;
+	cl_command_queue* commandQueue;
+    cl_program program;
+    cl_kernel kernel_guide, kernel_coeffs, kernel_boxc, kernel_upsample;
+    cl_int errorNumber;
+    cl_event event;
+
+    cl_int width, height, maxDis;
+    cl_int subsample_rate, subWidth, subHeight, radius, sliceChunk;
+
+    size_t globalWorksize_sub[3], localWorksize[3];
+
+	cl_mem *Ir, *Ig, *Ib;
+	cl_mem xIdx, yIdx; //nearest-neighbour subsampling grid
+	cl_mem xofs, xalpha, yofs, yalpha; //bilinear upsampling positions & weights
+	cl_mem mean_I[3], inv_I[6];
+	cl_mem coef[4], mean_coef[4]; //a_r, a_g, a_b, b for sliceChunk subsampled slices
+
+	int allocBuffers(void);
+	void releaseBuffers(void);
+	int enqueueKernel(cl_kernel kernel, cl_uint workDim, const size_t *globalworksize, const size_t *localworksize, const char *name);
+};
@@ -93,19 +93,18 @@ public:
 		//OUTPUT OF THIS STEP: Is, iMap
 		//If I is floating point image, "adaptive quantization" is done in from32FTo32S.
 		//The mapping of floating value to integer value is stored in iMap (for each channel).
-		//"Is" stores each channel of "I". The channels are converted to CV_32S type after this step.
+		//"Is" stores each channel of "I". CV_32F channels are converted to CV_32S type after this step,
+		//CV_8U channels are filtered as they are.
 		vector<float *> iMap(I.channels());
 		vector<Mat> Is;
 		{
-			split(I,Is);
+			if(I.channels()==1)Is.assign(1,I);
+			else split(I,Is);
 			for(int i=0;i<(int)Is.size();i++){
 				if(I.depth()==CV_32F){
 					iMap[i] = new float[nI];
 					from32FTo32S(Is[i],Is[i],nI,iMap[i]);
 				}
-				else if(I.depth()==CV_8U){
-					Is[i].convertTo(Is[i],CV_32S);
-				}
 			}
 		}
 
@@ -141,14 +140,12 @@ public:
 					from32STo32F(Is[i],Is[i],iMap[i]);
 					delete []iMap[i];
 				}
-				else if(I.depth()==CV_8U){
-					Is[i].convertTo(Is[i],CV_8U);
-				}
 			}
 		}
 
 		//merge the channels
-		merge(Is,result);
+		if(Is.size()==1)result = Is[0];
+		else merge(Is,result);
 
 		//end of the function
 		return result;
@@ -158,9 +155,11 @@ public:
 	/* Function: filterCore
 	 *
 	 * Description: filter core implementation only containing joint-histogram weighted median framework
+	 *				Columns are independent (the histogram is reset for each column), so the image is
+	 *				split into one strip of columns per OpenMP thread, see filterCoreStrip.
 	 *
 	 * input arguments:
-	 *			I: input image. Only accept CV_32S type.
+	 *			I: input image. Only accept CV_32S or CV_8U type.
 	 *          F: feature image. Only accept CV_32S type.
 	 *       wMap: a 2D array that defines the distance between each pair of feature values. wMap[i][j] is the weight between feature value "i" and "j".
 	 *          r: radius of filtering kernel, should be a positive integer.
@@ -173,21 +172,53 @@ public:
 	static Mat filterCore(Mat &I, Mat &F, float **wMap, int r=20, int nF=256, int nI=256, Mat mask=Mat()){
 
 		// Check validation
-		assert(I.depth() == CV_32S && I.channels()==1);//input image: 32SC1
+		assert((I.depth() == CV_32S || I.depth() == CV_8U) && I.channels()==1);//input image: 32SC1 or 8UC1
 		assert(F.depth() == CV_32S && F.channels()==1);//feature image: 32SC1
 
-		// Configuration and declaration
-		int rows = I.rows, cols = I.cols;
-		int alls = rows * cols;
-		int winSize = (2*r+1)*(2*r+1);
+		int cols = I.cols;
 		Mat outImg = I.clone();
 
-		// Handle Mask
-		if(mask.empty()){
-			mask = Mat(I.size(),CV_8U);
-			mask = Scalar(1);
+		#pragma omp parallel
+		{
+			int nStrips = omp_get_num_threads();
+			int strip = omp_get_thread_num();
+			if(I.depth() == CV_8U)
+				filterCoreStrip<uchar>(I, F, wMap, r, nF, nI, mask, strip*cols/nStrips, (strip+1)*cols/nStrips, outImg);
+			else
+				filterCoreStrip<int>(I, F, wMap, r, nF, nI, mask, strip*cols/nStrips, (strip+1)*cols/nStrips, outImg);
 		}
 
+		// end of the function
+		return outImg;
+	}
+
+	/***************************************************************/
+	/* Function: filterCoreStrip
+	 *
+	 * Description: filterCore on the columns [xStart, xEnd) only. Each call owns its joint-histogram,
+	 *				BCB and necklace tables, so calls on disjoint strips may run concurrently
+	 *				(on the same or different images) and write to a shared output image.
+	 *				T is the pixel type of I and outImg: int (CV_32S) or uchar (CV_8U). The tables are
+	 *				sized by nI, so label maps with few values (e.g. disparities) should pass the label count.
+	 *
+	 * input arguments:
+	 *			As filterCore; an empty mask uses every pixel.
+	 *	   outImg: output of the same size and type as I, only columns [xStart, xEnd) are written.
+	 *		 keep: optional CV_8UC1 map, pixels where it is non-zero are not recomputed and are not written
+	 *			   to outImg (initialise outImg with I). Only the rows between the first and last pixel
+	 *			   to filter in a column are scanned; the other pixels still enter the histograms.
+	 */
+	/***************************************************************/
+
+	template<typename T>
+	static void filterCoreStrip(const Mat &I, const Mat &F, float **wMap, int r, int nF, int nI, const Mat &mask,
+								int xStart, int xEnd, Mat &outImg, const Mat &keep = Mat()){
+
+		// Configuration and declaration
+		int rows = I.rows, cols = I.cols;
+
+		if(xStart >= xEnd)return;
+
 		// Allocate memory for joint-histogram and BCB
 		int **H = int2D(nI,nF);
 		int *BCB = new int[nF];
@@ -199,7 +230,15 @@ public:
 		int *BCBb = new int[nF];//backward link
 
 		// Column Scanning
-		for(int x=0;x<cols;x++){
+		for(int x=xStart;x<xEnd;x++){
+
+			// Rows [yFirst, yLast] contain every pixel of the column to be filtered
+			int yFirst = 0, yLast = rows-1;
+			if(!keep.empty()){
+				while(yFirst < rows && keep.ptr<uchar>(yFirst)[x])yFirst++;
+				if(yFirst == rows)continue;
+				while(keep.ptr<uchar>(yLast)[x])yLast--;
+			}
 
 			// Reset histogram and BCB for each column
 			memset(BCB, 0, sizeof(int)*nF);
@@ -216,16 +255,16 @@ public:
 
 			// Initialize joint-histogram and BCB for the first window
 			{
-				int upY = min(rows-1,r);
-				for(int i=0;i<=upY;i++){
+				int upY = min(rows-1,yFirst+r);
+				for(int i=max(0,yFirst-r);i<=upY;i++){
 
-					int *IPtr = I.ptr<int>(i);
-					int *FPtr = F.ptr<int>(i);
-					uchar *maskPtr = mask.ptr<uchar>(i);
+					const T *IPtr = I.ptr<T>(i);
+					const int *FPtr = F.ptr<int>(i);
+					const uchar *maskPtr = mask.empty() ? NULL : mask.ptr<uchar>(i);
 
 					for(int j=downX;j<=upX;j++){
 
-						if(!maskPtr[j])continue;
+						if(maskPtr && !maskPtr[j])continue;
 
 						int fval = IPtr[j];
 						int *curHist = H[fval];
@@ -251,10 +290,10 @@ public:
 				}
 			}
 
-			for(int y=0;y<rows;y++){
+			for(int y=yFirst;y<=yLast;y++){
 
 				// Find weighted median with help of BCB and joint-histogram
-				{
+				if(keep.empty() || !keep.ptr<uchar>(y)[x]){
 
 					float balanceWeight = 0;
 					int curIndex = F.ptr<int>(y,x)[0];
@@ -311,8 +350,8 @@ public:
 					}
 
 					// Weighted median is found and written to the output image
-					if(balanceWeight<0)outImg.ptr<int>(y,x)[0] = curMedianVal+1;
-					else outImg.ptr<int>(y,x)[0] = curMedianVal;
+					if(balanceWeight<0)outImg.ptr<T>(y,x)[0] = (T)(curMedianVal+1);
+					else outImg.ptr<T>(y,x)[0] = (T)curMedianVal;
 				}
 
 				// Update joint-histogram and BCB when local window is shifted.
@@ -323,13 +362,13 @@ public:
 						int rownum = y + r + 1;
 						if(rownum < rows){
 
-							int *inputImgPtr = I.ptr<int>(rownum);
-							int *guideImgPtr = F.ptr<int>(rownum);
-							uchar *maskPtr = mask.ptr<uchar>(rownum);
+							const T *inputImgPtr = I.ptr<T>(rownum);
+							const int *guideImgPtr = F.ptr<int>(rownum);
+							const uchar *maskPtr = mask.empty() ? NULL : mask.ptr<uchar>(rownum);
 
 							for(int j=downX;j<=upX;j++){
 
-								if(!maskPtr[j])continue;
+								if(maskPtr && !maskPtr[j])continue;
 
 								fval = inputImgPtr[j];
 								curHist = H[fval];
@@ -359,13 +398,13 @@ public:
 						int rownum = y - r;
 						if(rownum >= 0){
 
-							int *inputImgPtr = I.ptr<int>(rownum);
-							int *guideImgPtr = F.ptr<int>(rownum);
-							uchar *maskPtr = mask.ptr<uchar>(rownum);
+							const T *inputImgPtr = I.ptr<T>(rownum);
+							const int *guideImgPtr = F.ptr<int>(rownum);
+							const uchar *maskPtr = mask.empty() ? NULL : mask.ptr<uchar>(rownum);
 
 							for(int j=downX;j<=upX;j++){
 
-								if(!maskPtr[j])continue;
+								if(maskPtr && !maskPtr[j])continue;
 
 								fval = inputImgPtr[j];
 								curHist = H[fval];
@@ -402,9 +441,6 @@ public:
 			int2D_release(Hf);
 			int2D_release(Hb);
 		}
-
-		// end of the function
-		return outImg;
 	}
 
 private:
@@ -421,7 +457,7 @@ private:
 	/***************************************************************/
 	static inline void updateBCB(int &num,int *f,int *b,int i,int v){
 
-		static int p1,p2;
+		int p1,p2;
 
 		if(i){
 			if(!num){ // cell is becoming non-empty
@@ -454,6 +490,8 @@ private:
 		return ret;
 	}
 
+public:
+
 	/***************************************************************/
 	/* Function: float2D_release
 	 * Description: deallocate the 2D array created by float2D()
@@ -463,6 +501,8 @@ private:
 		delete []p;
 	}
 
+private:
+
 	/***************************************************************/
 	/* Function: int2D
 	 * Description: allocate a 2D integer array with dimension "dim1 x dim2"
@@ -485,6 +525,8 @@ private:
 		delete []p;
 	}
 
+public:
+
 	/***************************************************************/
 	/* Function: featureIndexing
 	 * Description: convert uchar feature image "F" to CV_32SC1 type.
@@ -545,9 +587,7 @@ private:
 
 			const int shift = 2; // 256(8-bit)->64(6-bit)
 			const int LOW_NUM = 256>>shift;
-			static int hash[LOW_NUM][LOW_NUM][LOW_NUM]={0};
-
-			memset(hash,0,sizeof(hash));
+			int (*hash)[LOW_NUM][LOW_NUM] = new int[LOW_NUM][LOW_NUM][LOW_NUM](); // per call, not static, for concurrent use
 
 			// throw pixels into a 2D histogram
 			int candCnt = 0;
@@ -615,6 +655,7 @@ private:
 					FNew.ptr<int>()[i] = hash[lowB][lowG][lowR];
 				}
 			}
+			delete []hash;
 
 			// Computer weight map (weight between each pair of feature index)
 			{
@@ -659,6 +700,8 @@ private:
 		F = FNew;
 	}
 
+private:
+
 	/***************************************************************/
 	/* Function: from32FTo32S
 	 * Description: adaptive quantization for changing a floating-point 1D image to integer image.
@@ -0,0 +1,63 @@
+/*---------------------------------------------------------------------------
+   OCLRuntime.h - Shared OpenCL Runtime Header
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+   All rights reserved.
+  ---------------------------------------------------------------------------*/
+#ifndef OCLRUNTIME_H
+#define OCLRUNTIME_H
+
+#include <map>
+#include <mutex>
+#include "oclUtil.h"
+
+#define OCL_POOL_SLACK 2 //a pooled buffer is reused for requests down to 1/OCL_POOL_SLACK of its size
+
+//
+// Process-wide OpenCL context, queues, programs & buffer pool shared by the DispEst instances,
+// so rebuilding the pipeline for new inputs does not rebuild the OpenCL state
+//
+class OCLRuntime
+{
+public:
+	//Created on first use, NULL if no OpenCL device could be set up
+	static OCLRuntime* get(void);
+	//Releases the runtime with its programs & pooled buffers, once no DispEst uses it
+	static void release(void);
+	//Platform & device selection for the runtime created next, false if one is already in use
+	static bool configure(const OCLDeviceConfig& config);
+
+	cl_context context;
+	cl_command_queue commandQueue;
+	//Uploads & readbacks of the double-buffered pipeline, on separate in-order queues so the
+	//next frame's upload is not queued behind the previous frame's readback
+	cl_command_queue uploadQueue;
+	cl_command_queue readQueue;
+	cl_device_id device;
+
+	//Builds each file once per set of options, the caller owns a reference to the program
+	bool getProgram(std::string filename, cl_program* program, std::string options = "");
+
+	//Pooled clCreateBuffer/clReleaseMemObject. A free buffer with the same flags is reused when
+	//it is large enough (and not too large), releaseBuffer hands it back to the pool. Buffers are
+	//only reused by commands enqueued after the release, which the in-order queue runs last.
+	cl_mem createBuffer(cl_mem_flags flags, size_t size, cl_int* errorNumber);
+	void releaseBuffer(cl_mem buffer);
+
+private:
+	OCLRuntime(void);
+	~OCLRuntime(void);
+	bool init(void);
+
+	std::mutex mtx;
+	std::map<std::string, cl_program> programs;
+	std::multimap<size_t, cl_mem> freeBuffers; //keyed by size
+
+	static OCLRuntime* instance;
+	static std::mutex instance_mtx;
+	static OCLDeviceConfig deviceConfig;
+};
+
+#endif //OCLRUNTIME_H
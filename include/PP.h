@@ -7,7 +7,7 @@
    All rights reserved.
   ---------------------------------------------------------------------------*/
 #include "ComFunc.h"
-#include "JointWMF.h"
+#include "ThreadPool.h"
 
 #define MED_SZ 19
 #define SIG_CLR 0.1
@@ -22,9 +22,22 @@ public:
 	PP(void);
 	~PP(void);
 
-	void processDM(Mat& lImg, Mat& rImg, Mat& lDisMap, Mat& rDisMap,
-					Mat& lValid, Mat& rValid, const int maxDis, int threads);
+	void processDM(cv::Mat& lImg, cv::Mat& rImg, cv::Mat& lDisMap, cv::Mat& rDisMap,
+					cv::Mat& lValid, cv::Mat& rValid, const int maxDis, ThreadPool* pool);
+
+	//Selective mode: only pixels failing the left-right check are weighted-median filtered
+	void setSelective(bool enable) {selective = enable;};
+	//Fraction of pixels left untouched by the last processDM (0 unless selective)
+	double getSkipRate(void) const {return skipRate;};
+
+private:
+	bool selective;
+	double skipRate;
 };
 
-struct WM_row_TD{const Mat* Img; Mat* Dis; uchar *pValid; int y; int maxDis;};
+struct WM_row_TD{const cv::Mat* Img; cv::Mat* Dis; uchar *pValid; int y; int maxDis;};
+
+//JointWMF per-view preparation (feature clustering) and per-strip filtering thread data
+struct WMF_view_TD{const cv::Mat* Img; cv::Mat* Dis; const cv::Mat* Valid; cv::Mat F; float** wMap; int nF;};
+struct WMF_strip_TD{const WMF_view_TD* view; int nI; int xStart; int xEnd; cv::Mat* out;};
 
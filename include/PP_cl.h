@@ -0,0 +1,71 @@
+/*---------------------------------------------------------------------------
+   PP_cl.h - OpenCL Post Processing Header
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+   All rights reserved.
+  ---------------------------------------------------------------------------*/
+#include "ComFunc.h"
+#include "oclUtil.h"
+
+#define PP_TILE 16	//work-group tile edge, must match PP_TILE in pp.cl
+#define PP_RMAX 9	//median window radius (MED_SZ/2), must match PP_RMAX in pp.cl
+#define PP_SIG_CLR 0.1f	//colour weight sigma, 25.5 of 255 as the CPU JointWMF
+#define PP_SLOTS 2	//output buffer sets, one per frame in flight
+
+//
+// Weighted-Median Post-processing on the device
+//
+class PP_cl
+{
+public:
+	PP_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, cv::Mat* I, const int d);
+	~PP_cl(void);
+
+	//Filters the maps in memoryObjects[DS_LDM/DS_RDM] behind waitEvents and blocks until
+	//the final maps have been read back into lDisMap & rDisMap
+	int processDM(cl_mem* memoryObjects, cv::Mat& lDisMap, cv::Mat& rDisMap,
+					cl_uint numWaitEvents = 0, const cl_event* waitEvents = NULL);
+
+	//Split form of processDM for frames in flight: enqueueDM filters into the slot's output
+	//buffers and enqueues their readback on readQueue without waiting, finishDM(slot) blocks
+	//until lDisMap & rDisMap hold the maps. A slot must be finished before it is reused.
+	int enqueueDM(cl_mem* memoryObjects, cv::Mat& lDisMap, cv::Mat& rDisMap, int slot, cl_command_queue* readQueue,
+					cl_uint numWaitEvents = 0, const cl_event* waitEvents = NULL);
+	int finishDM(int slot);
+
+	//Selective mode: only pixels failing the left-right check are weighted-median filtered
+	void setSelective(bool enable) {selective = enable;};
+	//Fraction of pixels left untouched by the last finished frame (0 unless selective)
+	double getSkipRate(void) const {return skipRate;};
+	//False when maxDis > 256, the kernels could not be built or cannot run PP_TILE x PP_TILE work-groups
+	bool isUsable(void) const {return usable;};
+
+private:
+	bool usable;
+	bool selective;
+	double skipRate;
+
+	//OpenCL Variables
+    cl_context* context;
+	cl_command_queue* commandQueue;
+    cl_program program;
+    cl_kernel kernel_lr, kernel_fill, kernel_wm;
+    cl_int errorNumber;
+    cl_event event;
+
+    cl_int width, height, maxDis;
+    size_t bufferSize_2D_8UC1;
+    size_t globalWorksize_2D[2], globalWorksize_tiles[2], localWorksize[2], globalWorksize_rows[1];
+
+	cl_mem lValid, rValid;
+	cl_mem lOut[PP_SLOTS], rOut[PP_SLOTS], validCount[PP_SLOTS];
+	cl_int count[PP_SLOTS];
+	bool slotSelective[PP_SLOTS];
+	cl_event readEvents[PP_SLOTS][3];
+	cl_uint numReads[PP_SLOTS];
+
+	int medianView(cl_mem* dispMap, cl_mem* Ir, cl_mem* Ig, cl_mem* Ib, cl_mem* keep, cl_mem* outMap);
+	int enqueueKernel(cl_kernel kernel, cl_uint workDim, const size_t *globalworksize, const size_t *localworksize, const char *name);
+};
@@ -48,17 +48,17 @@
 #define FILE_TEMPLATE_RIGHT	BASE_DIR "data/chessboard%dR.png"
 
 struct StereoCameraProperties{
-    Mat cameraMatrix[2];
-    Mat distCoeffs[2];
-	Mat R, T, E, F; //rotation matrix, translation vector, essential matrix E=[T*R], fundamental matrix
-	Mat R1, R2, P1, P2, Q;
-	Size imgSize;
-    Rect roi[2]; //region of interest
+    cv::Mat cameraMatrix[2];
+    cv::Mat distCoeffs[2];
+	cv::Mat R, T, E, F; //rotation matrix, translation vector, essential matrix E=[T*R], fundamental matrix
+	cv::Mat R1, R2, P1, P2, Q;
+	cv::Size imgSize;
+    cv::Rect roi[2]; //region of interest
 };
 
 int print_help();
 
-void StereoCalib(const std::vector<std::string>& imagelist, Size boardSize, StereoCameraProperties& props, bool useCalibrated, bool showRectified);
+void StereoCalib(const std::vector<std::string>& imagelist, cv::Size boardSize, StereoCameraProperties& props, bool useCalibrated, bool showRectified);
 
 bool readStringList( const std::string& filename, std::vector<std::string>& l );
 
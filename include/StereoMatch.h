@@ -10,6 +10,7 @@
 
 #include "ComFunc.h"
 #include "StereoCalib.h"
+#include "opencv2/videoio.hpp"
 #include "DispEst.h"
 #include "args.hxx"
 
@@ -21,7 +22,7 @@
 #define MASK_NONOCC 2
 #define MASK_DISC 3
 
-#define DISPLAY
+//DISPLAY is set by the build (cmake -DDISPLAY=ON/OFF)
 //#define DEBUG_APP
 #define DEBUG_APP_MONITORS
 
@@ -50,10 +51,14 @@ public:
 	bool user_dataset;
 
 	//StereoSGBM Variables
-	cv::Ptr<StereoSGBM> ssgbm;
+	cv::Ptr<cv::StereoSGBM> ssgbm;
 
 	//Stereo GIF Variables
 	unsigned int subsample_rate = 4;;
+	bool streaming_mode;
+	int stripe_rows;
+	bool selective_pp;
+	bool double_buffer;
 private:
 	//Variables
 	bool end_de, recaptureChessboards, recalibrate;
@@ -82,14 +87,14 @@ private:
     int maxDis;
 
     //stage & process time measurements
-    double cvc_time, cvf_time, dispsel_time, pp_time;
+    double cvc_time, cvf_time, dispsel_time, pp_time, pp_skip;
     double cvc_time_avg, cvf_time_avg, dispsel_time_avg, pp_time_avg;
     unsigned int frame_count;
 
     //Frame Holders & Camera object
 	cv::Mat lFrame, rFrame, vFrame;
 
-	VideoCapture cap;
+	cv::VideoCapture cap;
 	//Image rectification maps
 	cv::Mat mapl[2], mapr[2];
 	cv::Rect cropBox;
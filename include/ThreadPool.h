@@ -0,0 +1,50 @@
+/*---------------------------------------------------------------------------
+   ThreadPool.h - Persistent Worker Thread Pool Header
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+  ---------------------------------------------------------------------------*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "ComFunc.h"
+#include <deque>
+#include <vector>
+#include <sched.h>
+
+//Work item - uses the pthreads start routine signature of the existing *_thread functions
+struct TP_Task{
+	void *(*func)(void *);
+	void *arg;
+};
+
+//
+// Long-lived pool of worker threads, optionally pinned round-robin to the CPUs of the process affinity mask.
+// Tasks are submitted in batches and completed with a single wait().
+//
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned int n, bool pin = true);
+	~ThreadPool(void);
+
+	unsigned int size(void) const {return nThreads;};
+	int submit(void *(*func)(void *), void *arg);
+	int wait(void);
+
+private:
+	unsigned int nThreads;
+	pthread_t* workers;
+	std::deque<TP_Task> tasks;
+	unsigned int pending;
+	bool stop;
+
+	pthread_mutex_t lock;
+	pthread_cond_t task_cv;
+	pthread_cond_t done_cv;
+
+	static void *worker(void *thread_arg);
+};
+
+#endif //THREADPOOL_H
@@ -4,20 +4,48 @@
 #ifndef GUIDED_FILTER_H
 #define GUIDED_FILTER_H
 
-#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
 
 class FastGuidedFilterImpl;
 
+// Scratch matrices for FastGuidedFilter::filter(p, dst, ws). Keep one per thread and
+// reuse it across calls: once the buffers have been sized by the first call, filtering
+// single-channel inputs of the same size performs no further Mat allocation.
+#define FGF_WS_LO 14
+#define FGF_WS_HI 5
+struct FastGuidedFilterWorkspace
+{
+    cv::Mat in, p;              // depth-converted and subsampled input
+    cv::Mat lo[FGF_WS_LO];      // subsampled resolution
+    cv::Mat hi[FGF_WS_HI];      // full resolution
+    cv::Mat row;                // one row of vertically interpolated coefficients
+};
+
 class FastGuidedFilter
 {
 public:
     FastGuidedFilter(const cv::Mat &I, int r, double eps,int s);
     ~FastGuidedFilter();
 
+    // Recompute the guide statistics for a new guide image, reusing the filter's storage
+    void setGuide(const cv::Mat &I);
+
     cv::Mat filter(const cv::Mat &p, int depth = -1) const;
+    // dst may be p (in-place), ws must not be shared between concurrent calls
+    void filter(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws, int depth = -1) const;
+    // As above for a single-channel p that is already at the subsampled resolution
+    // (cols/s x rows/s, sampled as cv::resize INTER_NN would); dst is full resolution
+    void filterSubsampled(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws) const;
+    // Fused upsample, evaluate & winner-takes-all: the filtered slice p (disparity d) is
+    // folded into minCost/dispMap (CV_32FC1/CV_8UC1) directly, ties keep the lower disparity.
+    // Row rowStart of the guide maps to row 0 of minCost/dispMap (rowEnd < 0: minCost.rows rows)
+    void filterSubsampledFold(const cv::Mat &p, int d, cv::Mat &minCost, cv::Mat &dispMap,
+                              FastGuidedFilterWorkspace &ws, int rowStart = 0, int rowEnd = -1) const;
 
 private:
     FastGuidedFilterImpl *impl_;
+    int r_, s_;
+    double eps_;
 };
 
 cv::Mat fastGuidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int s = 1,int depth = -1);
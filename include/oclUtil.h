@@ -108,6 +108,19 @@ std::string imageChannelDataTypeToString(cl_channel_type channelDataType);
  */
 bool cleanUpOpenCL(cl_context context, cl_command_queue commandQueue, cl_program program, cl_kernel kernel, cl_mem* memoryObjects, int numberOfMemoryObjects);
 
+/**
+ * \brief Which OpenCL platform & device to use, and whether to fission the device.
+ * \details subUnits takes precedence over affinity when both are set.
+ */
+struct OCLDeviceConfig
+{
+    int platform;       //platform index, -1 for the first platform
+    int device;         //device index on the platform, -1 for the first accelerator, else GPU, else CPU
+    cl_uint subUnits;   //if > 0, partition by counts and use a sub-device of this many compute units
+    cl_bitfield affinity; //if != 0, partition by this CL_DEVICE_AFFINITY_DOMAIN_* and use the first sub-device
+    OCLDeviceConfig() : platform(-1), device(-1), subUnits(0), affinity(0) {}
+};
+
 /**
  * \brief Create an OpenCL context on a device on the first available platform.
  * \param[out] context Pointer to the created OpenCL context.
@@ -116,11 +129,23 @@ bool cleanUpOpenCL(cl_context context, cl_command_queue commandQueue, cl_program
 bool createContext(cl_context* context);
 
 /**
- * \brief Create an OpenCL context for a sub-device of a device on the first available platform.
+ * \brief Create an OpenCL context on the platform, device or sub-device selected by config.
  * \param[out] context Pointer to the created OpenCL context.
+ * \param[in] config The platform & device selection.
  * \return False if an error occurred, otherwise true.
  */
-bool createSubDeviceContext(cl_context* context, cl_int numComputeUnits);
+bool createContext(cl_context* context, const OCLDeviceConfig& config);
+
+/**
+ * \brief Partition a device (OpenCL 1.2 device fission) as set by config.subUnits or config.affinity.
+ * \details The other sub-devices of the partition are released, so their compute units stay free
+ *          for other processes.
+ * \param[in] device The device to partition.
+ * \param[in] config The partitioning.
+ * \param[out] subDevice The first sub-device, release it with clReleaseDevice.
+ * \return False if an error occurred, otherwise true.
+ */
+bool createSubDevice(cl_device_id device, const OCLDeviceConfig& config, cl_device_id* subDevice);
 
 /**
  * \brief Create an OpenCL command queue for a given context.
@@ -133,13 +158,40 @@ bool createCommandQueue(cl_context context, cl_command_queue* commandQueue, cl_d
 
 /**
  * \brief Create an OpenCL program from a given file and compile it.
+ * \details When the library is built with EMBED_CL the source compiled into it under the same file
+ *          name is used instead of the file. The built binary is cached in clCacheDir(), keyed by
+ *          the source, device, driver version and build options, and loaded from there on later runs.
  * \param[in] context The OpenCL context in use.
  * \param[in] device The OpenCL device to compile the kernel for.
  * \param[in] filename Name of the file containing the OpenCL kernel code to load.
  * \param[out] program The created OpenCL program object.
+ * \param[in] options Build options passed to clBuildProgram.
  * \return False if an error occurred, otherwise true.
  */
-bool createProgram(cl_context context, cl_device_id device, std::string filename, cl_program* program);
+bool createProgram(cl_context context, cl_device_id device, std::string filename, cl_program* program, std::string options = "");
+
+/**
+ * \brief Directory of the OpenCL program binary cache.
+ * \details $PRIME_CL_CACHE if set (an empty value disables the cache), otherwise
+ *          $XDG_CACHE_HOME/primestereo or $HOME/.cache/primestereo.
+ * \return The directory, empty if there is none.
+ */
+std::string clCacheDir(void);
+
+/**
+ * \brief Identify a device & its driver for the caches in clCacheDir().
+ * \param[in] device The device.
+ * \return A hash of the device vendor, name, version, driver version and compute units in hex.
+ */
+std::string clDeviceKey(cl_device_id device);
+
+/**
+ * \brief Replace a file in clCacheDir(), through a temporary file so readers never see it partly written.
+ * \param[in] name The file name.
+ * \param[in] contents The new contents.
+ * \return False if there is no cache directory or the file could not be written, otherwise true.
+ */
+bool writeCacheFile(const std::string& name, const std::string& contents);
 
 /**
  * \brief Query an OpenCL device to see if it supports an extension.
@@ -7,6 +7,8 @@
   ---------------------------------------------------------------------------*/
 #include "CVC.h"
 
+using namespace cv;
+
 CVC::CVC(void)
 {
 #ifdef DEBUG_APP
@@ -40,7 +42,7 @@ float myCostGrd(float* lC, float* lG)
 
 int CVC::preprocess(const Mat& Img, Mat& GrdX)
 {
-	cv::cvtColor(Img, GrdX, CV_RGB2GRAY);
+	cv::cvtColor(Img, GrdX, cv::COLOR_RGB2GRAY);
 	cv::Sobel(GrdX, GrdX, CV_32F, 1, 0, 1);
 	return 0;
 }
@@ -177,3 +179,169 @@ int CVC::buildCV_right(const Mat& lImg, const Mat& rImg, const Mat& lGrdX, const
 	}
 	return 0;
 }
+
+//Split the frame into planes so the row kernels can use contiguous vector loads
+int CVC::preprocess(const Mat& Img, Mat& GrdX, Mat* Planes)
+{
+	preprocess(Img, GrdX);
+	cv::split(Img, Planes);
+	Planes[3] = GrdX;
+	return 0;
+}
+
+//Row pointers of plane set P at row y, offset by x
+static inline void planeRow(const Mat* P, int y, int x, const float* row[CVC_PLANES])
+{
+	for(int p = 0; p < CVC_PLANES; ++p)
+		row[p] = P[p].ptr<float>(y) + x;
+}
+
+void *CVC::buildCV_band_thread(void *thread_arg)
+{
+	struct buildCV_band_TD *t_data = static_cast<struct buildCV_band_TD *>(thread_arg);
+
+	t_data->constructor->buildCV_band_sub(*t_data->grid, t_data->lPlanes, t_data->rPlanes, t_data->yStart, t_data->yEnd,
+										t_data->dStart, t_data->dEnd, t_data->lcostVol, t_data->rcostVol, *t_data->gather);
+	return (void*)0;
+}
+
+//Source index of each destination index, exactly as cv::resize computes it for INTER_NN
+static void nnIndex(int src, int dst, std::vector<int>& idx)
+{
+	double ifx = 1. / ((double)dst / src);
+	idx.resize(dst);
+	for(int i = 0; i < dst; ++i)
+		idx[i] = std::min(cvFloor(i * ifx), src - 1);
+}
+
+int CVC::setupSubGrid(const Mat* lPlanes, const Mat* rPlanes, int s, CVC_SubGrid& grid)
+{
+	int wid = lPlanes[0].cols;
+	int hei = lPlanes[0].rows;
+	cv::Size subSize(wid / s, hei / s);
+
+	grid.s = s;
+	nnIndex(wid, subSize.width, grid.xIdx);
+	nnIndex(hei, subSize.height, grid.yIdx);
+	for(int p = 0; p < CVC_PLANES; ++p)
+	{
+		if(s == 1)
+		{
+			grid.lSub[p] = lPlanes[p];
+			grid.rSub[p] = rPlanes[p];
+			continue;
+		}
+		cv::resize(lPlanes[p], grid.lSub[p], subSize, 0, 0, CV_INTER_NN);
+		cv::resize(rPlanes[p], grid.rSub[p], subSize, 0, 0, CV_INTER_NN);
+	}
+	return 0;
+}
+
+//Row y of both views at disparity d on the full resolution grid (s == 1). The cost is symmetric
+//in its two pixels, so C(r[x], l[x+d]) is the left cost at x+d: the right row is a shear copy
+//of the left row and only its border (x >= wid - d) needs computing.
+static inline void costRow_full(const CVC_Kernels& k, const Mat* lPlanes, const Mat* rPlanes,
+								int y, int wid, int d, float* lcost, float* rcost)
+{
+	const float* lRow[CVC_PLANES];
+	const float* rRow[CVC_PLANES];
+	d = std::min(d, wid);
+
+	//Left view: C(l[x], r[x-d]), border while x < d
+	planeRow(lPlanes, y, 0, lRow);
+	k.border(lRow, d, lcost);
+	planeRow(lPlanes, y, d, lRow);
+	planeRow(rPlanes, y, 0, rRow);
+	k.row(lRow, rRow, wid - d, lcost + d);
+
+	//Right view: shear copy, border once x >= wid - d
+	memcpy(rcost, lcost + d, (wid - d) * sizeof(float));
+	planeRow(rPlanes, y, wid - d, rRow);
+	k.border(rRow, d, rcost + wid - d);
+}
+
+//Subsampled row j of both views at disparity d. The pair pixels are gathered into
+//contiguous rows so the vector kernels can be used unchanged.
+static inline void costRow_sub(const CVC_Kernels& k, const CVC_SubGrid& grid, const Mat* lPlanes, const Mat* rPlanes,
+								int j, int d, float* gather, float* lcost, float* rcost)
+{
+	const int wid = lPlanes[0].cols;
+	const int subWid = grid.lSub[0].cols;
+	const int y = grid.yIdx[j];
+	const int* xIdx = &grid.xIdx[0];
+	const float* ref[CVC_PLANES];
+	const float* pair[CVC_PLANES];
+	const float* src[CVC_PLANES];
+	float* dst[CVC_PLANES];
+
+	//Left view: C(l[x], r[x-d]), border while x < d
+	int i0 = 0;
+	while(i0 < subWid && xIdx[i0] < d)
+		i0++;
+	planeRow(rPlanes, y, 0, src);
+	for(int p = 0; p < CVC_PLANES; ++p)
+	{
+		dst[p] = gather + p*subWid;
+		for(int i = i0; i < subWid; ++i)
+			dst[p][i] = src[p][xIdx[i] - d];
+		pair[p] = dst[p] + i0;
+	}
+	planeRow(grid.lSub, j, 0, ref);
+	k.border(ref, i0, lcost);
+	planeRow(grid.lSub, j, i0, ref);
+	k.row(ref, pair, subWid - i0, lcost + i0);
+
+	//Right view: C(r[x], l[x+d]), border once x >= wid - d
+	int i1 = 0;
+	while(i1 < subWid && xIdx[i1] < wid - d)
+		i1++;
+	planeRow(lPlanes, y, 0, src);
+	for(int p = 0; p < CVC_PLANES; ++p)
+	{
+		for(int i = 0; i < i1; ++i)
+			dst[p][i] = src[p][xIdx[i] + d];
+		pair[p] = dst[p];
+	}
+	planeRow(grid.rSub, j, 0, ref);
+	k.row(ref, pair, i1, rcost);
+	planeRow(grid.rSub, j, i1, ref);
+	k.border(ref, subWid - i1, rcost + i1);
+}
+
+int CVC::buildCV_sub(const CVC_SubGrid& grid, const Mat* lPlanes, const Mat* rPlanes, const int d, Mat& lcost, Mat& rcost,
+						std::vector<float>& gather)
+{
+	const CVC_Kernels& k = cvcKernels();
+	int subWid = grid.lSub[0].cols;
+	int subHei = grid.lSub[0].rows;
+	gather.resize(CVC_PLANES * subWid);
+
+	for(int j = 0; j < subHei; ++j)
+	{
+		if(grid.s == 1)
+			costRow_full(k, lPlanes, rPlanes, j, subWid, d, lcost.ptr<float>(j), rcost.ptr<float>(j));
+		else
+			costRow_sub(k, grid, lPlanes, rPlanes, j, d, &gather[0], lcost.ptr<float>(j), rcost.ptr<float>(j));
+	}
+	return 0;
+}
+
+int CVC::buildCV_band_sub(const CVC_SubGrid& grid, const Mat* lPlanes, const Mat* rPlanes, int yStart, int yEnd,
+							int dStart, int dEnd, CostVolume* lcostVol, CostVolume* rcostVol, std::vector<float>& gather)
+{
+	const CVC_Kernels& k = cvcKernels();
+	int subWid = grid.lSub[0].cols;
+	gather.resize(CVC_PLANES * subWid);
+
+	for(int j = yStart; j < yEnd; ++j)
+	{
+		for(int d = dStart; d < dEnd; ++d)
+		{
+			if(grid.s == 1)
+				costRow_full(k, lPlanes, rPlanes, j, subWid, d, lcostVol->ptr(d, j), rcostVol->ptr(d, j));
+			else
+				costRow_sub(k, grid, lPlanes, rPlanes, j, d, &gather[0], lcostVol->ptr(d, j), rcostVol->ptr(d, j));
+		}
+	}
+	return 0;
+}
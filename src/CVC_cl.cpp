@@ -7,6 +7,28 @@
    All rights reserved.
   ---------------------------------------------------------------------------*/
 #include "CVC_cl.h"
+#include "OCLRuntime.h"
+
+using namespace cv;
+
+#define FILE_CVC_PROG BASE_DIR "assets/cvc.cl"
+
+//Construction kernels over the planar float inputs, with the pixels per work-item along x
+//and the NDRange dimensions (cvc_float_dl loops over the disparities itself)
+static const struct {const char* name; int pixelsX; cl_uint workDim;} cvcVariants[] =
+{
+	{"cvc_float_nv", 1, 3},
+	{"cvc_float_v4", 4, 3},
+	{"cvc_float_dl", 1, 2},
+};
+static const int CVC_VARIANTS = sizeof(cvcVariants)/sizeof(cvcVariants[0]);
+
+//Work-group sizes tried by the autotuner, 0x0 leaves the choice to the runtime
+static const size_t cvcLocalSizes[][2] =
+{
+	{0, 0}, {8, 8}, {16, 4}, {16, 8}, {16, 16}, {32, 2}, {32, 4}, {32, 8}, {64, 1}, {64, 4}, {128, 1}, {256, 1}
+};
+static const int CVC_LOCAL_SIZES = sizeof(cvcLocalSizes)/sizeof(cvcLocalSizes[0]);
 
 CVC_cl::CVC_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device,
 				Mat* I, const int d) : maxDis(d),
@@ -19,7 +41,7 @@ CVC_cl::CVC_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id
     kernel = 0;
 //    imgType = I->type() & CV_MAT_DEPTH_MASK;
 
-    if (!createProgram(*context, device, FILE_CVC_PROG, &program))
+    if (!OCLRuntime::get()->getProgram(FILE_CVC_PROG, &program))
     {
         cleanUpOpenCL(NULL, NULL, program, NULL, NULL, 0);
         std::cerr << "Failed to create OpenCL program." << __FILE__ << ":"<< __LINE__ << std::endl;
@@ -27,51 +49,28 @@ CVC_cl::CVC_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id
 
     width = (cl_int)I->cols;
     height = (cl_int)I->rows;
-//    channels = (cl_int)I->channels();
-
-//	if(imgType == CV_32F)
-//	{
-		strcpy(kernel_name, "cvc_float_nv");
-		//strcpy(kernel_name, "cvc_float_v4");
-
-		bufferSize_2D = width * height * sizeof(cl_float);
-		bufferSize_3D = width * height * maxDis * sizeof(cl_float);
-
-		//cvc_uchar_nv
-		globalWorksize[0] = (size_t)width;
-		//cvc_uchar_v4
-//		globalWorksize[0] = (size_t)width/4;
-
-		globalWorksize[1] = (size_t)height;
-		globalWorksize[2] = (size_t)maxDis;
-//	}
-//	else if(imgType == CV_8U)
-//	{
-//		strcpy(kernel_name, "cvc_uchar_vx");
-//		//strcpy(kernel_name, "cvc_uchar_v16");
-//		//strcpy(kernel_name, "cvc_uchar_nv");
-//
-//		bufferSize_2D = width * height * sizeof(cl_uchar);
-//		bufferSize_3D = width * height * maxDis * sizeof(cl_uchar);
-//
-//		//cvc_uchar_vx
-//	    globalWorksize[0] = (size_t)height;
-//	    globalWorksize[1] = (size_t)1;
-//		//cvc_uchar_v16
-////		globalWorksize[0] = (size_t)width/16;
-//		//cvc_uchar_nv
-////		globalWorksize[0] = (size_t)width;
-////		globalWorksize[1] = (size_t)height;
-//
-//		globalWorksize[2] = (size_t)maxDis;
-//
-//	}
-//    else{
-//		printf("CVC_cl: Error - Unrecognised data type in processing! (CVC_cl)\n");
-//		exit(1);
-//    }
-	kernel = clCreateKernel(program, kernel_name, &errorNumber);
-    if (!checkSuccess(errorNumber))
+    channels = (cl_int)I->channels();
+
+	bufferSize_2D = width * height * sizeof(cl_float);
+	bufferSize_3D = width * height * maxDis * sizeof(cl_float);
+
+	//The tuned construction kernel for this device & resolution if there is one, otherwise
+	//cvc_float_nv until the first frame has been autotuned
+	this->device = device;
+	variant = -1;
+	tuned = loadTuning();
+	if(!tuned)
+	{
+		const char* tune = getenv("PRIME_CL_TUNE");
+		tuned = tune && !strcmp(tune, "0");
+		setVariant(0, NULL);
+	}
+    bool createKernelsSuccess = (kernel != 0);
+	kernel_split_32f = clCreateKernel(program, "cvc_split_float", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+	kernel_split_8u = clCreateKernel(program, "cvc_split_uchar", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+    if (!createKernelsSuccess)
     {
         cleanUpOpenCL(NULL, NULL, NULL, NULL, NULL, 0);
         std::cerr << "Failed to create OpenCL kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
@@ -83,129 +82,363 @@ CVC_cl::CVC_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id
 
     /* An event to associate with the Kernel. Allows us to retreive profiling information later. */
     event = 0;
+
+    globalWorksize_2D[0] = (size_t)width;
+    globalWorksize_2D[1] = (size_t)height;
+
+    //Allocated on the first frame, once its type is known
+    uploadQueue = commandQueue;
+    inputType = -1;
+    bufferSize_input = 0;
+    for (int i = 0; i < CVC_SLOTS; i++)
+    {
+        lInput[i] = rInput[i] = 0;
+        inputFree[i][0] = inputFree[i][1] = 0;
+    }
 }
 CVC_cl::~CVC_cl(void)
 {
     /* Release OpenCL objects. */
-    cleanUpOpenCL(NULL, NULL, NULL, kernel, NULL, 0);
+    for (int i = 0; i < CVC_SLOTS; i++)
+    {
+        releaseSlot(i);
+        if(lInput[i]) OCLRuntime::get()->releaseBuffer(lInput[i]);
+        if(rInput[i]) OCLRuntime::get()->releaseBuffer(rInput[i]);
+    }
+    clReleaseKernel(kernel_split_32f);
+    clReleaseKernel(kernel_split_8u);
+    cleanUpOpenCL(NULL, NULL, program, kernel, NULL, 0);
+}
+
+int CVC_cl::allocInput(int type)
+{
+    if(type == inputType)
+        return 0;
+    if(type != CV_32FC3 && type != CV_8UC3)
+    {
+        std::cerr << "CVC_cl: Error - Unsupported input type, expected CV_32FC3 or CV_8UC3. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return 1;
+    }
+    bufferSize_input = width * height * channels * (type == CV_8UC3 ? sizeof(cl_uchar) : sizeof(cl_float));
+    bool createMemoryObjectsSuccess = true;
+    for (int i = 0; i < CVC_SLOTS; i++)
+    {
+        releaseSlot(i);
+        if(lInput[i]) OCLRuntime::get()->releaseBuffer(lInput[i]);
+        if(rInput[i]) OCLRuntime::get()->releaseBuffer(rInput[i]);
+        lInput[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_ONLY, bufferSize_input, &errorNumber);
+        createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+        rInput[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_ONLY, bufferSize_input, &errorNumber);
+        createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+    }
+    if (!createMemoryObjectsSuccess)
+    {
+        inputType = -1;
+        std::cerr << "Failed to create OpenCL buffers. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return 1;
+    }
+    inputType = type;
+    return 0;
+}
+
+//Waits until the split kernels of the slot's last frame have consumed its uploads, then drops
+//the references to the host frames
+void CVC_cl::releaseSlot(int slot)
+{
+    for (int v = 0; v < 2; v++)
+    {
+        if(!inputFree[slot][v])
+            continue;
+        clWaitForEvents(1, &inputFree[slot][v]);
+        clReleaseEvent(inputFree[slot][v]);
+        inputFree[slot][v] = 0;
+    }
+    lFrame[slot].release();
+    rFrame[slot].release();
+}
+
+//Splits one uploaded view into its colour planes & gradient, behind writeEvent
+int CVC_cl::splitInput(cl_mem* input, cl_event writeEvent, cl_mem* memoryObjects, int view, cl_event* splitEvent)
+{
+    cl_kernel split = (inputType == CV_8UC3) ? kernel_split_8u : kernel_split_32f;
+
+    int arg_num = 0;
+    bool setKernelArgumentsSuccess = true;
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(split, arg_num++, sizeof(cl_mem), input));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(split, arg_num++, sizeof(cl_int), &height));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(split, arg_num++, sizeof(cl_int), &width));
+    for (int i = 0; i < channels; i++)
+        setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(split, arg_num++, sizeof(cl_mem), &memoryObjects[view * channels + i]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(split, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LGRDX + view]));
+    if (!setKernelArgumentsSuccess)
+    {
+        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return 1;
+    }
+
+    if(OCL_STATS) printf("CVC_cl: Running Split Kernels\n");
+    if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, split, 2, NULL, globalWorksize_2D, NULL, 1, &writeEvent, splitEvent)))
+    {
+        std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return 1;
+    }
+    if(OCL_STATS)
+    {
+        clWaitForEvents(1, splitEvent);
+        printProfilingInfo(*splitEvent);
+    }
+    return 0;
 }
 
-int CVC_cl::buildCV(const Mat& lImg, const Mat& rImg, cl_mem *memoryObjects)
+int CVC_cl::buildCV(const Mat& lImg, const Mat& rImg, cl_mem *memoryObjects, cl_event* doneEvent, int slot)
 {
-	lImgRGB = new Mat[lImg.channels()];
-    rImgRGB = new Mat[rImg.channels()];
-    split(lImg, lImgRGB);
-    split(rImg, rImgRGB);
-
-	cvtColor(lImg, lGray, CV_RGB2GRAY);
-	cvtColor(rImg, rGray, CV_RGB2GRAY);
-
-	/* Map the input memory objects to host side pointers. */
-	bool EnqueueMapBufferSuccess = true;
-//	if(imgType == CV_32F)
-//	{
-	    //Sobel filter to compute X gradient     <-- investigate Mali Sobel OpenCL kernel
-		Sobel( lGray, lGrdX, CV_32F, 1, 0, 1 ); // ex time 16 -17ms
-		Sobel( rGray, rGrdX, CV_32F, 1, 0, 1 ); // for both
-		lGrdX += 0.5;
-		rGrdX += 0.5;
-
-		cl_float *clbuffer_lImgRGB[3], *clbuffer_rImgRGB[3];
-		for (int i = 0; i < channels; i++)
-		{
-			clbuffer_lImgRGB[i] = (cl_float*)clEnqueueMapBuffer(*commandQueue, memoryObjects[i], CL_TRUE, CL_MAP_WRITE | CL_MAP_READ, 0, bufferSize_2D, 0, NULL, NULL, &errorNumber);
-			EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-			clbuffer_rImgRGB[i] = (cl_float*)clEnqueueMapBuffer(*commandQueue, memoryObjects[i+channels], CL_TRUE, CL_MAP_WRITE | CL_MAP_READ, 0, bufferSize_2D, 0, NULL, NULL, &errorNumber);
-			EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-
-			memcpy(clbuffer_lImgRGB[i], lImgRGB[i].data, bufferSize_2D);
-			memcpy(clbuffer_rImgRGB[i], rImgRGB[i].data, bufferSize_2D);
-		}
-//	}
-//	else if(imgType == CV_8U)
-//	{
-//		//Sobel filter to compute X gradient
-//		Sobel( lGray, lGrdX, CV_8U, 1, 0, 1 );
-//		Sobel( rGray, rGrdX, CV_8U, 1, 0, 1 );
-//		lGrdX += 0.5;
-//		rGrdX += 0.5;
-//
-//		cl_uchar *clbuffer_lImgRGB[3], *clbuffer_rImgRGB[3];
-//		//Six 1-channel 2D buffers W*H
-//		for (int i = 0; i < channels; i++)
-//		{
-//			clbuffer_lImgRGB[i] = (cl_uchar*)clEnqueueMapBuffer(*commandQueue, memoryObjects[i], CL_TRUE, CL_MAP_WRITE | CL_MAP_READ, 0, bufferSize_2D, 0, NULL, NULL, &errorNumber);
-//			EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-//			clbuffer_rImgRGB[i] = (cl_uchar*)clEnqueueMapBuffer(*commandQueue, memoryObjects[i+channels], CL_TRUE, CL_MAP_WRITE | CL_MAP_READ, 0, bufferSize_2D, 0, NULL, NULL, &errorNumber);
-//			EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-//
-//			memcpy(clbuffer_lImgRGB[i], lImgRGB[i].data, bufferSize_2D);
-//			memcpy(clbuffer_rImgRGB[i], rImgRGB[i].data, bufferSize_2D);
-//		}
-//	}
-
-	//Two 1-channel 2D buffers W*H
-	cl_uchar *clbuffer_lGrdX = (cl_uchar*)clEnqueueMapBuffer(*commandQueue, memoryObjects[CVC_LGRDX], CL_TRUE, CL_MAP_WRITE | CL_MAP_READ, 0, bufferSize_2D, 0, NULL, NULL, &errorNumber);
-	EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-	cl_uchar *clbuffer_rGrdX = (cl_uchar*)clEnqueueMapBuffer(*commandQueue, memoryObjects[CVC_RGRDX], CL_TRUE, CL_MAP_WRITE | CL_MAP_READ, 0, bufferSize_2D, 0, NULL, NULL, &errorNumber);
-	EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-	if (!EnqueueMapBufferSuccess)
+	if(lImg.type() != rImg.type() || channels != 3 || allocInput(lImg.type()))
+		return 1;
+
+	if(slot < 0 || slot >= CVC_SLOTS)
+		return 1;
+	//The slot's previous frame is normally long done, this only blocks if the caller runs ahead
+	releaseSlot(slot);
+
+	//One upload per view of the interleaved frame, split & gradient run on the device.
+	//The slot holds the frames until the uploads are consumed, so the writes need not block.
+	lFrame[slot] = lImg.isContinuous() ? lImg : lImg.clone();
+	rFrame[slot] = rImg.isContinuous() ? rImg : rImg.clone();
+	cl_event writeEvents[2];
+	bool EnqueueWriteSuccess = true;
+	EnqueueWriteSuccess &= checkSuccess(clEnqueueWriteBuffer(*uploadQueue, lInput[slot], CL_FALSE, 0, bufferSize_input, lFrame[slot].data, 0, NULL, &writeEvents[0]));
+	EnqueueWriteSuccess &= checkSuccess(clEnqueueWriteBuffer(*uploadQueue, rInput[slot], CL_FALSE, 0, bufferSize_input, rFrame[slot].data, 0, NULL, &writeEvents[1]));
+	if (!EnqueueWriteSuccess)
+	{
+	   std::cerr << "Writing memory objects failed " << __FILE__ << ":"<< __LINE__ << std::endl;
+	   return 1;
+	}
+	if(uploadQueue != commandQueue)
+		clFlush(*uploadQueue);
+
+	cl_event* splitEvents = inputFree[slot];
+	bool lSplit = !splitInput(&lInput[slot], writeEvents[0], memoryObjects, 0, &splitEvents[0]);
+	bool rSplit = lSplit && !splitInput(&rInput[slot], writeEvents[1], memoryObjects, 1, &splitEvents[1]);
+	clReleaseEvent(writeEvents[0]);
+	clReleaseEvent(writeEvents[1]);
+	if (!lSplit) splitEvents[0] = 0;
+	if (!rSplit)
 	{
-	   cleanUpOpenCL(NULL, NULL, program, NULL, NULL, 0);
-	   std::cerr << "Mapping memory objects failed " << __FILE__ << ":"<< __LINE__ << std::endl;
+	   splitEvents[1] = 0;
+	   return 1;
 	}
 
-    //printf("CVC_cl: Copying data to OpenCL memory space\n");
-	memcpy(clbuffer_lGrdX, lGrdX.data, bufferSize_2D);
-	memcpy(clbuffer_rGrdX, rGrdX.data, bufferSize_2D);
+    if(!tuned)
+    {
+        //First frame without a tuning result, the variants are timed on its planes
+        clWaitForEvents(2, splitEvents);
+        if(tuneKernel(memoryObjects))
+            setVariant(0, NULL);
+        tuned = true;
+    }
+    if(setKernelArgs(memoryObjects))
+        return 1;
+
+    if(OCL_STATS) printf("CVC_cl: Running CVC Kernels\n");
+    /* Enqueue the kernel */
+    if (enqueueCV(2, splitEvents, &event))
+    {
+        std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return 1;
+    }
+
+    /* Print the profiling information for the event. */
+    if(OCL_STATS)
+    {
+        clWaitForEvents(1, &event);
+        printProfilingInfo(event);
+    }
+    /* The consumer takes over the event, otherwise release it. */
+    if (doneEvent)
+        *doneEvent = event;
+    else if (!checkSuccess(clReleaseEvent(event)))
+    {
+        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int CVC_cl::setVariant(int v, const size_t* local)
+{
+    if(v < 0 || v >= CVC_VARIANTS)
+        return 1;
+    if(v != variant || !kernel)
+    {
+        cl_kernel variantKernel = clCreateKernel(program, cvcVariants[v].name, &errorNumber);
+        if (!checkSuccess(errorNumber))
+        {
+            std::cerr << "Failed to create OpenCL kernel " << cvcVariants[v].name << ". " << __FILE__ << ":"<< __LINE__ << std::endl;
+            return 1;
+        }
+        if(kernel) clReleaseKernel(kernel);
+        kernel = variantKernel;
+        variant = v;
+        strcpy(kernel_name, cvcVariants[v].name);
+    }
+    localWorksize[0] = local ? local[0] : 0;
+    localWorksize[1] = local ? local[1] : 0;
+
+    //Rounded up to whole work-groups, the kernels skip the work-items past the image
+    const size_t lx = localWorksize[0] ? localWorksize[0] : 1;
+    const size_t ly = localWorksize[1] ? localWorksize[1] : 1;
+    const size_t items = (width + cvcVariants[v].pixelsX - 1) / cvcVariants[v].pixelsX;
+    globalWorksize[0] = (items + lx - 1) / lx * lx;
+    globalWorksize[1] = (height + ly - 1) / ly * ly;
+    globalWorksize[2] = (size_t)maxDis;
+    return 0;
+}
 
+int CVC_cl::setKernelArgs(cl_mem* memoryObjects)
+{
     int arg_num = 0;
     /* Setup the kernel arguments. */
     bool setKernelArgumentsSuccess = true;
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LIMGR]));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LIMGG]));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LIMGB]));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_RIMGR]));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_RIMGG]));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_RIMGB]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LIMGR]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LIMGG]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LIMGB]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_RIMGR]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_RIMGG]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_RIMGB]));
     setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_LGRDX]));
     setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CVC_RGRDX]));
     setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_int), &height));
     setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_int), &width));
     setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CV_LCV]));
     setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[CV_RCV]));
+    if(cvcVariants[variant].workDim == 2) //the disparity loop is inside the kernel
+        setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_int), &maxDis));
     if (!setKernelArgumentsSuccess)
     {
-		cleanUpOpenCL(NULL, NULL, NULL, NULL, NULL, 0);
         std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return 1;
     }
+    return 0;
+}
 
-    if(OCL_STATS) printf("CVC_cl: Running CVC Kernels\n");
-    /* Enqueue the kernel */
-    if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel, 3, NULL, globalWorksize, NULL, 0, NULL, &event)))
+int CVC_cl::enqueueCV(cl_uint numWaitEvents, const cl_event* waitEvents, cl_event* cvEvent)
+{
+    const size_t local[3] = {localWorksize[0], localWorksize[1], 1};
+    return checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel, cvcVariants[variant].workDim, NULL, globalWorksize,
+                        localWorksize[0] ? local : NULL, numWaitEvents, waitEvents, cvEvent)) ? 0 : 1;
+}
+
+//Tuning results are keyed by device & driver and the volume dimensions
+std::string CVC_cl::tuningKey(void)
+{
+    return clDeviceKey(device) + " " + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(maxDis);
+}
+
+//One line per key: <device> <width>x<height>x<maxDis> <kernel> <local x> <local y>
+bool CVC_cl::loadTuning(void)
+{
+    std::string dir = clCacheDir();
+    if(dir.empty())
+        return false;
+    std::ifstream tuneFile((dir + "/" CVC_TUNE_FILE).c_str());
+    const std::string key = tuningKey();
+    std::string line;
+    while(std::getline(tuneFile, line))
     {
-        cleanUpOpenCL(NULL, NULL, NULL, NULL, NULL, 0);
-        std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
+        std::istringstream fields(line);
+        std::string dev, dims, name;
+        size_t local[2];
+        if(!(fields >> dev >> dims >> name >> local[0] >> local[1]) || dev + " " + dims != key)
+            continue;
+        for(int v = 0; v < CVC_VARIANTS; v++)
+        {
+            if(name == cvcVariants[v].name && !setVariant(v, local))
+            {
+                printf("CVC_cl: Tuned kernel %s, work-group %zux%zu\n", kernel_name, local[0], local[1]);
+                return true;
+            }
+        }
     }
+    return false;
+}
+
+void CVC_cl::saveTuning(void)
+{
+    std::string dir = clCacheDir();
+    if(dir.empty())
+        return;
+    std::ifstream tuneFile((dir + "/" CVC_TUNE_FILE).c_str());
+    const std::string key = tuningKey();
+    std::string contents, line;
+    while(std::getline(tuneFile, line))
+        if(line.compare(0, key.size() + 1, key + " "))
+            contents += line + "\n";
+    tuneFile.close();
+    contents += key + " " + kernel_name + " " + std::to_string(localWorksize[0]) + " " + std::to_string(localWorksize[1]) + "\n";
+    if(!writeCacheFile(CVC_TUNE_FILE, contents))
+        std::cerr << "CVC_cl: Could not save the tuning result in " << dir << std::endl;
+}
+
+//Times every variant & work-group size on the uploaded frame and keeps the fastest
+int CVC_cl::tuneKernel(cl_mem* memoryObjects)
+{
+    size_t maxItems[3] = {0, 0, 0};
+    clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL);
 
-    /* Wait for completion */
-    if (!checkSuccess(clFinish(*commandQueue)))
+    int bestVariant = -1;
+    size_t bestLocal[2] = {0, 0};
+    double bestTime = 0;
+    for(int v = 0; v < CVC_VARIANTS; v++)
     {
-        cleanUpOpenCL(NULL, NULL, NULL, NULL, NULL, 0);
-        std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
+        if(setVariant(v, NULL) || setKernelArgs(memoryObjects))
+            continue;
+        size_t maxGroup = 0;
+        clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxGroup, NULL);
 
-    /* Print the profiling information for the event. */
-    if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
+        for(int l = 0; l < CVC_LOCAL_SIZES; l++)
+        {
+            const size_t* local = cvcLocalSizes[l];
+            if(local[0] && (local[0] * local[1] > maxGroup || local[0] > maxItems[0] || local[1] > maxItems[1]))
+                continue;
+            setVariant(v, local);
+
+            //The first run warms up, the fastest of the timed runs counts
+            double time = -1;
+            for(int r = 0; r <= CVC_TUNE_REPS; r++)
+            {
+                cl_event runEvent = 0;
+                if(enqueueCV(0, NULL, &runEvent))
+                {
+                    time = -1;
+                    break;
+                }
+                clWaitForEvents(1, &runEvent);
+                cl_ulong start = 0, end = 0;
+                clGetEventProfilingInfo(runEvent, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+                clGetEventProfilingInfo(runEvent, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+                clReleaseEvent(runEvent);
+                if(r && (time < 0 || (end - start) / 1000000.0 < time))
+                    time = (end - start) / 1000000.0;
+            }
+            if(time < 0)
+                continue;
+            if(OCL_STATS) printf("CVC_cl: %s, work-group %zux%zu: %.3f ms\n", kernel_name, local[0], local[1], time);
+            if(bestVariant < 0 || time < bestTime)
+            {
+                bestVariant = v;
+                bestLocal[0] = local[0];
+                bestLocal[1] = local[1];
+                bestTime = time;
+            }
+        }
+    }
+    if(bestVariant < 0 || setVariant(bestVariant, bestLocal))
     {
-        cleanUpOpenCL(*context, *commandQueue, program, NULL, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        std::cerr << "CVC_cl: Autotuning failed, using the default kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
         return 1;
     }
-
+    printf("CVC_cl: Autotuned kernel %s, work-group %zux%zu (%.3f ms)\n", kernel_name, bestLocal[0], bestLocal[1], bestTime);
+    saveTuning();
     return 0;
 }
@@ -0,0 +1,112 @@
+/*---------------------------------------------------------------------------
+   CVC_simd.cpp - Vectorised Cost Volume Construction Kernels
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+  ---------------------------------------------------------------------------*/
+#include "CVC.h"
+
+//Keep a*b + c*d unfused so every kernel matches myCostGrd bit-for-bit (in non-FMA builds)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CVC_X86
+#include <immintrin.h>
+#endif
+
+//cost[i] = ALPHA*|a - b|_rgb + (1 - ALPHA)*|a - b|_grd
+static void cvc_row_scalar(const float* const a[CVC_PLANES], const float* const b[CVC_PLANES], int n, float* cost)
+{
+	for(int i = 0; i < n; ++i)
+	{
+		float clrDiff = fabs(a[0][i] - b[0][i]) + fabs(a[1][i] - b[1][i]) + fabs(a[2][i] - b[2][i]);
+		float grdDiff = fabs(a[3][i] - b[3][i]);
+		cost[i] = ALPHA_32F * clrDiff + (1 - ALPHA_32F) * grdDiff;
+	}
+}
+
+#ifdef CVC_X86
+__attribute__((target("avx2")))
+static void cvc_row_avx2(const float* const a[CVC_PLANES], const float* const b[CVC_PLANES], int n, float* cost)
+{
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	const __m256 alpha = _mm256_set1_ps(ALPHA_32F);
+	const __m256 beta = _mm256_set1_ps(1 - ALPHA_32F);
+
+	int i = 0;
+	for(; i + 8 <= n; i += 8)
+	{
+		__m256 dr = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(a[0] + i), _mm256_loadu_ps(b[0] + i)));
+		__m256 dg = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(a[1] + i), _mm256_loadu_ps(b[1] + i)));
+		__m256 db = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(a[2] + i), _mm256_loadu_ps(b[2] + i)));
+		__m256 dx = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(a[3] + i), _mm256_loadu_ps(b[3] + i)));
+		__m256 clr = _mm256_add_ps(_mm256_add_ps(dr, dg), db);
+		_mm256_storeu_ps(cost + i, _mm256_add_ps(_mm256_mul_ps(alpha, clr), _mm256_mul_ps(beta, dx)));
+	}
+	if(i < n)
+	{
+		const float* at[CVC_PLANES] = {a[0] + i, a[1] + i, a[2] + i, a[3] + i};
+		const float* bt[CVC_PLANES] = {b[0] + i, b[1] + i, b[2] + i, b[3] + i};
+		cvc_row_scalar(at, bt, n - i, cost + i);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void cvc_row_avx512(const float* const a[CVC_PLANES], const float* const b[CVC_PLANES], int n, float* cost)
+{
+	const __m512 alpha = _mm512_set1_ps(ALPHA_32F);
+	const __m512 beta = _mm512_set1_ps(1 - ALPHA_32F);
+
+	for(int i = 0; i < n; i += 16)
+	{
+		//Masked loads/stores handle the row tail
+		__mmask16 m = (n - i >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+		__m512 dr = _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, a[0] + i), _mm512_maskz_loadu_ps(m, b[0] + i)));
+		__m512 dg = _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, a[1] + i), _mm512_maskz_loadu_ps(m, b[1] + i)));
+		__m512 db = _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, a[2] + i), _mm512_maskz_loadu_ps(m, b[2] + i)));
+		__m512 dx = _mm512_abs_ps(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, a[3] + i), _mm512_maskz_loadu_ps(m, b[3] + i)));
+		__m512 clr = _mm512_add_ps(_mm512_add_ps(dr, dg), db);
+		_mm512_mask_storeu_ps(cost + i, m, _mm512_add_ps(_mm512_mul_ps(alpha, clr), _mm512_mul_ps(beta, dx)));
+	}
+}
+#endif // CVC_X86
+
+//Border columns compare against BC_32F, evaluated exactly as myCostGrd(lC, lG)
+static void cvc_border_scalar(const float* const a[CVC_PLANES], int n, float* cost)
+{
+	for(int i = 0; i < n; ++i)
+	{
+		float clrDiff = fabs(a[0][i] - BC_32F) + fabs(a[1][i] - BC_32F) + fabs(a[2][i] - BC_32F);
+		float grdDiff = fabs(a[3][i] - BC_32F);
+		cost[i] = ALPHA_32F * clrDiff + (1 - ALPHA_32F) * grdDiff;
+	}
+}
+
+static CVC_Kernels selectKernels(void)
+{
+	CVC_Kernels k = {cvc_row_scalar, cvc_border_scalar, "scalar"};
+#ifdef CVC_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+	{
+		k.row = cvc_row_avx512;
+		k.name = "AVX-512";
+	}
+	else if(__builtin_cpu_supports("avx2"))
+	{
+		k.row = cvc_row_avx2;
+		k.name = "AVX2";
+	}
+#endif // CVC_X86
+	return k;
+}
+
+//Resolved once, on first use
+const CVC_Kernels& cvcKernels(void)
+{
+	static const CVC_Kernels kernels = selectKernels();
+	return kernels;
+}
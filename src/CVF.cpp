@@ -11,6 +11,8 @@
   ---------------------------------------------------------------------------*/
 #include "CVF.h"
 
+using namespace cv;
+
 CVF::CVF()
 {
 #ifdef DEBUG_APP
@@ -1,769 +1,257 @@
 /*---------------------------------------------------------------------------
    CVF_cl.cpp - OpenCL Cost Volume Filter Code
               - Guided Image Filter
-              - Box Filter
   ---------------------------------------------------------------------------
    Author: Charles Leech
    Email: cl19g10 [at] ecs.soton.ac.uk
    Copyright (c) 2016 Charlie Leech, University of Southampton.
   ---------------------------------------------------------------------------*/
 #include "CVF_cl.h"
+#include "OCLRuntime.h"
+
+using namespace cv;
+
+#define FILE_CVF_PROG BASE_DIR "assets/cvf.cl"
 
 CVF_cl::CVF_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, Mat* I, const int d) :
 				context(context), commandQueue(commandQueue), maxDis(d)
 {
 	//OpenCL Setup
     program = 0;
-//    imgType = I->type() & CV_MAT_DEPTH_MASK;
+    kernel_guide = kernel_coeffs = kernel_output = 0;
+    /* Tail of the event chain of enqueued kernels (0 when empty). Allows us to retreive profiling information later. */
+    event = 0;
+	mean_I = var_I = coef = NULL;
 
-    if (!createProgram(*context, device, FILE_CVF_PROG, &program))
+	//Unless the filter can run on this device it is left unusable and the caller does not use OpenCL
+	usable = false;
+    if (!OCLRuntime::get()->getProgram(FILE_CVF_PROG, &program))
     {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_split, NULL, 0);
         std::cerr << "Failed to create OpenCL program." << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
     }
 
-//	if(imgType == CV_32F)
-//	{
-		kernel_mmsd = clCreateKernel(program, "EWMul_SameDim_32F", &errorNumber);
-		kernel_mmdd = clCreateKernel(program, "EWMul_DiffDim_32F", &errorNumber);
-		kernel_mdsd = clCreateKernel(program, "EWDiv_SameDim_32F", &errorNumber);
-		kernel_split = clCreateKernel(program, "Split_32F", &errorNumber);
-		kernel_sub = clCreateKernel(program, "Subtract_32F", &errorNumber);
-		kernel_add = clCreateKernel(program, "Add_32F", &errorNumber);
-		kernel_centf = clCreateKernel(program, "cent_filter_32F", &errorNumber);
-		kernel_var = clCreateKernel(program, "var_math_32F", &errorNumber);
-		kernel_bf = clCreateKernel(program, "BoxFilter_32F", &errorNumber);
-		kernel_bfc_rows = clCreateKernel(program, "BoxRows_32F", &errorNumber);
-		kernel_bfc_cols = clCreateKernel(program, "BoxCols_32F", &errorNumber);
-//		printf("CVF_cl: Float (_32F) OpenCL kernel versions created in context.\n");
-//	}
-//	else if(imgType == CV_8U)
-//	{
-//		kernel_mmsd = clCreateKernel(program, "EWMul_SameDim_8U", &errorNumber);
-//		kernel_mmdd = clCreateKernel(program, "EWMul_DiffDim_8U", &errorNumber);
-//		kernel_mdsd = clCreateKernel(program, "EWDiv_SameDim_8U", &errorNumber);
-//		kernel_split = clCreateKernel(program, "Split_8U", &errorNumber);
-//		kernel_sub = clCreateKernel(program, "Subtract_8U", &errorNumber);
-//		kernel_add = clCreateKernel(program, "Add_8U", &errorNumber);
-//		kernel_centf = clCreateKernel(program, "cent_filter_8U", &errorNumber);
-//		kernel_var = clCreateKernel(program, "var_math_8U", &errorNumber);
-//		kernel_bfc_rows = clCreateKernel(program, "BoxRows_8U", &errorNumber);
-//		kernel_bfc_cols = clCreateKernel(program, "BoxCols_8U", &errorNumber);
-//		printf("CVF_cl: Char (_8U) OpenCL kernel versions created in context.\n");
-//	}
-//    else{
-//		printf("CVF_cl: Error - Unrecognised data type in processing! (CVF_cl)\n");
-//		exit(1);
-//    }
-    if (!checkSuccess(errorNumber))
+	//Fused guided filter kernels: the box means, covariance, 3x3 solve and output are
+	//formed in local memory tiles, so only the coefficients of one chunk of slices are stored
+	kernel_guide = clCreateKernel(program, "GIF_Guide_32F", &errorNumber);
+    bool createKernelsSuccess = checkSuccess(errorNumber);
+	kernel_coeffs = clCreateKernel(program, "GIF_Coeffs_32F", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+	kernel_output = clCreateKernel(program, "GIF_Output_32F", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+    if (!createKernelsSuccess)
     {
-        cleanUpOpenCL(*context, *commandQueue, program, NULL, NULL, 0);
         std::cerr << "Failed to create OpenCL kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		exit(1);
+		return;
     }
     else{
 		printf("CVF_cl: OpenCL kernel versions created in context.\n");
     }
 
-    /* An event to associate with the Kernel. Allows us to retreive profiling information later. */
-    event = 0;
+	//The kernels need a full CVF_TILE x CVF_TILE work-group
+	cl_kernel kernels[3] = {kernel_guide, kernel_coeffs, kernel_output};
+	for(int i = 0; i < 3; i++)
+	{
+		size_t maxWorkGroupSize = 0;
+		clGetKernelWorkGroupInfo(kernels[i], device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, NULL);
+		if(maxWorkGroupSize < CVF_TILE * CVF_TILE)
+		{
+			std::cerr << "CVF_cl: Device work-group size (" << maxWorkGroupSize << ") is too small for the "
+					  << CVF_TILE << "x" << CVF_TILE << " filter tiles. " << __FILE__ << ":"<< __LINE__ << std::endl;
+			return;
+		}
+	}
 
 	width = I->cols;
 	height = I->rows;
+	sliceChunk = std::min(maxDis, (cl_int)CVF_SLICES);
 
-	//OpenCL Buffers that are type dependent (in accending size order)
-//	if(imgType == CV_32F)
-//	{
-		bufferSize_2D = width * height * sizeof(cl_float);
-		bufferSize_3D = width * height * maxDis * sizeof(cl_float);
-//	}
-//	else if(imgType == CV_8U)
-//	{
-//		bufferSize_2D = width * height * sizeof(cl_uchar);
-//		bufferSize_3D = width * height * maxDis * sizeof(cl_uchar);
-//	}
+	bufferSize_2D = width * height * sizeof(cl_float);
+	bufferSize_chunk = width * height * sliceChunk * sizeof(cl_float);
 
-    globalWorksize_3D[0] = (size_t)width;
-    globalWorksize_3D[1] = (size_t)height;
-    globalWorksize_3D[2] = (size_t)maxDis;
-
-    globalWorksize_2D[0] = (size_t)width;
-    globalWorksize_2D[1] = (size_t)height;
+	//Rounded up to whole tiles, the kernels skip the out-of-image work-items
+    globalWorksize_2D[0] = (size_t)((width + CVF_TILE - 1) / CVF_TILE * CVF_TILE);
+    globalWorksize_2D[1] = (size_t)((height + CVF_TILE - 1) / CVF_TILE * CVF_TILE);
     globalWorksize_2D[2] = (size_t)1;
 
-    globalWorksize_split[0] = (size_t)width/3;
-    globalWorksize_split[1] = (size_t)height;
-
-    globalWorksize_bf_3D[0] = (size_t)width/16;
-    globalWorksize_bf_3D[1] = (size_t)height;
-    globalWorksize_bf_3D[2] = (size_t)maxDis;
-
-    globalWorksize_bf_2D[0] = (size_t)width/16;
-    globalWorksize_bf_2D[1] = (size_t)height;
-    globalWorksize_bf_2D[2] = (size_t)1;
-
-    globalWorksize_bfc_2D[0] = (size_t)height;
-    globalWorksize_bfc_2D[1] = (size_t)1;
-    globalWorksize_bfc_2D[2] = (size_t)1;
-
-    globalWorksize_bfc_3D[0] = (size_t)height;
-    globalWorksize_bfc_3D[1] = (size_t)1;
-    globalWorksize_bfc_3D[2] = (size_t)maxDis;
+    localWorksize[0] = (size_t)CVF_TILE;
+    localWorksize[1] = (size_t)CVF_TILE;
+    localWorksize[2] = (size_t)1;
 
 	bool createMemoryObjectsSuccess = true;
 
-	Ixx = new cl_mem[6];
 	mean_I = new cl_mem[3]; //r, g, b
-	mean_Ixx = new cl_mem[6]; //rr, rg, rb, gg, gb, bb
 	var_I = new cl_mem[6]; //rr, rg, rb, gg, gb, bb
-	cov_Ip = new cl_mem[3];
-	a = new cl_mem[3];
+	coef = new cl_mem[4]; //a_r, a_g, a_b, b
 	for(int i = 0; i < 6; i++)
 	{
-		Ixx[i] = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_2D, NULL, &errorNumber);
-		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		mean_Ixx[i] = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_2D, NULL, &errorNumber);
-		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		var_I[i] = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_2D, NULL, &errorNumber);
+		var_I[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
 		if(i<3)
 		{
-			mean_I[i] = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_2D, NULL, &errorNumber);
-			createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-			cov_Ip[i] = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
+			mean_I[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 			createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-			a[i] = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
+		}
+		if(i<4)
+		{
+			coef[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_chunk, &errorNumber);
 			createMemoryObjectsSuccess &= checkSuccess(errorNumber);
 		}
 	}
 
-	mean_cv = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-
-	tmp_3DA_r = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-	tmp_3DA_g = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-	tmp_3DA_b = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-	tmp_3DB_r = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-	tmp_3DB_g = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-	tmp_3DB_b = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-
-	bf2Dtmp = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_2D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-	bf3Dtmp = clCreateBuffer(*context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
-	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-
 	if (!createMemoryObjectsSuccess)
 	{
 		std::cerr << "Failed to create OpenCL buffers. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
 	}
     printf("Allocated OpenCL Buffers\n");
+	usable = true;
 }
 
 CVF_cl::~CVF_cl(void)
 {
-	for(int i = 0; i < 6; i++)
+	if(var_I)
 	{
-		clReleaseMemObject(var_I[i]);
-		clReleaseMemObject(mean_Ixx[i]);
-		if(i<3)
+		for(int i = 0; i < 6; i++)
 		{
-			clReleaseMemObject(mean_I[i]);
-			clReleaseMemObject(a[i]);
-			clReleaseMemObject(cov_Ip[i]);
+			OCLRuntime::get()->releaseBuffer(var_I[i]);
+			if(i<3) OCLRuntime::get()->releaseBuffer(mean_I[i]);
+			if(i<4) OCLRuntime::get()->releaseBuffer(coef[i]);
 		}
 	}
-
-	clReleaseMemObject(mean_cv);
-	clReleaseMemObject(tmp_3DA_r);
-	clReleaseMemObject(tmp_3DA_g);
-	clReleaseMemObject(tmp_3DA_b);
-	clReleaseMemObject(tmp_3DB_r);
-	clReleaseMemObject(tmp_3DB_g);
-	clReleaseMemObject(tmp_3DB_b);
-	clReleaseMemObject(bf2Dtmp);
-	clReleaseMemObject(bf3Dtmp);
+	delete[] var_I;
+	delete[] mean_I;
+	delete[] coef;
+
+	if(kernel_guide) clReleaseKernel(kernel_guide);
+	if(kernel_coeffs) clReleaseKernel(kernel_coeffs);
+	if(kernel_output) clReleaseKernel(kernel_output);
+	if(program) clReleaseProgram(program);
+	if(event) clReleaseEvent(event);
 }
 
-int CVF_cl::preprocess(cl_mem* ImgR, cl_mem* ImgG, cl_mem* ImgB)
+int CVF_cl::preprocess(cl_mem* ImgR, cl_mem* ImgG, cl_mem* ImgB, cl_event waitEvent)
 {
-    Ir = ImgR;
-    Ig = ImgG;
-    Ib = ImgB;
-
-    //mean_I
-//	boxfilter(Ir, &mean_I[0], globalWorksize_bf_2D);
-//	boxfilter(Ig, &mean_I[1], globalWorksize_bf_2D);
-//	boxfilter(Ib, &mean_I[2], globalWorksize_bf_2D);
-
-	boxfilter(Ir, &bf2Dtmp, &mean_I[0], globalWorksize_bfc_2D);
-	boxfilter(Ig, &bf2Dtmp, &mean_I[1], globalWorksize_bfc_2D);
-	boxfilter(Ib, &bf2Dtmp, &mean_I[2], globalWorksize_bfc_2D);
-
-	elementwiseMulSD(Ir, Ir, &Ixx[0], globalWorksize_2D);
-	elementwiseMulSD(Ir, Ig, &Ixx[1], globalWorksize_2D);
-	elementwiseMulSD(Ir, Ib, &Ixx[2], globalWorksize_2D);
-	elementwiseMulSD(Ig, Ig, &Ixx[3], globalWorksize_2D);
-	elementwiseMulSD(Ig, Ib, &Ixx[4], globalWorksize_2D);
-	elementwiseMulSD(Ib, Ib, &Ixx[5], globalWorksize_2D);
-
-	for(int i = 0; i < 6; i++)
+	//Start from waitEvent (the producer of the images) if given, else continue the current chain
+	if(waitEvent)
 	{
-//			boxfilter(&Ixx[i], &mean_Ixx[i], globalWorksize_bf_2D);
-			boxfilter(&Ixx[i], &bf2Dtmp, &mean_Ixx[i], globalWorksize_bfc_2D);
+		clRetainEvent(waitEvent);
+		if(event) clReleaseEvent(event);
+		event = waitEvent;
 	}
 
-	preproc_maths(mean_I, mean_Ixx, var_I, globalWorksize_2D);
-
-	return 0;
-}
-
-int CVF_cl::filterCV(cl_mem* cl_costVol)
-{
-//		boxfilter(cl_costVol, &mean_cv, globalWorksize_bf_3D);
-		boxfilter(cl_costVol, &bf3Dtmp, &mean_cv, globalWorksize_bfc_3D);
-
-	elementwiseMulDD(Ir, cl_costVol, &tmp_3DA_r); //Icv_r
-	elementwiseMulDD(Ig, cl_costVol, &tmp_3DA_g); //Icv_g
-	elementwiseMulDD(Ib, cl_costVol, &tmp_3DA_b); //Icv_b
-
-	std::cout << "Here" << std::endl;
-//	boxfilter(&tmp_3DA_r, &tmp_3DB_r, globalWorksize_bf_3D); //mean_Icv_r
-//	boxfilter(&tmp_3DA_g, &tmp_3DB_g, globalWorksize_bf_3D); //mean_Icv_g
-//	boxfilter(&tmp_3DA_b, &tmp_3DB_b, globalWorksize_bf_3D); //mean_Icv_b
-	boxfilter(&tmp_3DA_r, &bf3Dtmp, &tmp_3DB_r, globalWorksize_bfc_3D); //mean_Icv_r
-	std::cout << "Here" << std::endl;
-	boxfilter(&tmp_3DA_g, &bf3Dtmp, &tmp_3DB_g, globalWorksize_bfc_3D); //mean_Icv_g
-	std::cout << "Here" << std::endl;
-	boxfilter(&tmp_3DA_b, &bf3Dtmp, &tmp_3DB_b, globalWorksize_bfc_3D); //mean_Icv_b
-	std::cout << "Here" << std::endl;
-
-	elementwiseMulDD(&mean_I[0], &mean_cv, &tmp_3DA_r); //mean_Ir_cv
-	elementwiseMulDD(&mean_I[1], &mean_cv, &tmp_3DA_g); //mean_Ig_cv
-	elementwiseMulDD(&mean_I[2], &mean_cv, &tmp_3DA_b); //mean_Ib_cv
-
-	sub(&tmp_3DB_r, &tmp_3DA_r, &cov_Ip[0], globalWorksize_3D); //cov_Icv_r = mean_Icv_r - mean_Ir_cv
-	sub(&tmp_3DB_g, &tmp_3DA_g, &cov_Ip[1], globalWorksize_3D); //cov_Icv_g = mean_Icv_g - mean_Ig_cv
-	sub(&tmp_3DB_b, &tmp_3DA_b, &cov_Ip[2], globalWorksize_3D); //cov_Icv_b = mean_Icv_b - mean_Ib_cv
+    Ir = ImgR;
+    Ig = ImgG;
+    Ib = ImgB;
 
-    // variance of I in each local patch: the matrix Sigma in Eqn (14).
+    // mean_I and the variance of I in each local patch: the matrix Sigma in Eqn (14).
     // Note the variance in each local patch is a 3x3 symmetric matrix:
     //           rr, rg, rb
     //   Sigma = rg, gg, gb
     //           rb, gb, bb
-
-	//Calculation of var_I moved to preprocess()
-
-	central_filter(mean_I, &mean_cv, var_I, cov_Ip, a, globalWorksize_3D);
-
-//	boxfilter(&a[0], &tmp_3DA_r, globalWorksize_bf_3D);
-//	boxfilter(&a[1], &tmp_3DA_g, globalWorksize_bf_3D);
-//	boxfilter(&a[2], &tmp_3DA_b, globalWorksize_bf_3D);
-//	boxfilter(&mean_cv, cl_costVol, globalWorksize_bf_3D);
-	boxfilter(&a[0], &bf3Dtmp, &tmp_3DA_r, globalWorksize_bfc_3D);
-	boxfilter(&a[1], &bf3Dtmp, &tmp_3DA_g, globalWorksize_bfc_3D);
-	boxfilter(&a[2], &bf3Dtmp, &tmp_3DA_b, globalWorksize_bfc_3D);
-	boxfilter(&mean_cv, &bf3Dtmp, cl_costVol, globalWorksize_bfc_3D);
-
-	elementwiseMulDD(Ir, &tmp_3DA_r, &tmp_3DA_r);
-	elementwiseMulDD(Ig, &tmp_3DA_g, &tmp_3DA_g);
-	elementwiseMulDD(Ib, &tmp_3DA_b, &tmp_3DA_b);
-	add(&tmp_3DA_r, &tmp_3DA_g, &tmp_3DA_r, globalWorksize_3D);
-	add(&tmp_3DA_r, &tmp_3DA_b, &tmp_3DA_r, globalWorksize_3D);
-	add(&tmp_3DA_r, cl_costVol, cl_costVol, globalWorksize_3D);
-
-    return 0;
-}
-
-int CVF_cl::elementwiseMulDD(cl_mem *cl_in_a, cl_mem *cl_in_b, cl_mem *cl_out)
-{
 	int arg_num = 0;
     /* Setup the kernel arguments. */
     bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmdd, arg_num++, sizeof(cl_mem), cl_in_a));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmdd, arg_num++, sizeof(cl_mem), cl_in_b));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmdd, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmdd, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmdd, arg_num++, sizeof(cl_mem), cl_out));
-    if (!setKernelArgumentsSuccess)
-    {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mmdd, NULL, 0);
-        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-    }
-
-    if(OCL_STATS) printf("CVF_cl: Running MMDD Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_mmdd, 3, NULL, globalWorksize_3D, NULL, 0, NULL, &event)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mmdd, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mmdd, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_mmdd, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
-    return 0;
-}
-
-int CVF_cl::elementwiseMulSD(cl_mem *cl_in_a, cl_mem *cl_in_b, cl_mem *cl_out, size_t *globalworksize)
-{
-	int arg_num = 0;
-    /* Setup the kernel arguments. */
-    bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmsd, arg_num++, sizeof(cl_mem), cl_in_a));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmsd, arg_num++, sizeof(cl_mem), cl_in_b));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmsd, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmsd, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mmsd, arg_num++, sizeof(cl_mem), cl_out));
-    if (!setKernelArgumentsSuccess)
-    {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mmsd, NULL, 0);
-        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-    }
-
-    if(OCL_STATS) printf("CVF_cl: Running MMSD Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_mmsd, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mmsd, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mmsd, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_mmsd, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
-    return 0;
-}
-
-int CVF_cl::elementwiseDivSD(cl_mem *cl_in_a, cl_mem *cl_in_b, cl_mem *cl_out, size_t *globalworksize)
-{
-	int arg_num = 0;
-    /* Setup the kernel arguments. */
-    bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mdsd, arg_num++, sizeof(cl_mem), cl_in_a));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mdsd, arg_num++, sizeof(cl_mem), cl_in_b));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mdsd, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mdsd, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_mdsd, arg_num++, sizeof(cl_mem), cl_out));
-    if (!setKernelArgumentsSuccess)
-    {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mdsd, NULL, 0);
-        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-    }
-
-    if(OCL_STATS) printf("CVF_cl: Running MDSD Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_mdsd, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mdsd, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_mdsd, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_mdsd, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
-    return 0;
-}
-
-int CVF_cl::split(cl_mem *cl_I, cl_mem *cl_Ir, cl_mem *cl_Ig, cl_mem *cl_Ib)
-{
-	int arg_num = 0;
-	/* Setup the kernel arguments. */
-	bool setKernelArgumentsSuccess = true;
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_split, arg_num++, sizeof(cl_mem), cl_I));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_split, arg_num++, sizeof(cl_int), &width));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_split, arg_num++, sizeof(cl_mem), cl_Ir));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_split, arg_num++, sizeof(cl_mem), cl_Ig));
-	setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_split, arg_num++, sizeof(cl_mem), cl_Ib));
-
-	if (!setKernelArgumentsSuccess)
-	{
-	   cleanUpOpenCL(*context, *commandQueue, program, kernel_split, NULL, 0);
-		std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-	}
-
-
-    if(OCL_STATS) printf("CVF_cl: Running Split Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_split, 2, NULL, globalWorksize_split, NULL, 0, NULL, &event)))
-	{
-	   cleanUpOpenCL(*context, *commandQueue, program, kernel_split, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
-	{
-	   cleanUpOpenCL(*context, *commandQueue, program, kernel_split, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_split, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
-    return 0;
-}
-
-int CVF_cl::sub(cl_mem *cl_in_a, cl_mem *cl_in_b, cl_mem *cl_out, size_t *globalworksize)
-{
-	int arg_num = 0;
-    /* Setup the kernel arguments. */
-    bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_sub, arg_num++, sizeof(cl_mem), cl_in_a));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_sub, arg_num++, sizeof(cl_mem), cl_in_b));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_sub, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_sub, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_sub, arg_num++, sizeof(cl_mem), cl_out));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), Ir));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), Ig));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), Ib));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_int), &width));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_int), &height));
+	for(int i = 0; i < 3; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), &mean_I[i]));
+	for(int i = 0; i < 6; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), &var_I[i]));
     if (!setKernelArgumentsSuccess)
     {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_sub, NULL, 0);
         std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
     }
 
-    if(OCL_STATS) printf("CVF_cl: Running Sub Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_sub, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_sub, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_sub, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_sub, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
-    return 0;
+	return enqueueKernel(kernel_guide, 2, globalWorksize_2D, localWorksize, "guide statistics");
 }
 
-int CVF_cl::add(cl_mem *cl_in_a, cl_mem *cl_in_b, cl_mem *cl_out, size_t *globalworksize)
+//The volume is filtered sliceChunk disparities at a time: the coefficients of a chunk are
+//computed from its cost slices, then box filtered and evaluated back over the same slices.
+int CVF_cl::filterCV(cl_mem* cl_costVol, cl_event* doneEvent)
 {
-	int arg_num = 0;
-    /* Setup the kernel arguments. */
-    bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_add, arg_num++, sizeof(cl_mem), cl_in_a));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_add, arg_num++, sizeof(cl_mem), cl_in_b));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_add, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_add, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_add, arg_num++, sizeof(cl_mem), cl_out));
-    if (!setKernelArgumentsSuccess)
-    {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_add, NULL, 0);
-        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-    }
-
-    if(OCL_STATS) printf("CVF_cl: Running Add Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_add, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_add, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_add, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_add, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
-    return 0;
-}
+	const cl_float eps = GIF_EPS;
 
-int CVF_cl::central_filter(cl_mem *mean_I_in, cl_mem *mean_cv_io, cl_mem *var_I_in, cl_mem *cov_Ip_in,  cl_mem *a_out, size_t *globalworksize)
-{
 	int arg_num = 0;
-    /* Setup the kernel arguments. */
+    /* Setup the kernel arguments (all but d0). */
     bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &mean_I_in[0]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &mean_I_in[1]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &mean_I_in[2]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &var_I_in[0]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &var_I_in[1]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &var_I_in[2]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &var_I_in[3]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &var_I_in[4]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &var_I_in[5]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &cov_Ip_in[0]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &cov_Ip_in[1]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &cov_Ip_in[2]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &a_out[0]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &a_out[1]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), &a_out[2]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_centf, arg_num++, sizeof(cl_mem), mean_cv_io));
-    if (!setKernelArgumentsSuccess)
-    {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_centf, NULL, 0);
-        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-    }
-
-    if(OCL_STATS) printf("CVF_cl: Running central filter Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_centf, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_centf, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
-	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_centf, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
-	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_centf, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
-    return 0;
-}
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), cl_costVol));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), Ir));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), Ig));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), Ib));
+	for(int i = 0; i < 3; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &mean_I[i]));
+	for(int i = 0; i < 6; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &var_I[i]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_int), &width));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_int), &height));
+    const int coeffs_d0 = arg_num++;
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_float), &eps));
+	for(int i = 0; i < 4; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &coef[i]));
 
-int CVF_cl::preproc_maths(cl_mem *mean_I_in, cl_mem *mean_Ixx_in, cl_mem *var_I_out, size_t *globalworksize)
-{
-	int arg_num = 0;
-    /* Setup the kernel arguments. */
-    bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_I_in[0]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_I_in[1]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_I_in[2]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_Ixx_in[0]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_Ixx_in[1]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_Ixx_in[2]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_Ixx_in[3]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_Ixx_in[4]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &mean_Ixx_in[5]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &var_I_out[0]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &var_I_out[1]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &var_I_out[2]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &var_I_out[3]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &var_I_out[4]));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_var, arg_num++, sizeof(cl_mem), &var_I_out[5]));
+	arg_num = 0;
+	for(int i = 0; i < 4; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_output, arg_num++, sizeof(cl_mem), &coef[i]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_output, arg_num++, sizeof(cl_mem), Ir));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_output, arg_num++, sizeof(cl_mem), Ig));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_output, arg_num++, sizeof(cl_mem), Ib));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_output, arg_num++, sizeof(cl_int), &width));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_output, arg_num++, sizeof(cl_int), &height));
+    const int output_d0 = arg_num++;
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_output, arg_num++, sizeof(cl_mem), cl_costVol));
     if (!setKernelArgumentsSuccess)
     {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_var, NULL, 0);
         std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
     }
 
-    if(OCL_STATS) printf("CVF_cl: Running variance maths Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_var, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
+	for(cl_int d0 = 0; d0 < maxDis; d0 += sliceChunk)
 	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_var, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
+		size_t globalWorksize_chunk[3] = {globalWorksize_2D[0], globalWorksize_2D[1],
+										  (size_t)std::min(sliceChunk, maxDis - d0)};
+
+		//The kernel arguments are captured at enqueue, so d0 can be updated per chunk
+		clSetKernelArg(kernel_coeffs, coeffs_d0, sizeof(cl_int), &d0);
+		if(enqueueKernel(kernel_coeffs, 3, globalWorksize_chunk, localWorksize, "coefficients"))
+			return 1;
+		clSetKernelArg(kernel_output, output_d0, sizeof(cl_int), &d0);
+		if(enqueueKernel(kernel_output, 3, globalWorksize_chunk, localWorksize, "output"))
+			return 1;
 	}
 
-	/* Wait for completion */
-	if (!checkSuccess(clFinish(*commandQueue)))
+	//Hand the tail of the chain to the consumer of the filtered volume
+	if(doneEvent)
 	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_var, NULL, 0);
-		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
+		clRetainEvent(event);
+		*doneEvent = event;
 	}
-
-	if(OCL_STATS) printProfilingInfo(event);
-    /* Release the event object. */
-    if (!checkSuccess(clReleaseEvent(event)))
-    {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel_var, NULL, 0);
-        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
-
     return 0;
 }
 
-//int CVF_cl::boxfilter(cl_mem *cl_in, cl_mem *cl_out, size_t *globalworksize)
-//{
-//	int arg_num = 0;
-//    /* Setup the kernel arguments. */
-//    bool setKernelArgumentsSuccess = true;
-//    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bf, arg_num++, sizeof(cl_mem), cl_in));
-//    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bf, arg_num++, sizeof(cl_int), &width));
-//    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bf, arg_num++, sizeof(cl_int), &height));
-//    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bf, arg_num++, sizeof(cl_mem), cl_out));
-//    if (!setKernelArgumentsSuccess)
-//    {
-//		cleanUpOpenCL(*context, *commandQueue, program, kernel_bf, NULL, 0);
-//        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-//    }
-//
-//    if(OCL_STATS) printf("CVF_cl: Running boxfilter Kernels\n");
-//	/* Enqueue the kernel */
-//	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_bf, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
-//	{
-//		cleanUpOpenCL(*context, *commandQueue, program, kernel_bf, NULL, 0);
-//		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-//		return 1;
-//	}
-//
-//	/* Wait for completion */
-//	if (!checkSuccess(clFinish(*commandQueue)))
-//	{
-//		cleanUpOpenCL(*context, *commandQueue, program, kernel_bf, NULL, 0);
-//		std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-//		return 1;
-//	}
-//
-//	if(OCL_STATS) printProfilingInfo(event);
-//    /* Release the event object. */
-//    if (!checkSuccess(clReleaseEvent(event)))
-//    {
-//        cleanUpOpenCL(*context, *commandQueue, program, kernel_bf, NULL, 0);
-//        std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
-//        return 1;
-//    }
-//
-//    return 0;
-//}
-
-int CVF_cl::boxfilter(cl_mem *cl_in, cl_mem *cl_tmp, cl_mem *cl_out, size_t *globalworksize)
+//Kernels are chained through events rather than waiting on the queue after each one:
+//every enqueue waits on the previous command of the chain and becomes its new tail.
+//The host only blocks where results are read back (DispSel_cl::CVSelect).
+int CVF_cl::enqueueKernel(cl_kernel kernel, cl_uint workDim, const size_t *globalworksize, const size_t *localworksize, const char *name)
 {
-	int iRadius = 4;
-	float fScale = 1.0f/(2.0f * iRadius + 1.0f);
-
-	int arg_num = 0;
-    /* Setup the kernel arguments. */
-    bool setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_rows, arg_num++, sizeof(cl_mem), cl_in));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_rows, arg_num++, sizeof(cl_mem), cl_tmp));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_rows, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_rows, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_rows, arg_num++, sizeof(cl_int), &iRadius));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_rows, arg_num++, sizeof(cl_float), &fScale));
-    if (!setKernelArgumentsSuccess)
-    {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_bfc_rows, NULL, 0);
-        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-    }
-
-	arg_num = 0;
-    /* Setup the kernel arguments. */
-    setKernelArgumentsSuccess = true;
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_cols, arg_num++, sizeof(cl_mem), cl_tmp));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_cols, arg_num++, sizeof(cl_mem), cl_out));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_cols, arg_num++, sizeof(cl_int), &width));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_cols, arg_num++, sizeof(cl_int), &height));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_cols, arg_num++, sizeof(cl_int), &iRadius));
-    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_bfc_cols, arg_num++, sizeof(cl_float), &fScale));
-    if (!setKernelArgumentsSuccess)
-    {
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_bfc_rows, NULL, 0);
-        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
-    }
-
-    if(OCL_STATS) printf("CVF_cl: Running boxfilter row Kernels\n");
+    if(OCL_STATS) printf("CVF_cl: Running %s Kernels\n", name);
+	cl_event next;
 	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_bfc_rows, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
+	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel, workDim, NULL, globalworksize, localworksize,
+												event ? 1 : 0, event ? &event : NULL, &next)))
 	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_bfc_rows, NULL, 0);
 		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
 		return 1;
 	}
+	if(event) clReleaseEvent(event);
+	event = next;
 
-	globalworksize[0] = (size_t)width;
-
-    if(OCL_STATS) printf("CVF_cl: Running boxfilter col Kernels\n");
-	/* Enqueue the kernel */
-	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel_bfc_cols, 3, NULL, globalworksize, NULL, 0, NULL, &event)))
+	if(OCL_STATS)
 	{
-		cleanUpOpenCL(*context, *commandQueue, program, kernel_bfc_cols, NULL, 0);
-		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		return 1;
+		clWaitForEvents(1, &event);
+		printProfilingInfo(event);
 	}
     return 0;
 }
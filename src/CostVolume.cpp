@@ -0,0 +1,63 @@
+/*---------------------------------------------------------------------------
+   CostVolume.cpp - Aligned Cost Volume Container
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+  ---------------------------------------------------------------------------*/
+#include "CostVolume.h"
+#include "oclUtil.h"
+
+//Round a number of elements up to a whole number of COSTVOL_ALIGN blocks
+template<typename T>
+static size_t alignElements(size_t n)
+{
+	const size_t block = COSTVOL_ALIGN / sizeof(T);
+	return (n + block - 1) / block * block;
+}
+
+template<typename T>
+CostVolume_<T>::CostVolume_(int h, int w, int d) :
+	hei(h), wid(w), maxDis(d), buf(NULL), slices(NULL)
+{
+	rowStep = alignElements<T>(wid);
+	dStep = rowStep * hei;
+	allocSize = dStep * maxDis * sizeof(T);
+
+	if(posix_memalign((void**)&buf, COSTVOL_ALIGN, allocSize))
+	{
+		printf("CostVolume: Error - failed to allocate %lu bytes\n", (unsigned long)allocSize);
+		exit(1);
+	}
+	memset(buf, 0, allocSize);
+
+	slices = new cv::Mat[maxDis];
+	for(int i = 0; i < maxDis; ++i)
+		slices[i] = cv::Mat(hei, wid, cv::DataType<T>::type, buf + i*dStep, rowStep * sizeof(T));
+}
+
+template<typename T>
+CostVolume_<T>::~CostVolume_(void)
+{
+	delete [] slices;
+	free(buf);
+}
+
+template<typename T>
+int CostVolume_<T>::download(cl_command_queue queue, cl_mem clVol)
+{
+	size_t origin[3] = {0, 0, 0};
+	size_t region[3] = {wid * sizeof(T), (size_t)hei, (size_t)maxDis};
+
+	if (!checkSuccess(clEnqueueReadBufferRect(queue, clVol, CL_TRUE, origin, origin, region,
+						wid * sizeof(T), wid * hei * sizeof(T),
+						rowStep * sizeof(T), dStep * sizeof(T), buf, 0, NULL, NULL)))
+	{
+		std::cerr << "Failed to download the cost volume. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+template class CostVolume_<float>;
+template class CostVolume_<uint16_t>;
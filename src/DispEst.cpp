@@ -6,9 +6,12 @@
    Copyright (c) 2016 Charlie Leech, University of Southampton.
   ---------------------------------------------------------------------------*/
 #include "DispEst.h"
+#include <opencv2/imgcodecs.hpp>
+
+using namespace cv;
 
 DispEst::DispEst(cv::Mat l, cv::Mat r, const int d, int t, bool ocl)
-    : lImg(l), rImg(r), maxDis(d), threads(t), useOCL(ocl)
+    : lImg(l), rImg(r), maxDis(d), threads(t), useOCL(ocl), streaming(false), stripe_rows(0), doubleBuffer(false), secondCost(false), times()
 {
 #ifdef DEBUG_APP
     std::cout << "Disparity Estimation for Depth Analysis in Stereo Vision Applications." << std::endl;
@@ -16,6 +19,7 @@ DispEst::DispEst(cv::Mat l, cv::Mat r, const int d, int t, bool ocl)
 
     hei = lImg.rows;
     wid = lImg.cols;
+    de_mode = useOCL ? OCL_DE : OCV_DE;
 
     //Global Image Type Checking
 	if(lImg.type() == rImg.type())
@@ -28,13 +32,18 @@ DispEst::DispEst(cv::Mat l, cv::Mat r, const int d, int t, bool ocl)
 		exit(1);
 	}
 
-    lcostVol = new cv::Mat[maxDis];
-    rcostVol = new cv::Mat[maxDis];
-    for (int i = 0; i < maxDis; ++i)
-    {
-		lcostVol[i] = cv::Mat::zeros(hei, wid, CV_32FC1);
-		rcostVol[i] = cv::Mat::zeros(hei, wid, CV_32FC1);
-    }
+    //Cost volumes are allocated on first use (not needed in streaming mode)
+    lcostVol = NULL;
+    rcostVol = NULL;
+    lcostVolSub = NULL;
+    rcostVolSub = NULL;
+    //Guided filters are built on the first frame and updated in place afterwards
+    lfgf = NULL;
+    rfgf = NULL;
+    fgf_rate = 0;
+    stripeBufs = NULL;
+    nStripeBufs = 0;
+    stripe_rate = 0;
 
 //    lImg_rgb = new Mat[3];
 //    rImg_rgb = new Mat[3];
@@ -48,36 +57,44 @@ DispEst::DispEst(cv::Mat l, cv::Mat r, const int d, int t, bool ocl)
 	lValid = cv::Mat::zeros(hei, wid, CV_8UC1);
 	rValid = cv::Mat::zeros(hei, wid, CV_8UC1);
 
-	printf("Setting up pthreads function constructors\n");
+	printf("Setting up pthreads worker pool and function constructors\n");
+    pool = new ThreadPool(threads);
     constructor = new CVC();
+    printf("Using %s cost construction kernels\n", cvcKernels().name);
+    printf("Using %s disparity selection kernels\n", wtaKernels().name);
     filter = new CVF();
     selector = new DispSel();
     postProcessor = new PP();
 
+    //The context, queues, programs & buffers come from the process-wide runtime, so a new
+    //DispEst for new inputs reuses them instead of setting OpenCL up again
+    if(useOCL && OCLRuntime::get() == NULL)
+    {
+		std::cerr << "Failed to set up OpenCL, using the CPU only. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		useOCL = false;
+		de_mode = OCV_DE;
+    }
+
     if(useOCL)
     {
 		printf("Setting up OpenCL Environment\n");
 		//OpenCL Setup
-		context = 0;
-		commandQueue = 0;
-		device = 0;
+		OCLRuntime* runtime = OCLRuntime::get();
+		context = runtime->context;
+		commandQueue = runtime->commandQueue;
+		uploadQueue = runtime->uploadQueue;
+		readQueue = runtime->readQueue;
+		device = runtime->device;
+		cvcEvent = 0;
+		cvfEvent = 0;
+		dsEvent = 0;
+		dbSlot = 0;
+		dbPending = -1;
+		dbPrimed = false;
 		numberOfMemoryObjects = 12;
 		for(int m = 0; m < (int)numberOfMemoryObjects; m++)
 			memoryObjects[m] = 0;
 
-		//cl_int numComputeUnits = 2;
-		if (!createContext(&context))
-		//if (!createSubDeviceContext(&context, numComputeUnits)) //Device Fission is not supported on Xeon Phi
-		{
-			cleanUpOpenCL(context, commandQueue, NULL, NULL, memoryObjects, numberOfMemoryObjects);
-			std::cerr << "Failed to create an OpenCL context. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		}
-		if (!createCommandQueue(context, &commandQueue, &device))
-		{
-			cleanUpOpenCL(context, commandQueue, NULL, NULL, memoryObjects, numberOfMemoryObjects);
-			std::cerr << "Failed to create the OpenCL command queue. " << __FILE__ << ":"<< __LINE__ << std::endl;
-		}
-
 		width = (cl_int)wid;
 		height = (cl_int)hei;
 		channels = (cl_int)lImg.channels();
@@ -96,39 +113,39 @@ DispEst::DispEst(cv::Mat l, cv::Mat r, const int d, int t, bool ocl)
 		//OpenCL Buffers that are always required
 		bufferSize_2D_8UC1 = width * height * sizeof(cl_uchar);
 
-		/* Create buffers for the left and right images, gradient data, cost volume, and disparity maps. */
+		/* Create buffers for the left and right images, gradient data, cost volume, and disparity maps.
+		 * The image planes & gradients are filled on the device by CVC_cl, so they are not host mapped. */
 		bool createMemoryObjectsSuccess = true;
-		memoryObjects[CVC_LIMGR] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_LIMGR] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		memoryObjects[CVC_LIMGG] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_LIMGG] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		memoryObjects[CVC_LIMGB] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_LIMGB] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
 
-		memoryObjects[CVC_RIMGR] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_RIMGR] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		memoryObjects[CVC_RIMGG] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_RIMGG] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		memoryObjects[CVC_RIMGB] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_RIMGB] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
 
-		memoryObjects[CVC_LGRDX] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_LGRDX] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		memoryObjects[CVC_RGRDX] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D, NULL, &errorNumber);
+		memoryObjects[CVC_RGRDX] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
 
-		memoryObjects[CV_LCV] = clCreateBuffer(context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
+		memoryObjects[CV_LCV] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_3D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		memoryObjects[CV_RCV] = clCreateBuffer(context, CL_MEM_READ_WRITE, bufferSize_3D, NULL, &errorNumber);
+		memoryObjects[CV_RCV] = runtime->createBuffer(CL_MEM_READ_WRITE, bufferSize_3D, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
 
-		memoryObjects[DS_LDM] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D_8UC1, NULL, &errorNumber);
+		memoryObjects[DS_LDM] = runtime->createBuffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D_8UC1, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
-		memoryObjects[DS_RDM] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D_8UC1, NULL, &errorNumber);
+		memoryObjects[DS_RDM] = runtime->createBuffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D_8UC1, &errorNumber);
 		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
 		if (!createMemoryObjectsSuccess)
 		{
-			cleanUpOpenCL(context, commandQueue, NULL, NULL, memoryObjects, numberOfMemoryObjects);
 			std::cerr << "Failed to create OpenCL buffers. " << __FILE__ << ":"<< __LINE__ << std::endl;
 		}
 
@@ -136,7 +153,18 @@ DispEst::DispEst(cv::Mat l, cv::Mat r, const int d, int t, bool ocl)
 		//OpenCL function constructors
 		constructor_cl  = new CVC_cl(&context, &commandQueue, device, &lImg, maxDis);
 		filter_cl       = new CVF_cl(&context, &commandQueue, device, &lImg, maxDis);
+		fgf_cl          = new FGF_cl(&context, &commandQueue, device, &lImg, maxDis, subsample_rate);
 		selector_cl = new DispSel_cl(&context, &commandQueue, device, &lImg, maxDis);
+		postProcessor_cl = new PP_cl(&context, &commandQueue, device, &lImg, maxDis);
+
+		//FGF_cl & PP_cl fall back to CVF_cl & the CPU, but without CVF_cl there is no OpenCL filter
+		if(!filter_cl->isUsable())
+		{
+			std::cerr << "The OpenCL cost volume filter cannot run on this device, using the CPU only. " << __FILE__ << ":"<< __LINE__ << std::endl;
+			releaseOCL();
+			useOCL = false;
+			de_mode = OCV_DE;
+		}
     }
 
 	printf("Construction Complete\n");
@@ -144,21 +172,37 @@ DispEst::DispEst(cv::Mat l, cv::Mat r, const int d, int t, bool ocl)
 
 DispEst::~DispEst(void)
 {
-    delete [] lcostVol;
-    delete [] rcostVol;
+    releaseCostVolumes();
+    releaseSubCostVolumes();
+    releaseStripes();
+    delete lfgf;
+    delete rfgf;
     delete constructor;
     delete filter;
     delete selector;
     delete postProcessor;
+    delete pool;
 
-    if(useOCL){
-		delete constructor_cl;
-		delete filter_cl;
-		delete selector_cl;
+    if(useOCL)
+		releaseOCL();
+}
 
-		for(int m = 0; m < (int)numberOfMemoryObjects; ++m)
-			clReleaseMemObject(memoryObjects[m]);
-    }
+void DispEst::releaseOCL(void)
+{
+	drainPipeline();
+	clFinish(commandQueue);
+	if(cvcEvent) clReleaseEvent(cvcEvent);
+	if(cvfEvent) clReleaseEvent(cvfEvent);
+	if(dsEvent) clReleaseEvent(dsEvent);
+	delete constructor_cl;
+	delete filter_cl;
+	delete fgf_cl;
+	delete selector_cl;
+	delete postProcessor_cl;
+
+	//Back to the pool for the next DispEst
+	for(int m = 0; m < (int)numberOfMemoryObjects; ++m)
+		OCLRuntime::get()->releaseBuffer(memoryObjects[m]);
 }
 
 int DispEst::setInputImages(cv::Mat leftImg, cv::Mat rightImg)
@@ -171,138 +215,541 @@ int DispEst::setInputImages(cv::Mat leftImg, cv::Mat rightImg)
 
 int DispEst::setThreads(unsigned int newThreads)
 {
-	if(newThreads > MAX_CPU_THREADS)
+	if(newThreads > MAX_CPU_THREADS || newThreads < MIN_CPU_THREADS)
 		return -1;
 
+	if(newThreads != threads)
+	{
+		delete pool;
+		pool = new ThreadPool(newThreads);
+	}
 	threads = newThreads;
 	return 0;
 }
 
+int DispEst::setMode(int newMode)
+{
+	if(newMode == OCL_DE && !useOCL)
+		return -1;
+
+	//The frame in flight has to land before the maps are produced another way
+	if(de_mode == OCL_DE && newMode != OCL_DE && useOCL && drainPipeline())
+		return -1;
+	de_mode = newMode;
+	return 0;
+}
+
+int DispEst::setStreamingMode(bool enable)
+{
+	streaming = enable;
+	if(streaming)
+	{
+		releaseCostVolumes();
+		releaseSubCostVolumes();
+	}
+	return 0;
+}
+
+int DispEst::setStripeRows(int rows)
+{
+	if(rows < 0)
+		return -1;
+
+	stripe_rows = rows;
+	if(stripe_rows)
+	{
+		releaseCostVolumes();
+		releaseSubCostVolumes();
+	}
+	else
+		releaseStripes();
+	return 0;
+}
+
+int DispEst::setSelectivePP(bool enable)
+{
+	postProcessor->setSelective(enable);
+	if(useOCL)
+		postProcessor_cl->setSelective(enable);
+	return 0;
+}
+
+int DispEst::setSecondCost(bool enable)
+{
+	secondCost = enable;
+	if(!secondCost)
+	{
+		lSecondCost.release();
+		rSecondCost.release();
+	}
+	return 0;
+}
+
+int DispEst::setDoubleBuffering(bool enable)
+{
+	//The frames in flight are read back through the PP_cl slots
+	if(!useOCL || (enable && !postProcessor_cl->isUsable()))
+		return -1;
+	if(enable == doubleBuffer)
+		return 0;
+	if(!enable && drainPipeline())
+		return -1;
+
+	if(enable)
+	{
+		for(int i = 0; i < PP_SLOTS; i++)
+		{
+			lSlotDisMap[i].create(hei, wid, CV_8UC1);
+			rSlotDisMap[i].create(hei, wid, CV_8UC1);
+		}
+	}
+	constructor_cl->setUploadQueue(enable ? &uploadQueue : &commandQueue);
+	dbSlot = 0;
+	doubleBuffer = enable;
+	return 0;
+}
+
+int DispEst::allocCostVolumes(void)
+{
+	if(lcostVol == NULL)
+		lcostVol = new CostVolume(hei, wid, maxDis);
+	if(rcostVol == NULL)
+		rcostVol = new CostVolume(hei, wid, maxDis);
+	return 0;
+}
+
+int DispEst::allocSubCostVolumes(void)
+{
+	int subHei = hei / subsample_rate;
+	int subWid = wid / subsample_rate;
+
+	if(lcostVolSub != NULL && (lcostVolSub->hei != subHei || lcostVolSub->wid != subWid))
+		releaseSubCostVolumes();
+	if(lcostVolSub == NULL)
+		lcostVolSub = new CostVolume(subHei, subWid, maxDis);
+	if(rcostVolSub == NULL)
+		rcostVolSub = new CostVolume(subHei, subWid, maxDis);
+	return 0;
+}
+
+void DispEst::releaseSubCostVolumes(void)
+{
+	delete lcostVolSub;
+	delete rcostVolSub;
+	lcostVolSub = NULL;
+	rcostVolSub = NULL;
+}
+
+void DispEst::releaseCostVolumes(void)
+{
+	delete lcostVol;
+	delete rcostVol;
+	lcostVol = NULL;
+	rcostVol = NULL;
+}
+
+//Point the guided filters at the current frames, rebuilding them only if the subsample rate changed
+int DispEst::updateFilters(void)
+{
+	if(lfgf == NULL || rfgf == NULL || fgf_rate != subsample_rate)
+	{
+		delete lfgf;
+		delete rfgf;
+		lfgf = new FastGuidedFilter(lImg, GIF_R_WIN, GIF_EPS, subsample_rate);
+		rfgf = new FastGuidedFilter(rImg, GIF_R_WIN, GIF_EPS, subsample_rate);
+		fgf_rate = subsample_rate;
+	}
+	else
+	{
+		lfgf->setGuide(lImg);
+		rfgf->setGuide(rImg);
+	}
+	return 0;
+}
+
+void DispEst::releaseStripes(void)
+{
+	for(int i = 0; i < nStripeBufs; ++i)
+	{
+		delete stripeBufs[i].lfgf;
+		delete stripeBufs[i].rfgf;
+	}
+	delete [] stripeBufs;
+	stripeBufs = NULL;
+	nStripeBufs = 0;
+}
+
 int DispEst::printCV(void)
 {
 	char filename[20];
 	int ret_val = 0;
 
+	//Fetch the device volumes when the OpenCL path produced them
+	if(de_mode == OCL_DE)
+	{
+		allocCostVolumes();
+		if(ret_val = lcostVol->download(commandQueue, memoryObjects[CV_LCV])) return ret_val;
+		if(ret_val = rcostVol->download(commandQueue, memoryObjects[CV_RCV])) return ret_val;
+	}
+	else if(lcostVol == NULL || rcostVol == NULL)
+	{
+		printf("DE: Error - No cost volumes to print (streaming mode or not yet computed).\n");
+		return -1;
+	}
+
 	for (int i = 0; i < maxDis; ++i)
 	{
-		if(ret_val = sprintf(filename, "CV/lCV%d.png", i)) return ret_val;
-		imwrite(filename, lcostVol[i]*1024*8);
-		if(ret_val = sprintf(filename, "CV/rCV%d.png", i)) return ret_val;
-		imwrite(filename, rcostVol[i]*1024*8);
+		if(sprintf(filename, "CV/lCV%d.png", i) < 0) return -1;
+		imwrite(filename, (*lcostVol)[i]*1024*8);
+		if(sprintf(filename, "CV/rCV%d.png", i) < 0) return -1;
+		imwrite(filename, (*rcostVol)[i]*1024*8);
 	}
 	return 0;
 }
 
 //#############################################################################################################
-//# Cost Volume Construction
+//# Complete Disparity Estimation pipeline
 //#############################################################################################################
-int DispEst::CostConst()
+int DispEst::compute(void)
 {
 	int ret_val = 0;
+	double start_time;
 
-	if(ret_val = constructor->preprocess(lImg, lGrdX))
-		return ret_val;
-	if(ret_val = constructor->preprocess(rImg, rGrdX))
-		return ret_val;
-
-    // Build Cost Volume
-	#pragma omp parallel for
-    for( int d = 0; d < maxDis; ++d)
-    {
-        constructor->buildCV_left(lImg, rImg, lGrdX, rGrdX, d, lcostVol[d]);
-    }
-	#pragma omp parallel for
-    for( int d = 0; d < maxDis; ++d)
-    {
-        constructor->buildCV_right(rImg, lImg, rGrdX, lGrdX, d, rcostVol[d]);
-    }
-    return 0;
-}
+	//Only the CPU cost volume pipeline selects from a volume, so only it has second-best costs
+	if(de_mode == OCL_DE || streaming || stripe_rows)
+	{
+		lSecondCost.release();
+		rSecondCost.release();
+	}
 
-int DispEst::CostConst_CPU()
-{
-    //Set up threads and thread attributes
-    void *status;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-    pthread_t BCV_threads[maxDis];
-    buildCV_TD buildCV_TD_Array[maxDis];
+	if(de_mode == OCL_DE && doubleBuffer)
+	{
+		//Every stage only enqueues work, pp covers the wait for the previous frame
+		if(ret_val = Pipeline_GPU()) return ret_val;
+	}
+	else if(de_mode == OCL_DE)
+	{
+		//CVC, CVF & selection only enqueue work, the device time up to the readback is accounted to pp
+		start_time = get_rt();
+		if(ret_val = CostConst_GPU()) return ret_val;
+		times.cvc = get_rt() - start_time;
+
+		start_time = get_rt();
+		if(ret_val = CostFilter_GPU()) return ret_val;
+		times.cvf = get_rt() - start_time;
+
+		start_time = get_rt();
+		if(ret_val = DispSelect_GPU()) return ret_val;
+		times.dispsel = get_rt() - start_time;
+
+		start_time = get_rt();
+		if(ret_val = PostProcess_GPU()) return ret_val;
+		times.pp = get_rt() - start_time;
+		times.pp_skip = postProcessor_cl->isUsable() ? postProcessor_cl->getSkipRate() : postProcessor->getSkipRate();
+	}
+	else if(streaming || stripe_rows)
+	{
+		times.cvc = 0;
+		times.dispsel = 0;
 
-	constructor->preprocess(lImg, lGrdX);
-	constructor->preprocess(rImg, rGrdX);
+		start_time = get_rt();
+		if(stripe_rows)
+		{
+			if(ret_val = CostFilterSelect_Stripes()) return ret_val;
+		}
+		else if(ret_val = CostFilterSelect_FGF()) return ret_val;
+		times.cvf = get_rt() - start_time;
 
-    for(int level = 0; level <= maxDis/threads; ++level)
+		start_time = get_rt();
+		if(ret_val = PostProcess_CPU()) return ret_val;
+		times.pp = get_rt() - start_time;
+		times.pp_skip = postProcessor->getSkipRate();
+	}
+	else
 	{
-	    //Handle remainder if threads is not power of 2.
-	    int block_size = (level < maxDis/threads) ? threads : (maxDis%threads);
-
-	    for(int iter=0; iter < block_size; ++iter)
-	    {
-	        int d = level*threads + iter;
-            buildCV_TD_Array[d] = {&lImg, &rImg, &lGrdX, &rGrdX, d, &lcostVol[d]};
-            pthread_create(&BCV_threads[d], &attr, CVC::buildCV_left_thread, (void *)&buildCV_TD_Array[d]);
-	    }
-        for(int iter=0; iter < block_size; ++iter)
-	    {
-	        int d = level*threads + iter;
-            pthread_join(BCV_threads[d], &status);
-        }
+		start_time = get_rt();
+		if(ret_val = CostConst_CPU()) return ret_val;
+		times.cvc = get_rt() - start_time;
+
+		start_time = get_rt();
+		if(ret_val = CostFilter_FGF()) return ret_val;
+		times.cvf = get_rt() - start_time;
+
+		start_time = get_rt();
+		if(ret_val = DispSelect_CPU()) return ret_val;
+		times.dispsel = get_rt() - start_time;
+
+		start_time = get_rt();
+		if(ret_val = PostProcess_CPU()) return ret_val;
+		times.pp = get_rt() - start_time;
+		times.pp_skip = postProcessor->getSkipRate();
 	}
-	for(int level = 0; level <= maxDis/threads; ++level)
+	return 0;
+}
+
+//#############################################################################################################
+//# Cost Volume Construction
+//#############################################################################################################
+int DispEst::CostConst_CPU()
+{
+	allocSubCostVolumes();
+	constructor->preprocess(lImg, lGrdX, lPlanes);
+	constructor->preprocess(rImg, rGrdX, rPlanes);
+	constructor->setupSubGrid(lPlanes, rPlanes, subsample_rate, subGrid);
+
+	//Bands of subsampled rows across all disparities of both volumes, ~4 tasks per worker
+	int subHei = lcostVolSub->hei;
+	int nBands = 4 * (int)pool->size();
+	int band_size = (subHei + nBands - 1) / nBands;
+	nBands = (subHei + band_size - 1) / band_size;
+	buildCV_band_TD TD_Array[nBands];
+	if((int)cvcGather.size() < nBands)
+		cvcGather.resize(nBands);
+
+	for(int b = 0; b < nBands; ++b)
 	{
-        //Handle remainder if threads is not power of 2.
-	    int block_size = (level < maxDis/threads) ? threads : (maxDis%threads);
-
-	    for(int iter=0; iter < block_size; ++iter)
-	    {
-	        int d = level*threads + iter;
-            buildCV_TD_Array[d] = {&rImg, &lImg, &rGrdX, &lGrdX, d, &rcostVol[d]};
-            pthread_create(&BCV_threads[d], &attr, CVC::buildCV_right_thread, (void *)&buildCV_TD_Array[d]);
-	    }
-        for(int iter=0; iter < block_size; ++iter)
-	    {
-	        int d = level*threads + iter;
-            pthread_join(BCV_threads[d], &status);
-        }
+		int yStart = b * band_size;
+		int yEnd = std::min(yStart + band_size, subHei);
+		TD_Array[b] = {constructor, &subGrid, lPlanes, rPlanes, yStart, yEnd, 0, maxDis, lcostVolSub, rcostVolSub, &cvcGather[b]};
+		pool->submit(CVC::buildCV_band_thread, (void *)&TD_Array[b]);
 	}
+	pool->wait();
 	return 0;
 }
 
 int DispEst::CostConst_GPU()
 {
-	constructor_cl->buildCV(lImg, rImg, memoryObjects);
+	if(cvcEvent) clReleaseEvent(cvcEvent);
+	cvcEvent = 0;
+	if(constructor_cl->buildCV(lImg, rImg, memoryObjects, &cvcEvent)) return -1;
 	return 0;
 }
 
 //#############################################################################################################
 //# Cost Volume Filtering
 //#############################################################################################################
+void *DispEst::CostFilter_FGF_thread(void *thread_arg)
+{
+	struct FGF_TD *t_data;
+	t_data = (struct FGF_TD *) thread_arg;
+
+	for(int d = t_data->dStart; d < t_data->dEnd; ++d)
+		t_data->fgf->filterSubsampled((*t_data->srcVol)[d], (*t_data->costVol)[d], *t_data->ws);
+	return (void*)0;
+}
+
 int DispEst::CostFilter_FGF()
 {
-    FastGuidedFilter fgf_left(lImg, GIF_R_WIN, GIF_EPS, subsample_rate);
-    FastGuidedFilter fgf_right(rImg, GIF_R_WIN, GIF_EPS, subsample_rate);
+	if(lcostVolSub == NULL || rcostVolSub == NULL)
+		return -1;
 
-	#pragma omp parallel for
-    for(int d = 0; d < maxDis; ++d){
-        lcostVol[d] = fgf_left.filter(lcostVol[d]);
-    }
+	allocCostVolumes();
+	updateFilters();
 
-	#pragma omp parallel for
-    for(int d = 0; d < maxDis; ++d){
-        rcostVol[d] = fgf_right.filter(rcostVol[d]);
-    }
+	//One contiguous block of disparities per worker and volume
+	int nBlocks = std::min((int)pool->size(), MAX_CPU_THREADS);
+	int block_size = (maxDis + nBlocks - 1) / nBlocks;
+    FGF_TD lTD_Array[nBlocks];
+    FGF_TD rTD_Array[nBlocks];
+
+	for(int b = 0; b < nBlocks; ++b)
+	{
+		int dStart = std::min(b * block_size, maxDis);
+		int dEnd = std::min(dStart + block_size, maxDis);
+		lTD_Array[b] = {lfgf, &fgfWS[2*b], lcostVolSub, lcostVol, dStart, dEnd};
+		pool->submit(CostFilter_FGF_thread, (void *)&lTD_Array[b]);
+		rTD_Array[b] = {rfgf, &fgfWS[2*b+1], rcostVolSub, rcostVol, dStart, dEnd};
+		pool->submit(CostFilter_FGF_thread, (void *)&rTD_Array[b]);
+	}
+	pool->wait();
 	return 0;
 }
 
-//TODO: Port FGF code to GPU
+void *DispEst::CostFilterSelect_thread(void *thread_arg)
+{
+	struct FS_TD *t_data;
+	t_data = (struct FS_TD *) thread_arg;
+
+	*t_data->lminCost = Scalar(FLT_MAX);
+	*t_data->lminDis = Scalar(0);
+	*t_data->rminCost = Scalar(FLT_MAX);
+	*t_data->rminDis = Scalar(0);
+	for(int d = t_data->dStart; d < t_data->dEnd; ++d)
+	{
+		t_data->constructor->buildCV_sub(*t_data->grid, t_data->lPlanes, t_data->rPlanes, d, *t_data->lsub, *t_data->rsub, *t_data->gather);
+
+		//Upsampling, evaluation and selection are fused, the filtered slice is never stored
+		t_data->lfgf->filterSubsampledFold(*t_data->lsub, d, *t_data->lminCost, *t_data->lminDis, *t_data->lws);
+		t_data->rfgf->filterSubsampledFold(*t_data->rsub, d, *t_data->rminCost, *t_data->rminDis, *t_data->rws);
+	}
+	return (void*)0;
+}
+
+//Build, filter and select one slice at a time so only a few slices per worker are resident
+int DispEst::CostFilterSelect_FGF()
+{
+	constructor->preprocess(lImg, lGrdX, lPlanes);
+	constructor->preprocess(rImg, rGrdX, rPlanes);
+	constructor->setupSubGrid(lPlanes, rPlanes, subsample_rate, subGrid);
+
+	updateFilters();
+
+	//Disparity 0 is never selected (as in CVSelect), split [1, maxDis) into blocks
+	int nBlocks = std::min((int)pool->size(), MAX_CPU_THREADS);
+	int block_size = (maxDis - 1 + nBlocks - 1) / nBlocks;
+	FS_TD TD_Array[nBlocks];
+	if((int)cvcGather.size() < nBlocks)
+		cvcGather.resize(nBlocks);
+
+	for(int b = 0; b < nBlocks; ++b)
+	{
+		int dStart = std::min(1 + b * block_size, maxDis);
+		int dEnd = std::min(dStart + block_size, maxDis);
+		for(int i = 2*b; i < 2*b + 2; ++i)
+		{
+			fsSub[i].create(subGrid.lSub[0].rows, subGrid.lSub[0].cols, CV_32FC1);
+			fsCost[i].create(hei, wid, CV_32FC1);
+			fsDis[i].create(hei, wid, CV_8UC1);
+		}
+		//Even entries hold the left view, odd entries the right view
+		TD_Array[b] = {constructor, lfgf, rfgf, &fgfWS[2*b], &fgfWS[2*b+1], lPlanes, rPlanes, &subGrid, dStart, dEnd,
+						&fsSub[2*b], &fsSub[2*b+1], &fsCost[2*b], &fsDis[2*b], &fsCost[2*b+1], &fsDis[2*b+1], &cvcGather[b]};
+		pool->submit(CostFilterSelect_thread, (void *)&TD_Array[b]);
+	}
+	pool->wait();
+
+	//Reduce the blocks in disparity order into the first block of each view
+	for(int b = 1; b < nBlocks; ++b)
+	{
+		selector->CVMerge(fsCost[2*b], fsDis[2*b], fsCost[0], fsDis[0]);
+		selector->CVMerge(fsCost[2*b+1], fsDis[2*b+1], fsCost[1], fsDis[1]);
+	}
+	fsDis[0].copyTo(lDisMap);
+	fsDis[1].copyTo(rDisMap);
+	return 0;
+}
+
+void *DispEst::CostFilterSelect_stripe_thread(void *thread_arg)
+{
+	struct Stripe_TD *t_data;
+	t_data = (struct Stripe_TD *) thread_arg;
+
+	int yA = std::max(t_data->yStart - t_data->halo, 0);
+	int yB = std::min(t_data->yEnd + t_data->halo, t_data->lImg->rows);
+	int wid = t_data->lImg->cols;
+	int rows = t_data->yEnd - t_data->yStart;
+	int inner = t_data->yStart - yA;
+
+	//Extended stripe views of the frame
+	cv::Mat lP[CVC_PLANES], rP[CVC_PLANES];
+	for(int p = 0; p < CVC_PLANES; ++p)
+	{
+		lP[p] = t_data->lPlanes[p].rowRange(yA, yB);
+		rP[p] = t_data->rPlanes[p].rowRange(yA, yB);
+	}
+	Stripe_Buf* buf = t_data->buf;
+	cv::Mat lGuide = t_data->lImg->rowRange(yA, yB);
+	cv::Mat rGuide = t_data->rImg->rowRange(yA, yB);
+	if(buf->lfgf == NULL)
+	{
+		buf->lfgf = new FastGuidedFilter(lGuide, GIF_R_WIN, GIF_EPS, t_data->subsample_rate);
+		buf->rfgf = new FastGuidedFilter(rGuide, GIF_R_WIN, GIF_EPS, t_data->subsample_rate);
+	}
+	else
+	{
+		buf->lfgf->setGuide(lGuide);
+		buf->rfgf->setGuide(rGuide);
+	}
+
+	t_data->constructor->setupSubGrid(lP, rP, t_data->subsample_rate, buf->grid);
+	buf->lsub.create(buf->grid.lSub[0].rows, buf->grid.lSub[0].cols, CV_32FC1);
+	buf->rsub.create(buf->grid.lSub[0].rows, buf->grid.lSub[0].cols, CV_32FC1);
+	buf->lminCost.create(rows, wid, CV_32FC1);
+	buf->rminCost.create(rows, wid, CV_32FC1);
+	buf->lminDis.create(rows, wid, CV_8UC1);
+	buf->rminDis.create(rows, wid, CV_8UC1);
+	buf->lminCost = Scalar(FLT_MAX);
+	buf->rminCost = Scalar(FLT_MAX);
+	buf->lminDis = Scalar(0);
+	buf->rminDis = Scalar(0);
+
+	//Only the inner rows are selected, the halo absorbs the filter borders
+	for(int d = 1; d < t_data->maxDis; ++d)
+	{
+		t_data->constructor->buildCV_sub(buf->grid, lP, rP, d, buf->lsub, buf->rsub, buf->gather);
+
+		buf->lfgf->filterSubsampledFold(buf->lsub, d, buf->lminCost, buf->lminDis, buf->lws, inner, inner + rows);
+		buf->rfgf->filterSubsampledFold(buf->rsub, d, buf->rminCost, buf->rminDis, buf->rws, inner, inner + rows);
+	}
+	cv::Mat lOut = t_data->lDisMap->rowRange(t_data->yStart, t_data->yEnd);
+	cv::Mat rOut = t_data->rDisMap->rowRange(t_data->yStart, t_data->yEnd);
+	buf->lminDis.copyTo(lOut);
+	buf->rminDis.copyTo(rOut);
+	return (void*)0;
+}
+
+//Split the frame into horizontal stripes so each stripe's slices stay cache resident
+//from construction through selection. Stripes overlap by a halo covering the FGF support:
+//two box filters of radius GIF_R_WIN plus the bilinear upsampling of the coefficients.
+//Post-processing still runs on the stitched maps - JointWMF (MED_SZ) quantises colours
+//over the whole frame, so it cannot be split without changing its output.
+int DispEst::CostFilterSelect_Stripes()
+{
+	int s = (int)subsample_rate;
+	constructor->preprocess(lImg, lGrdX, lPlanes);
+	constructor->preprocess(rImg, rGrdX, rPlanes);
+
+	//Stripe edges on multiples of s keep the subsampled grid aligned with the full frame
+	int halo = (2*GIF_R_WIN + 2*s + s - 1) / s * s;
+	int stripe_size = (stripe_rows + s - 1) / s * s;
+	int nStripes = (hei + stripe_size - 1) / stripe_size;
+	Stripe_TD TD_Array[nStripes];
+
+	//Per-stripe filters are tied to the subsample rate & stripe count
+	if(nStripes != nStripeBufs || subsample_rate != stripe_rate)
+	{
+		releaseStripes();
+		stripeBufs = new Stripe_Buf[nStripes];
+		for(int i = 0; i < nStripes; ++i)
+		{
+			stripeBufs[i].lfgf = NULL;
+			stripeBufs[i].rfgf = NULL;
+		}
+		nStripeBufs = nStripes;
+		stripe_rate = subsample_rate;
+	}
+
+	for(int i = 0; i < nStripes; ++i)
+	{
+		int yStart = i * stripe_size;
+		TD_Array[i] = {constructor, &lImg, &rImg, lPlanes, rPlanes, &lDisMap, &rDisMap,
+						yStart, std::min(yStart + stripe_size, hei), halo, maxDis, s, &stripeBufs[i]};
+		pool->submit(CostFilterSelect_stripe_thread, (void *)&TD_Array[i]);
+	}
+	pool->wait();
+	return 0;
+}
+
+//Subsampled (fast) guided filter when subsample_rate > 1, as on the CPU, else (or when FGF_cl cannot
+//run on the device) the full resolution GIF
 int DispEst::CostFilter_GPU()
 {
     //printf("OpenCL Cost Filtering Underway...\n");
-    filter_cl->preprocess(&memoryObjects[CVC_LIMGR], &memoryObjects[CVC_LIMGG], &memoryObjects[CVC_LIMGB]);
+    if(cvfEvent) clReleaseEvent(cvfEvent);
+    cvfEvent = 0;
+    if(subsample_rate > 1 && fgf_cl->isUsable())
+    {
+		if(fgf_cl->setSubsampleRate(subsample_rate)) return -1;
+		fgf_cl->preprocess(&memoryObjects[CVC_LIMGR], &memoryObjects[CVC_LIMGG], &memoryObjects[CVC_LIMGB], cvcEvent);
+		fgf_cl->filterCV(&memoryObjects[CV_LCV]);
+		fgf_cl->preprocess(&memoryObjects[CVC_RIMGR], &memoryObjects[CVC_RIMGG], &memoryObjects[CVC_RIMGB]);
+		fgf_cl->filterCV(&memoryObjects[CV_RCV], &cvfEvent);
+		return 0;
+    }
+    filter_cl->preprocess(&memoryObjects[CVC_LIMGR], &memoryObjects[CVC_LIMGG], &memoryObjects[CVC_LIMGB], cvcEvent);
     filter_cl->filterCV(&memoryObjects[CV_LCV]);
     filter_cl->preprocess(&memoryObjects[CVC_RIMGR], &memoryObjects[CVC_RIMGG], &memoryObjects[CVC_RIMGB]);
-    filter_cl->filterCV(&memoryObjects[CV_RCV]);
+    filter_cl->filterCV(&memoryObjects[CV_RCV], &cvfEvent);
     //printf("Filtering Complete\n");
 	return 0;
 }
@@ -310,35 +757,109 @@ int DispEst::CostFilter_GPU()
 
 int DispEst::DispSelect_CPU()
 {
+	if(lcostVol == NULL || rcostVol == NULL)
+		return -1;
+
     //printf("Left Selection...\n");
-    selector->CVSelect(lcostVol, maxDis, lDisMap);
-    //selector->CVSelect_thread(lcostVol, maxDis, lDisMap, threads);
+    //selector->CVSelect(*lcostVol, maxDis, lDisMap);
+    selector->CVSelect_thread(*lcostVol, maxDis, lDisMap, pool, secondCost ? &lSecondCost : NULL);
 
     //printf("Right Selection...\n");
-    selector->CVSelect(rcostVol, maxDis, rDisMap);
-    //selector->CVSelect_thread(rcostVol, maxDis, rDisMap, threads);
+    //selector->CVSelect(*rcostVol, maxDis, rDisMap);
+    selector->CVSelect_thread(*rcostVol, maxDis, rDisMap, pool, secondCost ? &rSecondCost : NULL);
 	return 0;
 }
 
 int DispEst::DispSelect_GPU()
 {
 	//printf("Left & Right Selection...\n");
-	selector_cl->CVSelect(memoryObjects, lDisMap, rDisMap);
+	if(dsEvent) clReleaseEvent(dsEvent);
+	dsEvent = 0;
+	if(selector_cl->CVSelect(memoryObjects, &dsEvent, cvfEvent ? 1 : 0, cvfEvent ? &cvfEvent : NULL)) return -1;
 	return 0;
 }
 
 int DispEst::PostProcess_CPU()
 {
     //printf("Post Processing Underway...\n");
-    postProcessor->processDM(lImg, rImg, lDisMap, rDisMap, lValid, rValid, maxDis, threads);
+    postProcessor->processDM(lImg, rImg, lDisMap, rDisMap, lValid, rValid, maxDis, pool);
     //printf("Post Processing Complete\n");
 	return 0;
 }
 
+//Without a usable PP_cl the selected maps are read back and post-processed on the CPU
 int DispEst::PostProcess_GPU()
 {
+    if(!postProcessor_cl->isUsable())
+    {
+		bool EnqueueReadBufferSuccess = true;
+		EnqueueReadBufferSuccess &= checkSuccess(clEnqueueReadBuffer(commandQueue, memoryObjects[DS_LDM], CL_TRUE, 0, bufferSize_2D_8UC1, lDisMap.data,
+												dsEvent ? 1 : 0, dsEvent ? &dsEvent : NULL, NULL));
+		EnqueueReadBufferSuccess &= checkSuccess(clEnqueueReadBuffer(commandQueue, memoryObjects[DS_RDM], CL_TRUE, 0, bufferSize_2D_8UC1, rDisMap.data,
+												0, NULL, NULL));
+		if (!EnqueueReadBufferSuccess)
+		{
+			std::cerr << "Reading back the disparity maps failed " << __FILE__ << ":"<< __LINE__ << std::endl;
+			return -1;
+		}
+		return PostProcess_CPU();
+    }
     //printf("Post Processing Underway...\n");
-    postProcessor->processDM(lImg, rImg, lDisMap, rDisMap, lValid, rValid, maxDis, threads);
+    if(postProcessor_cl->processDM(memoryObjects, lDisMap, rDisMap, dsEvent ? 1 : 0, dsEvent ? &dsEvent : NULL)) return -1;
     //printf("Post Processing Complete\n");
 	return 0;
 }
+
+//#############################################################################################################
+//# Double-buffered OpenCL pipeline
+//#############################################################################################################
+int DispEst::Pipeline_GPU()
+{
+	const int slot = dbSlot;
+	double start_time = get_rt();
+	if(cvcEvent) clReleaseEvent(cvcEvent);
+	cvcEvent = 0;
+	if(constructor_cl->buildCV(lImg, rImg, memoryObjects, &cvcEvent, slot)) return -1;
+	times.cvc = get_rt() - start_time;
+
+	start_time = get_rt();
+	if(CostFilter_GPU()) return -1;
+	times.cvf = get_rt() - start_time;
+
+	start_time = get_rt();
+	if(DispSelect_GPU()) return -1;
+	times.dispsel = get_rt() - start_time;
+
+	//The maps land in the slot's host maps, the previous frame's are collected while the
+	//device works on this one. The first frame has no predecessor and is waited for.
+	start_time = get_rt();
+	if(postProcessor_cl->enqueueDM(memoryObjects, lSlotDisMap[slot], rSlotDisMap[slot], slot, &readQueue,
+									dsEvent ? 1 : 0, dsEvent ? &dsEvent : NULL)) return -1;
+	const int ready = dbPrimed ? dbPending : slot;
+	dbPending = dbPrimed ? slot : -1;
+	dbPrimed = true;
+	dbSlot = (slot + 1) % PP_SLOTS;
+	if(ready >= 0 && finishSlot(ready)) return -1;
+	times.pp = get_rt() - start_time;
+	times.pp_skip = postProcessor_cl->getSkipRate();
+	return 0;
+}
+
+int DispEst::finishSlot(int slot)
+{
+	if(postProcessor_cl->finishDM(slot)) return -1;
+	lSlotDisMap[slot].copyTo(lDisMap);
+	rSlotDisMap[slot].copyTo(rDisMap);
+	return 0;
+}
+
+//Waits for the frame still in flight and makes its maps current
+int DispEst::drainPipeline(void)
+{
+	int ret_val = 0;
+	if(dbPending >= 0)
+		ret_val = finishSlot(dbPending);
+	dbPending = -1;
+	dbPrimed = false;
+	return ret_val;
+}
@@ -20,89 +20,94 @@ void *DS_X(void *thread_arg)
 	struct DS_X_TD *t_data;
 	t_data = (struct DS_X_TD *) thread_arg;
     //Matricies
-	cv::Mat* costVol = t_data->costVol;
+	CostVolume* costVol = t_data->costVol;
 	cv::Mat* dispMap = t_data->dispMap;
-    //Variables
-	int y = t_data->y;
-	int maxDis = t_data->maxDis;
+	cv::Mat* secondCost = t_data->secondCost;
+	const WTA_Kernels& k = wtaKernels();
 
-	int wid = dispMap->cols;
-	unsigned char* dispData = (unsigned char*) dispMap->ptr<unsigned char>(y);
-
-	for(int x = 0; x < wid; ++x)
+	for(int y = t_data->yStart; y < t_data->yEnd; ++y)
 	{
-		float minCost = DBL_MAX;
-		int minDis = 0;
-
-		for(int d = 1; d < maxDis; ++d)
-		{
-			float* costData = (float*)costVol[d].ptr<float>(y);
-			if(costData[x] < minCost)
-			{
-				minCost = costData[x];
-				minDis = d;
-			}
-		}
-		dispData[x] = minDis;
+		k.f32(costVol->ptr(0, y), costVol->dStep, t_data->maxDis, dispMap->cols,
+				dispMap->ptr<uchar>(y), secondCost ? secondCost->ptr<float>(y) : NULL);
 	}
 	return (void*)0;
 }
 
-int DispSel::CVSelect_thread(cv::Mat* costVol, const unsigned int maxDis, cv::Mat& dispMap, int threads)
+int DispSel::CVSelect_thread(CostVolume& costVol, const unsigned int maxDis, cv::Mat& dispMap, ThreadPool* pool, cv::Mat* secondCost)
 {
-    unsigned int hei = dispMap.rows;
+    int hei = dispMap.rows;
+	if(secondCost != NULL)
+		secondCost->create(hei, dispMap.cols, CV_32FC1);
 
-	//Set up threads for x-loop
-    void* status;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-    pthread_t DS_X_threads[hei];
-    DS_X_TD DS_X_TD_Array[hei];
+	//Bands of rows, ~4 tasks per worker
+	int nBands = 4 * (int)pool->size();
+	int band_size = (hei + nBands - 1) / nBands;
+	nBands = (hei + band_size - 1) / band_size;
+    DS_X_TD DS_X_TD_Array[nBands];
 
-    for(int level = 0; level <= hei/threads; ++level)
+    for(int b = 0; b < nBands; ++b)
 	{
-        //Handle remainder if threads is not power of 2.
-	    int block_size = (level < hei/threads) ? threads : (hei%threads);
-
-	    for(int iter=0; iter < block_size; ++iter)
-	    {
-	        int d = level*threads + iter;
-            DS_X_TD_Array[d] = {costVol, &dispMap, d, maxDis};
-            pthread_create(&DS_X_threads[d], &attr, DS_X, (void *)&DS_X_TD_Array[d]);
-	    }
-        for(int iter=0; iter < block_size; ++iter)
-	    {
-	        int d = level*threads + iter;
-            pthread_join(DS_X_threads[d], &status);
-        }
+		int yStart = b * band_size;
+        DS_X_TD_Array[b] = {&costVol, &dispMap, secondCost, yStart, std::min(yStart + band_size, hei), maxDis};
+        pool->submit(DS_X, (void *)&DS_X_TD_Array[b]);
 	}
+	pool->wait();
 	return 0;
 }
 
-int DispSel::CVSelect(cv::Mat* costVol, const unsigned int maxDis, cv::Mat& dispMap)
+int DispSel::CVSelect(CostVolume& costVol, const unsigned int maxDis, cv::Mat& dispMap, cv::Mat* secondCost)
 {
-    unsigned int hei = dispMap.rows;
-    unsigned int wid = dispMap.cols;
+    int hei = dispMap.rows;
+    int wid = dispMap.cols;
+	const WTA_Kernels& k = wtaKernels();
+	if(secondCost != NULL)
+		secondCost->create(hei, wid, CV_32FC1);
 
 	#pragma omp parallel for
-    for(unsigned int y = 0; y < hei; ++y)
+    for(int y = 0; y < hei; ++y)
     {
-		for(unsigned int x = 0; x < wid; ++x)
-		{
-			float minCost = DBL_MAX;
-			int minDis = 0;
+		k.f32(costVol.ptr(0, y), costVol.dStep, maxDis, wid,
+				dispMap.ptr<uchar>(y), secondCost ? secondCost->ptr<float>(y) : NULL);
+    }
+    return 0;
+}
 
-			for(unsigned int d = 1; d < maxDis; ++d)
+int DispSel::CVSelect(CostVolume16U& costVol, const unsigned int maxDis, cv::Mat& dispMap, cv::Mat* secondCost)
+{
+    int hei = dispMap.rows;
+    int wid = dispMap.cols;
+	const WTA_Kernels& k = wtaKernels();
+	if(secondCost != NULL)
+		secondCost->create(hei, wid, CV_16UC1);
+
+	#pragma omp parallel for
+    for(int y = 0; y < hei; ++y)
+    {
+		k.u16(costVol.ptr(0, y), costVol.dStep, maxDis, wid,
+				dispMap.ptr<uchar>(y), secondCost ? secondCost->ptr<uint16_t>(y) : NULL);
+    }
+    return 0;
+}
+
+//Merge a partial result covering higher disparities - ties keep the lower disparity
+int DispSel::CVMerge(const cv::Mat& srcCost, const cv::Mat& srcDisp, cv::Mat& minCost, cv::Mat& dispMap)
+{
+    int hei = dispMap.rows;
+    int wid = dispMap.cols;
+
+    for(int y = 0; y < hei; ++y)
+    {
+		const float* srcData = srcCost.ptr<float>(y);
+		const uchar* srcDispData = srcDisp.ptr<uchar>(y);
+		float* minData = minCost.ptr<float>(y);
+		uchar* dispData = dispMap.ptr<uchar>(y);
+		for(int x = 0; x < wid; ++x)
+		{
+			if(srcData[x] < minData[x])
 			{
-				float* costData = (float*)costVol[d].ptr<float>(y);
-				if(costData[x] < minCost)
-				{
-					minCost = costData[x];
-					minDis = d;
-				}
+				minData[x] = srcData[x];
+				dispData[x] = srcDispData[x];
 			}
-			dispMap.at<unsigned char>(y,x) = minDis;
 		}
     }
     return 0;
@@ -7,6 +7,11 @@
    All rights reserved.
   ---------------------------------------------------------------------------*/
 #include "DispSel_cl.h"
+#include "OCLRuntime.h"
+
+using namespace cv;
+
+#define FILE_DS_PROG BASE_DIR "assets/dispsel.cl"
 
 DispSel_cl::DispSel_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device,
 						Mat* I, const int d) : maxDis(d), context(context), commandQueue(commandQueue)
@@ -17,9 +22,9 @@ DispSel_cl::DispSel_cl(cl_context* context, cl_command_queue* commandQueue, cl_d
     program = 0;
 //    imgType = I->type() & CV_MAT_DEPTH_MASK;
 
-    if (!createProgram(*context, device, FILE_DS_PROG, &program))
+    if (!OCLRuntime::get()->getProgram(FILE_DS_PROG, &program))
     {
-        cleanUpOpenCL(NULL, NULL, NULL, kernel, NULL, 0);
+        cleanUpOpenCL(NULL, NULL, program, NULL, NULL, 0);
         std::cerr << "Failed to create OpenCL program." << __FILE__ << ":"<< __LINE__ << std::endl;
     }
 
@@ -63,16 +68,11 @@ DispSel_cl::DispSel_cl(cl_context* context, cl_command_queue* commandQueue, cl_d
 DispSel_cl::~DispSel_cl(void)
 {
     /* Release OpenCL objects. */
-	cleanUpOpenCL(NULL, NULL, NULL, kernel, NULL, 0);
+	cleanUpOpenCL(NULL, NULL, program, kernel, NULL, 0);
 }
 
-int DispSel_cl::CVSelect(cl_mem *memoryObjects, Mat& ldispMap, Mat& rdispMap)
-{
-
-	cv::namedWindow("dispPreview", CV_WINDOW_AUTOSIZE);
-	cv::imshow("dispPreview", ldispMap);
-	cv::waitKey(0);
-
+int DispSel_cl::CVSelect(cl_mem *memoryObjects, cl_event* doneEvent, cl_uint numWaitEvents, const cl_event* waitEvents)
+{
 	int arg_num = 0;
     /* Setup the kernel arguments. */
     bool setKernelArgumentsSuccess = true;
@@ -85,56 +85,35 @@ int DispSel_cl::CVSelect(cl_mem *memoryObjects, Mat& ldispMap, Mat& rdispMap)
     setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel, arg_num++, sizeof(cl_mem), &memoryObjects[DS_RDM]));
     if (!setKernelArgumentsSuccess)
     {
-        cleanUpOpenCL(NULL, NULL, NULL, kernel, NULL, 0);
         std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
     }
 
     if(OCL_STATS) printf("DS_cl: Running DispSel Kernels\n");
     /* Enqueue the kernel */
-    if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel, 2, NULL, globalWorksize, NULL, 0, NULL, &event)))
+    if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel, 2, NULL, globalWorksize, NULL, numWaitEvents, waitEvents, &event)))
     {
-        cleanUpOpenCL(NULL, NULL, NULL, kernel, NULL, 0);
         std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
         return 1;
     }
 
-    /* Wait for completion */
-    if (!checkSuccess(clFinish(*commandQueue)))
-    {
-        cleanUpOpenCL(NULL, NULL, NULL, kernel, NULL, 0);
-        std::cerr << "Failed waiting for kernel execution to finish. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return 1;
-    }
+	if(doneEvent)
+	{
+		clRetainEvent(event);
+		*doneEvent = event;
+	}
 
     /* Print the profiling information for the event. */
-    if(OCL_STATS) printProfilingInfo(event);
+    if(OCL_STATS)
+    {
+		clWaitForEvents(1, &event);
+		printProfilingInfo(event);
+    }
     /* Release the event object. */
     if (!checkSuccess(clReleaseEvent(event)))
     {
-        cleanUpOpenCL(*context, *commandQueue, program, kernel, NULL, 0);
         std::cerr << "Failed releasing the event object. " << __FILE__ << ":"<< __LINE__ << std::endl;
         return 1;
-    }
-	imshow("dispPreview", ldispMap);
-	cv::waitKey(0);
-
-	/* Map the output memory objects to host side pointers. */
-	bool EnqueueMapBufferSuccess = true;
-	cl_char *clbuffer_lDispMap = (cl_char*)clEnqueueMapBuffer(*commandQueue, memoryObjects[DS_LDM], CL_TRUE, CL_MAP_READ, 0, bufferSize_2D_8UC1, 0, NULL, NULL, &errorNumber);
-	EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-	cl_char *clbuffer_rDispMap = (cl_char*)clEnqueueMapBuffer(*commandQueue, memoryObjects[DS_RDM], CL_TRUE, CL_MAP_READ, 0, bufferSize_2D_8UC1, 0, NULL, NULL, &errorNumber);
-	EnqueueMapBufferSuccess &= checkSuccess(errorNumber);
-	if (!EnqueueMapBufferSuccess)
-	{
-	   cleanUpOpenCL(*context, *commandQueue, program, kernel, NULL, 0);
-	   std::cerr << "Mapping memory objects failed " << __FILE__ << ":"<< __LINE__ << std::endl;
-	}
-
-	memcpy(ldispMap.data, clbuffer_lDispMap, bufferSize_2D_8UC1);
-	memcpy(rdispMap.data, clbuffer_rDispMap, bufferSize_2D_8UC1);
-
-	imshow("dispPreview", ldispMap);
-	cv::waitKey(0);
+    }
 
-//    return 0;
+    return 0;
 }
@@ -0,0 +1,97 @@
+/*---------------------------------------------------------------------------
+   DispSel_simd.cpp - Vectorised Winner-Takes-All Selection Kernels
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+  ---------------------------------------------------------------------------*/
+#include "DispSel.h"
+
+//
+// Running min/argmin (and second-best) over a tile of WTA_TILE pixels, one disparity
+// at a time. Each disparity step is a branch-free compare & blend across the tile, so the
+// loop vectorises to 8-16 pixels per instruction for whichever ISA the caller targets.
+// Ties keep the lower disparity and d = 0 is never selected, as in the scalar CVSelect.
+//
+template<typename T, typename I>
+static inline __attribute__((always_inline))
+void wta_row(const T* costs, size_t dStep, int maxDis, int wid, T init, uchar* disp, T* second)
+{
+	T minBuf[WTA_TILE];
+	T secBuf[WTA_TILE];
+	I disBuf[WTA_TILE];
+
+	for(int x0 = 0; x0 < wid; x0 += WTA_TILE)
+	{
+		int n = std::min(wid - x0, WTA_TILE);
+		for(int i = 0; i < WTA_TILE; ++i)
+		{
+			minBuf[i] = init;
+			secBuf[i] = init;
+			disBuf[i] = 0;
+		}
+
+		for(int d = 1; d < maxDis; ++d)
+		{
+			const T* c = costs + d*dStep + x0;
+			const I dI = (I)d;
+			#pragma omp simd
+			for(int i = 0; i < n; ++i)
+			{
+				T v = c[i];
+				T m = minBuf[i];
+				bool lt = v < m;
+				T hi = lt ? m : v;
+				secBuf[i] = hi < secBuf[i] ? hi : secBuf[i];
+				minBuf[i] = lt ? v : m;
+				disBuf[i] = lt ? dI : disBuf[i];
+			}
+		}
+
+		for(int i = 0; i < n; ++i)
+			disp[x0 + i] = (uchar)disBuf[i];
+		if(second != NULL)
+			memcpy(second + x0, secBuf, n * sizeof(T));
+	}
+}
+
+#define WTA_INSTANCE(suffix, attr) \
+	attr static void wta_f32_##suffix(const float* costs, size_t dStep, int maxDis, int wid, uchar* disp, float* second) \
+	{ wta_row<float, int32_t>(costs, dStep, maxDis, wid, FLT_MAX, disp, second); } \
+	attr static void wta_u16_##suffix(const uint16_t* costs, size_t dStep, int maxDis, int wid, uchar* disp, uint16_t* second) \
+	{ wta_row<uint16_t, uint16_t>(costs, dStep, maxDis, wid, USHRT_MAX, disp, second); }
+
+WTA_INSTANCE(default, )
+#if defined(__x86_64__) || defined(__i386__)
+#define WTA_X86
+WTA_INSTANCE(avx2, __attribute__((target("avx2"))))
+WTA_INSTANCE(avx512, __attribute__((target("avx512f,avx512bw"))))
+#endif // x86
+
+static WTA_Kernels selectKernels(void)
+{
+	WTA_Kernels k = {wta_f32_default, wta_u16_default, "default"};
+#ifdef WTA_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+	{
+		k.f32 = wta_f32_avx512;
+		k.u16 = wta_u16_avx512;
+		k.name = "AVX-512";
+	}
+	else if(__builtin_cpu_supports("avx2"))
+	{
+		k.f32 = wta_f32_avx2;
+		k.u16 = wta_u16_avx2;
+		k.name = "AVX2";
+	}
+#endif // WTA_X86
+	return k;
+}
+
+//Resolved once, on first use
+const WTA_Kernels& wtaKernels(void)
+{
+	static const WTA_Kernels kernels = selectKernels();
+	return kernels;
+}
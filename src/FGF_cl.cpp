@@ -0,0 +1,371 @@
+/*---------------------------------------------------------------------------
+   FGF_cl.cpp - OpenCL Fast Guided Filter Code
+              - Subsampled Guided Image Filter
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+  ---------------------------------------------------------------------------*/
+#include "FGF_cl.h"
+#include "OCLRuntime.h"
+
+using namespace cv;
+
+#define FILE_FGF_PROG BASE_DIR "assets/fgf.cl"
+
+//Same source indices as cv::resize INTER_NN
+static void nnIndex(int src, int dst, std::vector<cl_int>& idx)
+{
+	double ifx = 1. / ((double)dst / src);
+	idx.resize(dst);
+	for(int i = 0; i < dst; ++i)
+		idx[i] = std::min(cvFloor(i * ifx), src - 1);
+}
+
+//Same source positions and weights as cv::resize INTER_LINEAR
+static void linearMap(int lo, int hi, std::vector<cl_int>& ofs, std::vector<cl_float>& alpha)
+{
+	double scale = 1. / ((double)hi / lo);
+	ofs.resize(hi);
+	alpha.resize(hi);
+	for(int i = 0; i < hi; ++i)
+	{
+		float f = (float)((i + 0.5) * scale - 0.5);
+		int si = cvFloor(f);
+		f -= si;
+		if(si < 0)
+			f = 0, si = 0;
+		if(si >= lo - 1)
+			f = 0, si = lo - 1;
+		ofs[i] = si;
+		alpha[i] = f;
+	}
+}
+
+FGF_cl::FGF_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, Mat* I, const int d, const int s) :
+				context(context), commandQueue(commandQueue), maxDis(d)
+{
+	//OpenCL Setup
+    program = 0;
+
+    if (!OCLRuntime::get()->getProgram(FILE_FGF_PROG, &program))
+    {
+        cleanUpOpenCL(NULL, NULL, program, NULL, NULL, 0);
+        std::cerr << "Failed to create OpenCL program." << __FILE__ << ":"<< __LINE__ << std::endl;
+    }
+
+    /* Tail of the event chain of enqueued kernels (0 when empty). */
+    event = 0;
+
+	width = I->cols;
+	height = I->rows;
+	subsample_rate = 0;
+
+	xIdx = yIdx = xofs = xalpha = yofs = yalpha = 0;
+	for(int i = 0; i < 6; i++)
+	{
+		inv_I[i] = 0;
+		if(i<3) mean_I[i] = 0;
+		if(i<4) coef[i] = mean_coef[i] = 0;
+	}
+
+	//Without its kernels the filter is left unusable and the caller falls back to CVF_cl
+	usable = false;
+	kernel_guide = clCreateKernel(program, "FGF_Guide_32F", &errorNumber);
+    bool createKernelsSuccess = checkSuccess(errorNumber);
+	kernel_coeffs = clCreateKernel(program, "FGF_Coeffs_32F", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+	kernel_boxc = clCreateKernel(program, "FGF_BoxCoeffs_32F", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+	kernel_upsample = clCreateKernel(program, "FGF_Upsample_32F", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+    if (!createKernelsSuccess)
+    {
+        std::cerr << "Failed to create OpenCL kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
+    }
+    else{
+		printf("FGF_cl: OpenCL kernel versions created in context.\n");
+    }
+
+	//The tiled kernels need a full FGF_TILE x FGF_TILE work-group
+	cl_kernel kernels[3] = {kernel_guide, kernel_coeffs, kernel_boxc};
+	for(int i = 0; i < 3; i++)
+	{
+		size_t maxWorkGroupSize = 0;
+		clGetKernelWorkGroupInfo(kernels[i], device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, NULL);
+		if(maxWorkGroupSize < FGF_TILE * FGF_TILE)
+		{
+			std::cerr << "FGF_cl: Device work-group size (" << maxWorkGroupSize << ") is too small for the "
+					  << FGF_TILE << "x" << FGF_TILE << " filter tiles. " << __FILE__ << ":"<< __LINE__ << std::endl;
+			return;
+		}
+	}
+
+    localWorksize[0] = (size_t)FGF_TILE;
+    localWorksize[1] = (size_t)FGF_TILE;
+    localWorksize[2] = (size_t)1;
+
+	usable = true;
+	if(setSubsampleRate(s))
+		usable = false;
+}
+
+FGF_cl::~FGF_cl(void)
+{
+	releaseBuffers();
+	if(kernel_guide) clReleaseKernel(kernel_guide);
+	if(kernel_coeffs) clReleaseKernel(kernel_coeffs);
+	if(kernel_boxc) clReleaseKernel(kernel_boxc);
+	if(kernel_upsample) clReleaseKernel(kernel_upsample);
+	if(program) clReleaseProgram(program);
+	if(event) clReleaseEvent(event);
+}
+
+int FGF_cl::setSubsampleRate(int s)
+{
+	if(!usable || s < 1)
+		return -1;
+	if(s == subsample_rate)
+		return 0;
+
+	//Buffers may still be in use by enqueued kernels
+	if(event) clWaitForEvents(1, &event);
+	releaseBuffers();
+
+	subsample_rate = s;
+	subWidth = width / s;
+	subHeight = height / s;
+	//Window of 2*(GIF_R_WIN/s)+1 subsampled pixels, as FastGuidedFilter
+	radius = std::min(GIF_R_WIN / s, FGF_RMAX);
+	sliceChunk = std::min(maxDis, FGF_SLICES * s * s);
+
+	//Rounded up to whole tiles, the kernels skip the out-of-image work-items
+    globalWorksize_sub[0] = (size_t)((subWidth + FGF_TILE - 1) / FGF_TILE * FGF_TILE);
+    globalWorksize_sub[1] = (size_t)((subHeight + FGF_TILE - 1) / FGF_TILE * FGF_TILE);
+    globalWorksize_sub[2] = (size_t)1;
+
+	return allocBuffers();
+}
+
+int FGF_cl::allocBuffers(void)
+{
+	std::vector<cl_int> xi, yi, xo, yo;
+	std::vector<cl_float> xa, ya;
+	nnIndex(width, subWidth, xi);
+	nnIndex(height, subHeight, yi);
+	linearMap(subWidth, width, xo, xa);
+	linearMap(subHeight, height, yo, ya);
+
+	const cl_mem_flags mapFlags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+	size_t bufferSize_sub = subWidth * subHeight * sizeof(cl_float);
+	size_t bufferSize_chunk = bufferSize_sub * sliceChunk;
+
+	bool createMemoryObjectsSuccess = true;
+	xIdx = clCreateBuffer(*context, mapFlags, subWidth * sizeof(cl_int), &xi[0], &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	yIdx = clCreateBuffer(*context, mapFlags, subHeight * sizeof(cl_int), &yi[0], &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	xofs = clCreateBuffer(*context, mapFlags, width * sizeof(cl_int), &xo[0], &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	xalpha = clCreateBuffer(*context, mapFlags, width * sizeof(cl_float), &xa[0], &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	yofs = clCreateBuffer(*context, mapFlags, height * sizeof(cl_int), &yo[0], &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	yalpha = clCreateBuffer(*context, mapFlags, height * sizeof(cl_float), &ya[0], &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+
+	for(int i = 0; i < 6; i++)
+	{
+		inv_I[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_sub, &errorNumber);
+		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+		if(i<3)
+		{
+			mean_I[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_sub, &errorNumber);
+			createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+		}
+		if(i<4)
+		{
+			coef[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_chunk, &errorNumber);
+			createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+			mean_coef[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_chunk, &errorNumber);
+			createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+		}
+	}
+
+	if (!createMemoryObjectsSuccess)
+	{
+		std::cerr << "Failed to create OpenCL buffers. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+void FGF_cl::releaseBuffers(void)
+{
+	cl_mem* mems[] = {&xIdx, &yIdx, &xofs, &xalpha, &yofs, &yalpha};
+	for(int i = 0; i < 6; i++)
+	{
+		if(*mems[i]) clReleaseMemObject(*mems[i]);
+		*mems[i] = 0;
+		if(inv_I[i]) OCLRuntime::get()->releaseBuffer(inv_I[i]);
+		inv_I[i] = 0;
+		if(i<3 && mean_I[i])
+		{
+			OCLRuntime::get()->releaseBuffer(mean_I[i]);
+			mean_I[i] = 0;
+		}
+		if(i<4 && coef[i])
+		{
+			OCLRuntime::get()->releaseBuffer(coef[i]);
+			OCLRuntime::get()->releaseBuffer(mean_coef[i]);
+			coef[i] = mean_coef[i] = 0;
+		}
+	}
+}
+
+int FGF_cl::preprocess(cl_mem* ImgR, cl_mem* ImgG, cl_mem* ImgB, cl_event waitEvent)
+{
+	//Start from waitEvent (the producer of the images) if given, else continue the current chain
+	if(waitEvent)
+	{
+		clRetainEvent(waitEvent);
+		if(event) clReleaseEvent(event);
+		event = waitEvent;
+	}
+
+    Ir = ImgR;
+    Ig = ImgG;
+    Ib = ImgB;
+
+	const cl_float eps = GIF_EPS;
+	int arg_num = 0;
+    /* Setup the kernel arguments. */
+    bool setKernelArgumentsSuccess = true;
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), Ir));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), Ig));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), Ib));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_int), &width));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), &xIdx));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), &yIdx));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_int), &subWidth));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_int), &subHeight));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_int), &radius));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_float), &eps));
+	for(int i = 0; i < 3; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), &mean_I[i]));
+	for(int i = 0; i < 6; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_guide, arg_num++, sizeof(cl_mem), &inv_I[i]));
+    if (!setKernelArgumentsSuccess)
+    {
+        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
+    }
+
+	return enqueueKernel(kernel_guide, 2, globalWorksize_sub, localWorksize, "guide statistics");
+}
+
+//The volume is filtered sliceChunk disparities at a time: the coefficients of a chunk are
+//computed and box filtered at the subsampled resolution, then upsampled and evaluated
+//back over the same full resolution slices.
+int FGF_cl::filterCV(cl_mem* cl_costVol, cl_event* doneEvent)
+{
+	int arg_num = 0;
+    /* Setup the kernel arguments (all but d0). */
+    bool setKernelArgumentsSuccess = true;
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), cl_costVol));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), Ir));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), Ig));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), Ib));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_int), &width));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_int), &height));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &xIdx));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &yIdx));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_int), &subWidth));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_int), &subHeight));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_int), &radius));
+    const int coeffs_d0 = arg_num++;
+	for(int i = 0; i < 3; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &mean_I[i]));
+	for(int i = 0; i < 6; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &inv_I[i]));
+	for(int i = 0; i < 4; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_coeffs, arg_num++, sizeof(cl_mem), &coef[i]));
+
+	arg_num = 0;
+	for(int i = 0; i < 4; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_boxc, arg_num++, sizeof(cl_mem), &coef[i]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_boxc, arg_num++, sizeof(cl_int), &subWidth));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_boxc, arg_num++, sizeof(cl_int), &subHeight));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_boxc, arg_num++, sizeof(cl_int), &radius));
+	for(int i = 0; i < 4; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_boxc, arg_num++, sizeof(cl_mem), &mean_coef[i]));
+
+	arg_num = 0;
+	for(int i = 0; i < 4; i++)
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), &mean_coef[i]));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), Ir));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), Ig));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), Ib));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_int), &width));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_int), &height));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_int), &subWidth));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_int), &subHeight));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), &xofs));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), &xalpha));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), &yofs));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), &yalpha));
+    const int upsample_d0 = arg_num++;
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_upsample, arg_num++, sizeof(cl_mem), cl_costVol));
+    if (!setKernelArgumentsSuccess)
+    {
+        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
+    }
+
+	for(cl_int d0 = 0; d0 < maxDis; d0 += sliceChunk)
+	{
+		size_t n = (size_t)std::min(sliceChunk, maxDis - d0);
+		size_t globalWorksize_chunk[3] = {globalWorksize_sub[0], globalWorksize_sub[1], n};
+		size_t globalWorksize_full[3] = {(size_t)width, (size_t)height, n};
+
+		//The kernel arguments are captured at enqueue, so d0 can be updated per chunk
+		clSetKernelArg(kernel_coeffs, coeffs_d0, sizeof(cl_int), &d0);
+		if(enqueueKernel(kernel_coeffs, 3, globalWorksize_chunk, localWorksize, "coefficients"))
+			return 1;
+		if(enqueueKernel(kernel_boxc, 3, globalWorksize_chunk, localWorksize, "coefficient box filter"))
+			return 1;
+		clSetKernelArg(kernel_upsample, upsample_d0, sizeof(cl_int), &d0);
+		if(enqueueKernel(kernel_upsample, 3, globalWorksize_full, NULL, "upsample"))
+			return 1;
+	}
+
+	//Hand the tail of the chain to the consumer of the filtered volume
+	if(doneEvent)
+	{
+		clRetainEvent(event);
+		*doneEvent = event;
+	}
+    return 0;
+}
+
+//Chained through events as in CVF_cl::enqueueKernel
+int FGF_cl::enqueueKernel(cl_kernel kernel, cl_uint workDim, const size_t *globalworksize, const size_t *localworksize, const char *name)
+{
+    if(OCL_STATS) printf("FGF_cl: Running %s Kernels\n", name);
+	cl_event next;
+	/* Enqueue the kernel */
+	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel, workDim, NULL, globalworksize, localworksize,
+												event ? 1 : 0, event ? &event : NULL, &next)))
+	{
+		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+	if(event) clReleaseEvent(event);
+	event = next;
+
+	if(OCL_STATS)
+	{
+		clWaitForEvents(1, &event);
+		printProfilingInfo(event);
+	}
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*---------------------------------------------------------------------------
+   OCLRuntime.cpp - Shared OpenCL Runtime Code
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+   All rights reserved.
+  ---------------------------------------------------------------------------*/
+#include "OCLRuntime.h"
+
+OCLRuntime* OCLRuntime::instance = NULL;
+std::mutex OCLRuntime::instance_mtx;
+OCLDeviceConfig OCLRuntime::deviceConfig;
+
+OCLRuntime* OCLRuntime::get(void)
+{
+	std::lock_guard<std::mutex> lock(instance_mtx);
+	if(instance == NULL)
+	{
+		instance = new OCLRuntime();
+		if(!instance->init())
+		{
+			delete instance;
+			instance = NULL;
+		}
+	}
+	return instance;
+}
+
+void OCLRuntime::release(void)
+{
+	std::lock_guard<std::mutex> lock(instance_mtx);
+	delete instance;
+	instance = NULL;
+}
+
+bool OCLRuntime::configure(const OCLDeviceConfig& config)
+{
+	std::lock_guard<std::mutex> lock(instance_mtx);
+	if(instance != NULL)
+	{
+		std::cerr << "The OpenCL runtime is already set up, release it before selecting another device. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return false;
+	}
+	deviceConfig = config;
+	return true;
+}
+
+OCLRuntime::OCLRuntime(void) : context(0), commandQueue(0), uploadQueue(0), readQueue(0), device(0)
+{
+}
+
+OCLRuntime::~OCLRuntime(void)
+{
+	if(commandQueue) clFinish(commandQueue);
+	if(uploadQueue) clFinish(uploadQueue);
+	if(readQueue) clFinish(readQueue);
+	for(std::map<std::string, cl_program>::iterator it = programs.begin(); it != programs.end(); ++it)
+		clReleaseProgram(it->second);
+	for(std::multimap<size_t, cl_mem>::iterator it = freeBuffers.begin(); it != freeBuffers.end(); ++it)
+		clReleaseMemObject(it->second);
+	if(readQueue) clReleaseCommandQueue(readQueue);
+	if(uploadQueue) clReleaseCommandQueue(uploadQueue);
+	if(commandQueue) clReleaseCommandQueue(commandQueue);
+	if(context) clReleaseContext(context);
+}
+
+bool OCLRuntime::init(void)
+{
+	printf("Setting up the OpenCL runtime\n");
+	if (!createContext(&context, deviceConfig))
+	{
+		std::cerr << "Failed to create an OpenCL context. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return false;
+	}
+	if (!createCommandQueue(context, &commandQueue, &device))
+	{
+		std::cerr << "Failed to create the OpenCL command queue. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return false;
+	}
+	//Queues on the same device for the double-buffered uploads & readbacks
+	if (!createCommandQueue(context, &uploadQueue, &device))
+	{
+		std::cerr << "Failed to create the OpenCL upload queue. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return false;
+	}
+	if (!createCommandQueue(context, &readQueue, &device))
+	{
+		std::cerr << "Failed to create the OpenCL readback queue. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool OCLRuntime::getProgram(std::string filename, cl_program* program, std::string options)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	const std::string key = filename + "\n" + options;
+	std::map<std::string, cl_program>::iterator it = programs.find(key);
+	if(it == programs.end())
+	{
+		cl_program built = 0;
+		if(!createProgram(context, device, filename, &built, options))
+			return false;
+		it = programs.insert(std::make_pair(key, built)).first;
+	}
+	*program = it->second;
+	return checkSuccess(clRetainProgram(*program));
+}
+
+cl_mem OCLRuntime::createBuffer(cl_mem_flags flags, size_t size, cl_int* errorNumber)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	std::multimap<size_t, cl_mem>::iterator it = freeBuffers.lower_bound(size);
+	for(; it != freeBuffers.end() && it->first <= size * OCL_POOL_SLACK; ++it)
+	{
+		cl_mem_flags bufferFlags = 0;
+		clGetMemObjectInfo(it->second, CL_MEM_FLAGS, sizeof(cl_mem_flags), &bufferFlags, NULL);
+		if(bufferFlags == flags)
+		{
+			cl_mem buffer = it->second;
+			freeBuffers.erase(it);
+			if(errorNumber) *errorNumber = CL_SUCCESS;
+			return buffer;
+		}
+	}
+
+	//Free buffers of these flags just too small for this request are most likely the same
+	//buffers of a smaller input, so they are dropped rather than kept around
+	for(it = freeBuffers.lower_bound(size / OCL_POOL_SLACK); it != freeBuffers.end() && it->first < size; )
+	{
+		cl_mem_flags bufferFlags = 0;
+		clGetMemObjectInfo(it->second, CL_MEM_FLAGS, sizeof(cl_mem_flags), &bufferFlags, NULL);
+		if(bufferFlags == flags)
+		{
+			clReleaseMemObject(it->second);
+			freeBuffers.erase(it++);
+		}
+		else
+			++it;
+	}
+	return clCreateBuffer(context, flags, size, NULL, errorNumber);
+}
+
+void OCLRuntime::releaseBuffer(cl_mem buffer)
+{
+	if(!buffer)
+		return;
+	size_t size = 0;
+	if(!checkSuccess(clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(size_t), &size, NULL)))
+		return;
+	std::lock_guard<std::mutex> lock(mtx);
+	freeBuffers.insert(std::make_pair(size, buffer));
+}
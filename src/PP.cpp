@@ -7,8 +7,11 @@
    All rights reserved.
   ---------------------------------------------------------------------------*/
 #include "PP.h"
+#include "JointWMF.h"
 
-PP::PP(void)
+using namespace cv;
+
+PP::PP(void) : selective(false), skipRate(0)
 {
 	//printf( "L-R Consistency Check and Weighted-Median Filter Post-Processing\n" );
 }
@@ -18,8 +21,8 @@ void lrCheck(Mat& lDis, Mat& rDis, Mat& lValid, Mat& rValid)
 {
     int hei = lDis.rows;
 	int wid = lDis.cols;
-    lValid = Scalar(0); //memset( lValid, 0, imgSize * sizeof( int ) );
-    rValid = Scalar(0); //memset( rValid, 0, imgSize * sizeof( int ) );
+    //Every pixel is written, rows are independent
+	#pragma omp parallel for
     for( int y = 0; y < hei; y ++ ) {
 		uchar* lDisData = ( uchar* ) lDis.ptr<uchar>( y );
 		uchar* rDisData = ( uchar* ) rDis.ptr<uchar>( y );
@@ -32,113 +35,72 @@ void lrCheck(Mat& lDis, Mat& rDis, Mat& lValid, Mat& rValid)
             int rLoc = ( x - lDep + wid ) % wid;
             int rDep = rDisData[ rLoc ];
             // disparity should not be zero
-            if( lDep == rDep && lDep >= 2 ) {
-                lValidData[x] = 1;
-            }
+            lValidData[x] = ( lDep == rDep && lDep >= 2 );
             // check right image
             rDep = rDisData[ x ];
             // assert( ( x + rDep ) >= 0 && ( x + rDep ) < wid );
             int lLoc = ( x + rDep + wid ) % wid;
             lDep = lDisData[ lLoc ];
             // disparity should not be zero
-            if( rDep == lDep && rDep >= 2 ) {
-                rValidData[x] = 1;
-            }
+            rValidData[x] = ( rDep == lDep && rDep >= 2 );
         }
     }
     return;
 }
 
+//Fill the invalid pixels of one row with the lower of the nearest valid disparities to
+//their left and right (or the only one found). Two O(W) sweeps carry the nearest valid
+//value forwards and backwards, then a branch-free min & blend pass writes the row.
+static void fillInvRow(uchar* disData, const uchar* validData, int wid, uchar* fwd, uchar* bwd)
+{
+	int xFirst = 0, xLast = wid - 1;
+	while(xFirst < wid && !validData[xFirst]) xFirst++;
+	if(xFirst == wid) return; //no valid pixel, the row is left as it is
+	while(!validData[xLast]) xLast--;
+
+	//Beyond the outermost valid pixels only one side exists, both sweeps hold its value there
+	uchar carry = disData[xFirst];
+	for(int x = 0; x < wid; x++)
+	{
+		carry = validData[x] ? disData[x] : carry;
+		fwd[x] = carry;
+	}
+	carry = disData[xLast];
+	for(int x = wid - 1; x >= 0; x--)
+	{
+		carry = validData[x] ? disData[x] : carry;
+		bwd[x] = carry;
+	}
+
+	#pragma omp simd
+	for(int x = 0; x < wid; x++)
+	{
+		uchar m = fwd[x] <= bwd[x] ? fwd[x] : bwd[x];
+		disData[x] = validData[x] ? disData[x] : m;
+	}
+}
+
 void fillInv(Mat& lDis, Mat& rDis, Mat& lValid, Mat& rValid)
 {
 	int hei = lDis.rows;
 	int wid = lDis.cols;
 
-    // fill left dep
-	#pragma omp parallel for
-    for( int y = 0; y < hei; y ++ ) {
-		uchar* lDisData = ( uchar* ) lDis.ptr<uchar>( y );
-		uchar* lValidData = ( uchar* ) lValid.ptr<uchar>( y );
-        for( int x = 0; x < wid; x ++ ) {
-            if( lValidData[x] == 0 ) {
-                // find left first valid pixel
-                int lFirst = x;
-                int lFind = 0;
-                while( lFirst >= 0 ) {
-                    if( lValidData[ lFirst ] ) {
-                        lFind = 1;
-                        break;
-                    }
-                    lFirst --;
-                }
-                int rFind = 0;
-                // find right first valid pixel
-                int rFirst = x;
-                while( rFirst < wid ) {
-                    if( lValidData[ rFirst ] ) {
-                        rFind = 1;
-                        break;
-                    }
-                    rFirst ++;
-                }
-                // set x's depth to the lowest one
-                if( lFind && rFind ) {
-                    if( lDisData[ lFirst ] <= lDisData[ rFirst ] ) {
-                        lDisData[ x ] = lDisData[ lFirst ];
-                    } else {
-                        lDisData[ x ] = lDisData[ rFirst ];
-                    }
-                } else if( lFind ) {
-                    lDisData[ x ] = lDisData[ lFirst ];
-                } else if ( rFind ) {
-                    lDisData[ x ] = lDisData[ rFirst ];
-                }
-            }
-        }
-    }
-    // fill right dep
-	#pragma omp parallel for
-    for( int y = 0; y < hei; y ++ ) {
-		uchar* rDisData = ( uchar* ) ( rDis.ptr<uchar>( y ) );
-		uchar* rValidData = ( uchar* ) rValid.ptr<uchar>( y );
-        for( int x = 0; x < wid; x ++ ) {
-            if( rValidData[x] == 0 ) {
-                // find left first valid pixel
-                int lFirst = x;
-                int lFind = 0;
-                while( lFirst >= 0 ) {
-                    if( rValidData[ lFirst ] ) {
-                        lFind = 1;
-                        break;
-                    }
-                    lFirst --;
-                }
-                // find right first valid pixel
-                int rFirst = x;
-                int rFind = 0;
-                while( rFirst < wid ) {
-                    if( rValidData[ rFirst ] ) {
-                        rFind = 1;
-                        break;
-                    }
-                    rFirst ++;
-                }
-                if( lFind && rFind ) {
-                    // set x's depth to the lowest one
-                    if( rDisData[ lFirst ] <= rDisData[ rFirst ] ) {
-                        rDisData[ x ] = rDisData[ lFirst ];
-                    } else {
-                        rDisData[ x ] = rDisData[ rFirst ];
-                    }
-                } else if( lFind ) {
-                    rDisData[ x ] = rDisData[ lFirst ];
-                } else if ( rFind )  {
-                    rDisData[ x ] = rDisData[ rFirst ];
-                }
-
-            }
-        }
-    }
+	//Rows of both maps are independent
+	#pragma omp parallel
+	{
+		uchar* fwd = new uchar[wid];
+		uchar* bwd = new uchar[wid];
+		#pragma omp for
+		for(int i = 0; i < 2*hei; i++)
+		{
+			Mat& Dis = i < hei ? lDis : rDis;
+			Mat& Valid = i < hei ? lValid : rValid;
+			int y = i < hei ? i : i - hei;
+			fillInvRow(Dis.ptr<uchar>(y), Valid.ptr<uchar>(y), wid, fwd, bwd);
+		}
+		delete [] fwd;
+		delete [] bwd;
+	}
     return;
 }
 
@@ -360,66 +322,106 @@ void *wgtMed_row(void *thread_arg)
 //		printf("PP: Error - Unrecognised data type in processing! (wgtMed_row)\n");
 //		exit(1);
 //    }
+	delete [] disHist;
 	return (void*)0;
 }
 
-void wgtMedian_thread(const Mat& Img, Mat& Dis, Mat& Valid, const int maxDis, const int threads)
+void wgtMedian_thread(const Mat& Img, Mat& Dis, Mat& Valid, const int maxDis, ThreadPool* pool)
 {
     int hei = Img.rows;
-
-	//Set up threads for x-loop
-    void* status;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-    pthread_t WM_row_threads[hei];
     WM_row_TD WM_row_TD_Array[hei];
 
-	for(int level = 0; level <= hei/threads; level ++)
+	//One task per row, all rows in flight on the pool
+	for(int y = 0; y < hei; y++)
 	{
-        //Handle remainder if threads is not power of 2.
-	    int block_size = (level < hei/threads) ? threads : (hei%threads);
-
-	    for(int iter=0; iter < block_size; iter++)
-	    {
-	        int d = level*threads + iter;
-			uchar* ValidData = (uchar*) Valid.ptr<uchar>(d);
-
-            WM_row_TD_Array[d] = {&Img, &Dis, ValidData, d, maxDis};
-            pthread_create(&WM_row_threads[d], &attr, wgtMed_row, (void *)&WM_row_TD_Array[d]);
-            //printf("WM Filtering Disparity Map @ y = %d\n", d);
-	    }
-        for(int iter=0; iter < block_size; iter++)
-	    {
-	        int d = level*threads + iter;
-            pthread_join(WM_row_threads[d], &status);
-            //printf("Joining WM Filtering @ y = %d\n", d);
-        }
+		uchar* ValidData = (uchar*) Valid.ptr<uchar>(y);
+		WM_row_TD_Array[y] = {&Img, &Dis, ValidData, y, maxDis};
+		pool->submit(wgtMed_row, (void *)&WM_row_TD_Array[y]);
 	}
+	pool->wait();
 	return;
 }
 
-void PP::processDM(Mat& lImg, Mat& rImg, Mat& lDisMap, Mat& rDisMap,
-					Mat& lValid, Mat& rValid, const int maxDis, int threads)
+void *wmf_view(void *thread_arg)
 {
-//	lrCheck(lDisMap, rDisMap, lValid, rValid);
-//	fillInv(lDisMap, rDisMap, lValid, rValid);
+	struct WMF_view_TD *t_data;
+	t_data = (struct WMF_view_TD *) thread_arg;
 
+	//use colour feature images:
+	Mat feature;
+	t_data->Img->convertTo(feature, CV_8UC3, 255);
+
+	//The k-means clustering is serial, so the two views are prepared concurrently
+	t_data->F = feature;
+	t_data->nF = 256;
+	JointWMF::featureIndexing(t_data->F, t_data->wMap, t_data->nF, 25.5f, "exp");
+	return (void*)0;
+}
+
+void *wmf_strip(void *thread_arg)
+{
+	struct WMF_strip_TD *t_data;
+	t_data = (struct WMF_strip_TD *) thread_arg;
+	const WMF_view_TD* view = t_data->view;
+
+	//Disparity labels are filtered in place of JointWMF's 256 levels, on the 8-bit map directly
+	JointWMF::filterCoreStrip<uchar>(*view->Dis, view->F, view->wMap, (int)MED_SZ/2, view->nF, t_data->nI, Mat(),
+								t_data->xStart, t_data->xEnd, *t_data->out, view->Valid ? *view->Valid : Mat());
+	return (void*)0;
+}
+
+void PP::processDM(Mat& lImg, Mat& rImg, Mat& lDisMap, Mat& rDisMap,
+					Mat& lValid, Mat& rValid, const int maxDis, ThreadPool* pool)
+{
 	// color image should be 3x3 median filtered
 	// according to weightedMedianMatlab.m from CVPR11
 	//wgtMedian( lImg, rImg, lDisMap, rDisMap, lValid, rValid, maxDis);
 
-//	wgtMedian_thread(lImg, lDisMap, lValid, maxDis, threads);
-//	wgtMedian_thread(rImg, rDisMap, rValid, maxDis, threads);
+//	wgtMedian_thread(lImg, lDisMap, lValid, maxDis, pool);
+//	wgtMedian_thread(rImg, rDisMap, rValid, maxDis, pool);
 	//printf("Weighted-Median Filter Done\n");
 
-	Mat lImg_8UC3, rImg_8UC3;
-	//use colour feature images:
-	lImg.convertTo(lImg_8UC3, CV_8UC3, 255);
-	rImg.convertTo(rImg_8UC3, CV_8UC3, 255);
+	//Otherwise equivalent to JointWMF::filter(DisMap, Img_8UC3, MED_SZ/2) on each view, with both views
+	//and strips of columns of each view filtered concurrently on the pool. Disparities lie in
+	//[0, maxDis), so the histograms only need maxDis input levels instead of 256
+	skipRate = 0;
+	if(selective)
+	{
+		//Consistent pixels are kept, inconsistent ones are filled from their neighbours
+		//and then re-estimated by the weighted median
+		lrCheck(lDisMap, rDisMap, lValid, rValid);
+		fillInv(lDisMap, rDisMap, lValid, rValid);
+		skipRate = (double)(countNonZero(lValid) + countNonZero(rValid)) / (2.0 * lValid.total());
+	}
+	const Mat* lKeep = selective ? &lValid : NULL;
+	const Mat* rKeep = selective ? &rValid : NULL;
+
+	WMF_view_TD vTD[2] = {{&lImg, &lDisMap, lKeep, Mat(), NULL, 0}, {&rImg, &rDisMap, rKeep, Mat(), NULL, 0}};
+	for(int v = 0; v < 2; v++)
+		pool->submit(wmf_view, (void *)&vTD[v]);
+	pool->wait();
 
-    lDisMap = JointWMF::filter(lDisMap, lImg_8UC3, (int)MED_SZ/2);
-    rDisMap = JointWMF::filter(rDisMap, rImg_8UC3, (int)MED_SZ/2);
+	int wid = lDisMap.cols;
+	int nStrips = std::max(std::min((int)pool->size(), wid), 1);
+	Mat out[2];
+	WMF_strip_TD sTD[2*nStrips];
+	for(int v = 0; v < 2; v++)
+	{
+		//Pixels skipped by a selective pass keep their current disparity
+		vTD[v].Dis->copyTo(out[v]);
+		for(int s = 0; s < nStrips; s++)
+		{
+			sTD[v*nStrips + s] = {&vTD[v], maxDis, s*wid/nStrips, (s+1)*wid/nStrips, &out[v]};
+			pool->submit(wmf_strip, (void *)&sTD[v*nStrips + s]);
+		}
+	}
+	pool->wait();
+
+	for(int v = 0; v < 2; v++)
+	{
+		out[v].copyTo(*vTD[v].Dis);
+		JointWMF::float2D_release(vTD[v].wMap);
+	}
 
 	return;
 }
@@ -0,0 +1,296 @@
+/*---------------------------------------------------------------------------
+   PP_cl.cpp - OpenCL Post Processing Code
+              - Left-Right Check, Invalid Pixel Filling & Weighted Median
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+   All rights reserved.
+  ---------------------------------------------------------------------------*/
+#include "PP_cl.h"
+#include "OCLRuntime.h"
+
+using namespace cv;
+
+#define FILE_PP_PROG BASE_DIR "assets/pp.cl"
+
+PP_cl::PP_cl(cl_context* context, cl_command_queue* commandQueue, cl_device_id device, Mat* I, const int d) :
+				selective(false), skipRate(0), context(context), commandQueue(commandQueue), maxDis(d)
+{
+	//OpenCL Setup
+    program = 0;
+    kernel_lr = kernel_fill = kernel_wm = 0;
+    /* Tail of the event chain of enqueued commands (0 when empty). */
+    event = 0;
+
+	lValid = rValid = 0;
+	for(int i = 0; i < PP_SLOTS; i++)
+	{
+		lOut[i] = rOut[i] = validCount[i] = 0;
+		count[i] = 0;
+		slotSelective[i] = false;
+		numReads[i] = 0;
+	}
+
+	//Unless the filter can run on this device it is left unusable and the caller post-processes on the CPU
+	usable = false;
+	//The two-level median histogram covers PP_BINS^2 = 256 labels
+	if(maxDis > 256)
+	{
+		std::cerr << "PP_cl: maxDis above 256 is not supported. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
+	}
+
+    if (!OCLRuntime::get()->getProgram(FILE_PP_PROG, &program))
+    {
+        std::cerr << "Failed to create OpenCL program." << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
+    }
+
+	kernel_lr = clCreateKernel(program, "PP_LRCheck", &errorNumber);
+    bool createKernelsSuccess = checkSuccess(errorNumber);
+	kernel_fill = clCreateKernel(program, "PP_FillInv", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+	kernel_wm = clCreateKernel(program, "PP_WeightedMedian", &errorNumber);
+    createKernelsSuccess &= checkSuccess(errorNumber);
+    if (!createKernelsSuccess)
+    {
+        std::cerr << "Failed to create OpenCL kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
+    }
+    else{
+		printf("PP_cl: OpenCL kernels created.\n");
+    }
+
+	//The weighted median needs a full PP_TILE x PP_TILE work-group
+	size_t maxWorkGroupSize = 0;
+	clGetKernelWorkGroupInfo(kernel_wm, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, NULL);
+	if(maxWorkGroupSize < PP_TILE * PP_TILE)
+	{
+		std::cerr << "PP_cl: Device work-group size (" << maxWorkGroupSize << ") is too small for the "
+				  << PP_TILE << "x" << PP_TILE << " median tiles. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
+	}
+
+	width = I->cols;
+	height = I->rows;
+	bufferSize_2D_8UC1 = width * height * sizeof(cl_uchar);
+
+    globalWorksize_2D[0] = (size_t)width;
+    globalWorksize_2D[1] = (size_t)height;
+    //Rounded up to whole tiles, the kernel skips the out-of-image work-items
+    globalWorksize_tiles[0] = (size_t)((width + PP_TILE - 1) / PP_TILE * PP_TILE);
+    globalWorksize_tiles[1] = (size_t)((height + PP_TILE - 1) / PP_TILE * PP_TILE);
+    localWorksize[0] = (size_t)PP_TILE;
+    localWorksize[1] = (size_t)PP_TILE;
+    //One work-item per row of either map
+    globalWorksize_rows[0] = (size_t)(2 * height);
+
+	bool createMemoryObjectsSuccess = true;
+	lValid = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D_8UC1, &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	rValid = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, bufferSize_2D_8UC1, &errorNumber);
+	createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	for(int i = 0; i < PP_SLOTS; i++)
+	{
+		lOut[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D_8UC1, &errorNumber);
+		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+		rOut[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize_2D_8UC1, &errorNumber);
+		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+		validCount[i] = OCLRuntime::get()->createBuffer(CL_MEM_READ_WRITE, sizeof(cl_int), &errorNumber);
+		createMemoryObjectsSuccess &= checkSuccess(errorNumber);
+	}
+	if (!createMemoryObjectsSuccess)
+	{
+		std::cerr << "Failed to create OpenCL buffers. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return;
+	}
+	usable = true;
+}
+
+PP_cl::~PP_cl(void)
+{
+	OCLRuntime::get()->releaseBuffer(lValid);
+	OCLRuntime::get()->releaseBuffer(rValid);
+	for(int i = 0; i < PP_SLOTS; i++)
+	{
+		finishDM(i);
+		OCLRuntime::get()->releaseBuffer(lOut[i]);
+		OCLRuntime::get()->releaseBuffer(rOut[i]);
+		OCLRuntime::get()->releaseBuffer(validCount[i]);
+	}
+	if(kernel_lr) clReleaseKernel(kernel_lr);
+	if(kernel_fill) clReleaseKernel(kernel_fill);
+	if(kernel_wm) clReleaseKernel(kernel_wm);
+	if(program) clReleaseProgram(program);
+	if(event) clReleaseEvent(event);
+}
+
+int PP_cl::processDM(cl_mem* memoryObjects, Mat& lDisMap, Mat& rDisMap, cl_uint numWaitEvents, const cl_event* waitEvents)
+{
+	if(enqueueDM(memoryObjects, lDisMap, rDisMap, 0, commandQueue, numWaitEvents, waitEvents))
+		return 1;
+	return finishDM(0);
+}
+
+int PP_cl::enqueueDM(cl_mem* memoryObjects, Mat& lDisMap, Mat& rDisMap, int slot, cl_command_queue* readQueue,
+						cl_uint numWaitEvents, const cl_event* waitEvents)
+{
+	if(!usable)
+		return 1;
+	if(slot < 0 || slot >= PP_SLOTS || numReads[slot])
+	{
+		std::cerr << "PP_cl: Slot " << slot << " is not free. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+
+	//Start the chain behind the producers of the disparity maps
+	if(event) clReleaseEvent(event);
+	event = 0;
+	if(numWaitEvents && !checkSuccess(clEnqueueMarkerWithWaitList(*commandQueue, numWaitEvents, waitEvents, &event)))
+	{
+		std::cerr << "Failed enqueuing the marker. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+
+	slotSelective[slot] = selective;
+	if(selective)
+	{
+		//Consistent pixels are kept, inconsistent ones are filled from their neighbours
+		//and then re-estimated by the weighted median
+		cl_event fillEvent;
+		const cl_int zero = 0;
+		if (!checkSuccess(clEnqueueFillBuffer(*commandQueue, validCount[slot], &zero, sizeof(cl_int), 0, sizeof(cl_int),
+												event ? 1 : 0, event ? &event : NULL, &fillEvent)))
+		{
+			std::cerr << "Failed enqueuing the fill. " << __FILE__ << ":"<< __LINE__ << std::endl;
+			return 1;
+		}
+		if(event) clReleaseEvent(event);
+		event = fillEvent;
+
+		int arg_num = 0;
+		bool setKernelArgumentsSuccess = true;
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_lr, arg_num++, sizeof(cl_mem), &memoryObjects[DS_LDM]));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_lr, arg_num++, sizeof(cl_mem), &memoryObjects[DS_RDM]));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_lr, arg_num++, sizeof(cl_int), &width));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_lr, arg_num++, sizeof(cl_mem), &lValid));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_lr, arg_num++, sizeof(cl_mem), &rValid));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_lr, arg_num++, sizeof(cl_mem), &validCount[slot]));
+
+		arg_num = 0;
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_fill, arg_num++, sizeof(cl_mem), &memoryObjects[DS_LDM]));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_fill, arg_num++, sizeof(cl_mem), &memoryObjects[DS_RDM]));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_fill, arg_num++, sizeof(cl_mem), &lValid));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_fill, arg_num++, sizeof(cl_mem), &rValid));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_fill, arg_num++, sizeof(cl_int), &width));
+		setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_fill, arg_num++, sizeof(cl_int), &height));
+		if (!setKernelArgumentsSuccess)
+		{
+			std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		}
+
+		if(enqueueKernel(kernel_lr, 2, globalWorksize_2D, NULL, "left-right check"))
+			return 1;
+		if(enqueueKernel(kernel_fill, 1, globalWorksize_rows, NULL, "invalid pixel filling"))
+			return 1;
+	}
+
+	if(medianView(&memoryObjects[DS_LDM], &memoryObjects[CVC_LIMGR], &memoryObjects[CVC_LIMGG], &memoryObjects[CVC_LIMGB], &lValid, &lOut[slot]))
+		return 1;
+	if(medianView(&memoryObjects[DS_RDM], &memoryObjects[CVC_RIMGR], &memoryObjects[CVC_RIMGG], &memoryObjects[CVC_RIMGB], &rValid, &rOut[slot]))
+		return 1;
+
+	/* Read the final maps back, finishDM is the one point where the host waits for the frame. */
+	cl_event* reads = readEvents[slot];
+	bool EnqueueReadBufferSuccess = true;
+	EnqueueReadBufferSuccess &= checkSuccess(clEnqueueReadBuffer(*readQueue, lOut[slot], CL_FALSE, 0, bufferSize_2D_8UC1, lDisMap.data, 1, &event, &reads[0]));
+	EnqueueReadBufferSuccess &= checkSuccess(clEnqueueReadBuffer(*readQueue, rOut[slot], CL_FALSE, 0, bufferSize_2D_8UC1, rDisMap.data, 1, &event, &reads[1]));
+	numReads[slot] = 2;
+	if(selective)
+	{
+		EnqueueReadBufferSuccess &= checkSuccess(clEnqueueReadBuffer(*readQueue, validCount[slot], CL_FALSE, 0, sizeof(cl_int), &count[slot], 1, &event, &reads[2]));
+		numReads[slot] = 3;
+	}
+	if (!EnqueueReadBufferSuccess)
+	{
+		numReads[slot] = 0;
+		std::cerr << "Reading back the disparity maps failed " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+	//Both queues are flushed so the frame runs while the host carries on
+	clFlush(*commandQueue);
+	if(readQueue != commandQueue)
+		clFlush(*readQueue);
+	return 0;
+}
+
+int PP_cl::finishDM(int slot)
+{
+	if(slot < 0 || slot >= PP_SLOTS || !numReads[slot])
+		return 0;
+
+	bool readSuccess = checkSuccess(clWaitForEvents(numReads[slot], readEvents[slot]));
+	for(cl_uint i = 0; i < numReads[slot]; i++)
+		clReleaseEvent(readEvents[slot][i]);
+	numReads[slot] = 0;
+	if (!readSuccess)
+	{
+		std::cerr << "Reading back the disparity maps failed " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+
+	skipRate = slotSelective[slot] ? (double)count[slot] / (2.0 * width * height) : 0;
+	return 0;
+}
+
+int PP_cl::medianView(cl_mem* dispMap, cl_mem* Ir, cl_mem* Ig, cl_mem* Ib, cl_mem* keep, cl_mem* outMap)
+{
+	const cl_int useKeep = selective ? 1 : 0;
+	const cl_int radius = PP_RMAX;
+	const cl_float divider = 1.0f / (2 * PP_SIG_CLR * PP_SIG_CLR);
+
+	int arg_num = 0;
+    /* Setup the kernel arguments. */
+    bool setKernelArgumentsSuccess = true;
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_mem), dispMap));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_mem), Ir));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_mem), Ig));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_mem), Ib));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_mem), keep));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_int), &useKeep));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_int), &width));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_int), &height));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_int), &radius));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_float), &divider));
+    setKernelArgumentsSuccess &= checkSuccess(clSetKernelArg(kernel_wm, arg_num++, sizeof(cl_mem), outMap));
+    if (!setKernelArgumentsSuccess)
+    {
+        std::cerr << "Failed setting OpenCL kernel arguments. " << __FILE__ << ":"<< __LINE__ << std::endl;
+    }
+
+	return enqueueKernel(kernel_wm, 2, globalWorksize_tiles, localWorksize, "weighted median");
+}
+
+//Chained through events as in CVF_cl::enqueueKernel
+int PP_cl::enqueueKernel(cl_kernel kernel, cl_uint workDim, const size_t *globalworksize, const size_t *localworksize, const char *name)
+{
+    if(OCL_STATS) printf("PP_cl: Running %s Kernels\n", name);
+	cl_event next;
+	/* Enqueue the kernel */
+	if (!checkSuccess(clEnqueueNDRangeKernel(*commandQueue, kernel, workDim, NULL, globalworksize, localworksize,
+												event ? 1 : 0, event ? &event : NULL, &next)))
+	{
+		std::cerr << "Failed enqueuing the kernel. " << __FILE__ << ":"<< __LINE__ << std::endl;
+		return 1;
+	}
+	if(event) clReleaseEvent(event);
+	event = next;
+
+	if(OCL_STATS)
+	{
+		clWaitForEvents(1, &event);
+		printProfilingInfo(event);
+	}
+    return 0;
+}
@@ -30,6 +30,8 @@
 
 #include "StereoCalib.h"
 
+using namespace cv;
+
 int print_help()
 {
     std::cout <<
@@ -7,11 +7,13 @@
   ---------------------------------------------------------------------------*/
 #include "StereoMatch.h"
 
+using namespace cv;
+
 //#############################################################################
 //# SM Preprocessing that we don't want to repeat
 //#############################################################################
 StereoMatch::StereoMatch(int argc, const char *argv[], int gotOpenCLDev) :
-	end_de(false), user_dataset(false), ground_truth_data(false)
+	end_de(false), user_dataset(false), streaming_mode(false), stripe_rows(0), selective_pp(false), double_buffer(false), ground_truth_data(false)
 {
 #ifdef DEBUG_APP
     std::cout << "Stereo Matching for Depth Estimation." << std::endl;
@@ -121,7 +123,7 @@ int StereoMatch::compute(float& de_time_ms)
 	std::cout << "Computing Depth Map" << std::endl;
 #endif // DEBUG_APP
 
-	float start_time = get_rt();
+	double start_time = get_rt();
 	//#########################################################################
 	//# Frame Capture and Preprocessing (that we have to repeat)
 	//#########################################################################
@@ -198,55 +200,32 @@ int StereoMatch::compute(float& de_time_ms)
 		SMDE->setInputImages(lFrame, rFrame);
 		SMDE->setThreads(num_threads);
 		SMDE->setSubsampleRate(subsample_rate);
+		SMDE->setMode(gotOCLDev ? de_mode : OCV_DE);
+		SMDE->setStreamingMode(streaming_mode);
+		SMDE->setStripeRows(stripe_rows);
+		SMDE->setSelectivePP(selective_pp);
+		if(gotOCLDev)
+			SMDE->setDoubleBuffering(double_buffer);
 
 		// ******** Disparity Estimation Code ******** //
 #ifdef DEBUG_APP
 		std::cout <<  "Disparity Estimation Started..." << std::endl;
 #endif // DEBUG_APP
 
-		if(de_mode == OCV_DE || !gotOCLDev)
-		{
-			cvc_time = get_rt();
-			SMDE->CostConst();
-			cvc_time = get_rt() - cvc_time;
-
-			cvf_time = get_rt();
-			SMDE->CostFilter_FGF();
-			cvf_time = get_rt()- cvf_time;
-
-			dispsel_time = get_rt();
-			SMDE->DispSelect_CPU();
-			dispsel_time = get_rt() - dispsel_time;
-
-			pp_time = get_rt();
-			SMDE->PostProcess_CPU();
-			pp_time = get_rt() - pp_time;
-		}
-		else
-		{
-			cvc_time = get_rt();
-			SMDE->CostConst_GPU();
-			cvc_time = get_rt() - cvc_time;
-
-			cvf_time = get_rt();
-			SMDE->CostFilter_GPU();
-			cvf_time = get_rt()- cvf_time;
-
-			dispsel_time = get_rt();
-			SMDE->DispSelect_GPU();
-			dispsel_time = get_rt() - dispsel_time;
-
-			pp_time = get_rt();
-			SMDE->PostProcess_GPU();
-			pp_time = get_rt() - pp_time;
-		}
+		SMDE->compute();
+		DE_Times stage_times = SMDE->getTimes();
+		cvc_time = stage_times.cvc;
+		cvf_time = stage_times.cvf;
+		dispsel_time = stage_times.dispsel;
+		pp_time = stage_times.pp;
+		pp_skip = stage_times.pp_skip;
 #ifdef DEBUG_APP
 		std::cout <<  "Disparity Estimation Complete." << std::endl;
 #endif // DEBUG_APP
 
 		// ******** Display Disparity Maps  ******** //
-		SMDE->lDisMap.convertTo(lDispMap, CV_8U, scale_factor); //scale factor used to compare error with ground truth
-		SMDE->rDisMap.convertTo(rDispMap, CV_8U, scale_factor);
+		SMDE->getLeftDispMap().convertTo(lDispMap, CV_8U, scale_factor); //scale factor used to compare error with ground truth
+		SMDE->getRightDispMap().convertTo(rDispMap, CV_8U, scale_factor);
 
 		cv::cvtColor(lDispMap, leftDispMap, cv::COLOR_GRAY2RGB);
 		cv::cvtColor(lDispMap, rightDispMap, cv::COLOR_GRAY2RGB);
@@ -259,6 +238,8 @@ int StereoMatch::compute(float& de_time_ms)
 		printf("CVF Time:\t %4.2f ms\n",cvf_time/1000);
 		printf("DispSel Time:\t %4.2f ms\n",dispsel_time/1000);
 		printf("PP Time:\t %4.2f ms\n",pp_time/1000);
+		if(selective_pp)
+			printf("PP Skipped:\t %4.1f %% of pixels\n", pp_skip*100);
 #endif //DEBUG_APP_MONITORS
 		frame_count++;
 	}
@@ -396,7 +377,7 @@ int StereoMatch::stereoCameraSetup(void)
 	if(recalibrate)
     {
 #ifndef DISPLAY
-		printf("Display window required for calibration. Please recompile with #define DISPLAY\n");
+		printf("Display window required for calibration. Please reconfigure with -DDISPLAY=ON\n");
 		return -1;
 #endif // DISPLAY
 		update_display();
@@ -723,6 +704,14 @@ int StereoMatch::parse_cli(int argc, const char * argv[])
 
 	args::Options ReqGlobal = args::Options::Required | args::Options::Global;
     args::ValueFlag<std::string> arg_alg_mode(parser, "mode", "The stereo matching algorithm to use. Valid options: {STEREO_SGBM, STEREO_GIF}.", {'a', "alg"}, ReqGlobal);
+    args::Flag arg_streaming(parser, "streaming", "STEREO_GIF on the CPU: filter and select one disparity slice at a time instead of storing the cost volumes.", {"streaming"}, args::Options::Global);
+    args::Flag arg_selective_pp(parser, "selective-pp", "STEREO_GIF: left-right check the disparity maps and only weighted-median filter the inconsistent pixels.", {"selective-pp"}, args::Options::Global);
+    args::Flag arg_double_buffer(parser, "double-buffer", "STEREO_GIF with OpenCL: keep two frames in flight so uploads and readbacks overlap the kernels. The maps lag the input by one frame.", {"double-buffer"}, args::Options::Global);
+    args::ValueFlag<int> arg_stripes(parser, "rows", "STEREO_GIF on the CPU: run construction, filtering and selection per horizontal stripe of this many rows (default " + std::to_string(STRIPE_ROWS) + ").", {"stripes"}, args::Options::Global);
+    args::ValueFlag<int> arg_cl_platform(parser, "index", "OpenCL platform index (default: the first platform).", {"cl-platform"}, args::Options::Global);
+    args::ValueFlag<int> arg_cl_device(parser, "index", "OpenCL device index on the platform (default: the first accelerator, else GPU, else CPU).", {"cl-device"}, args::Options::Global);
+    args::ValueFlag<int> arg_cl_units(parser, "units", "Partition the OpenCL device and run on a sub-device of this many compute units.", {"cl-units"}, args::Options::Global);
+    args::ValueFlag<std::string> arg_cl_affinity(parser, "domain", "Partition the OpenCL device by affinity domain and run on the first sub-device. Valid options: {numa, L4, L3, L2, L1, next}.", {"cl-affinity"}, args::Options::Global);
 
     try {
         parser.ParseCLI(argc, argv);
@@ -747,6 +736,53 @@ int StereoMatch::parse_cli(int argc, const char * argv[])
 		MatchingAlgorithm = STEREO_SGBM;
 		std::cout << "\t Matching Algorithm: STEREO_SGBM" << std::endl;
 	}
+	if(arg_streaming){
+		streaming_mode = true;
+		std::cout << "\t Streaming filter-and-select mode enabled" << std::endl;
+	}
+	if(arg_stripes){
+		stripe_rows = args::get(arg_stripes) > 0 ? args::get(arg_stripes) : STRIPE_ROWS;
+		std::cout << "\t Stripe mode enabled: " << stripe_rows << " rows per stripe" << std::endl;
+	}
+	if(arg_selective_pp){
+		selective_pp = true;
+		std::cout << "\t Selective post-processing enabled" << std::endl;
+	}
+	if(arg_double_buffer){
+		double_buffer = true;
+		std::cout << "\t OpenCL double buffering enabled" << std::endl;
+	}
+
+	OCLDeviceConfig cl_config;
+	if(arg_cl_platform)
+		cl_config.platform = args::get(arg_cl_platform);
+	if(arg_cl_device)
+		cl_config.device = args::get(arg_cl_device);
+	if(arg_cl_units && args::get(arg_cl_units) > 0)
+		cl_config.subUnits = args::get(arg_cl_units);
+	if(arg_cl_affinity){
+		const std::string domain = args::get(arg_cl_affinity);
+		if(domain == "numa")		cl_config.affinity = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+		else if(domain == "L4")		cl_config.affinity = CL_DEVICE_AFFINITY_DOMAIN_L4_CACHE;
+		else if(domain == "L3")		cl_config.affinity = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE;
+		else if(domain == "L2")		cl_config.affinity = CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE;
+		else if(domain == "L1")		cl_config.affinity = CL_DEVICE_AFFINITY_DOMAIN_L1_CACHE;
+		else if(domain == "next")	cl_config.affinity = CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE;
+		else {
+			std::cerr << "Unknown affinity domain: " << domain << std::endl;
+			std::cerr << parser;
+			return -1;
+		}
+	}
+	if(cl_config.platform >= 0 || cl_config.device >= 0 || cl_config.subUnits || cl_config.affinity){
+		std::cout << "\t OpenCL device selection: platform " << cl_config.platform << ", device " << cl_config.device;
+		if(cl_config.subUnits)
+			std::cout << ", sub-device of " << cl_config.subUnits << " compute units";
+		else if(cl_config.affinity)
+			std::cout << ", sub-device by " << args::get(arg_cl_affinity) << " affinity";
+		std::cout << std::endl;
+		OCLRuntime::configure(cl_config);
+	}
 
     return 0;
 }
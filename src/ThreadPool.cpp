@@ -0,0 +1,108 @@
+/*---------------------------------------------------------------------------
+   ThreadPool.cpp - Persistent Worker Thread Pool
+  ---------------------------------------------------------------------------
+   Author: Charles Leech
+   Email: cl19g10 [at] ecs.soton.ac.uk
+   Copyright (c) 2016 Charlie Leech, University of Southampton.
+  ---------------------------------------------------------------------------*/
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int n, bool pin) :
+	nThreads(n ? n : 1), pending(0), stop(false)
+{
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&task_cv, NULL);
+	pthread_cond_init(&done_cv, NULL);
+
+	workers = new pthread_t[nThreads];
+#ifdef __linux__
+	//Only the CPUs the process may run on (taskset, cpusets), in order
+	std::vector<int> cores;
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(pin && !sched_getaffinity(0, sizeof(cpu_set_t), &allowed))
+	{
+		for(int c = 0; c < CPU_SETSIZE; ++c)
+			if(CPU_ISSET(c, &allowed))
+				cores.push_back(c);
+	}
+#endif // __linux__
+	for(unsigned int i = 0; i < nThreads; ++i)
+	{
+		pthread_create(&workers[i], NULL, ThreadPool::worker, (void *)this);
+#ifdef __linux__
+		if(!cores.empty())
+		{
+			int core = cores[i % cores.size()];
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET(core, &cpuset);
+			pthread_setaffinity_np(workers[i], sizeof(cpu_set_t), &cpuset);	//best effort, an unpinned worker still runs
+		}
+#endif // __linux__
+	}
+}
+
+ThreadPool::~ThreadPool(void)
+{
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&task_cv);
+	pthread_mutex_unlock(&lock);
+
+	for(unsigned int i = 0; i < nThreads; ++i)
+		pthread_join(workers[i], NULL);
+	delete [] workers;
+
+	pthread_cond_destroy(&done_cv);
+	pthread_cond_destroy(&task_cv);
+	pthread_mutex_destroy(&lock);
+}
+
+int ThreadPool::submit(void *(*func)(void *), void *arg)
+{
+	TP_Task task = {func, arg};
+
+	pthread_mutex_lock(&lock);
+	tasks.push_back(task);
+	pending++;
+	pthread_cond_signal(&task_cv);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+//Block until every submitted task has completed
+int ThreadPool::wait(void)
+{
+	pthread_mutex_lock(&lock);
+	while(pending)
+		pthread_cond_wait(&done_cv, &lock);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+void *ThreadPool::worker(void *thread_arg)
+{
+	ThreadPool* pool = (ThreadPool *)thread_arg;
+
+	pthread_mutex_lock(&pool->lock);
+	while(true)
+	{
+		while(pool->tasks.empty() && !pool->stop)
+			pthread_cond_wait(&pool->task_cv, &pool->lock);
+		if(pool->tasks.empty())
+			break;
+
+		TP_Task task = pool->tasks.front();
+		pool->tasks.pop_front();
+		pthread_mutex_unlock(&pool->lock);
+
+		task.func(task.arg);
+
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->pending == 0)
+			pthread_cond_broadcast(&pool->done_cv);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return (void*)0;
+}
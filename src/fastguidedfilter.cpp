@@ -1,38 +1,70 @@
 // Source: https://github.com/Sundrops/fast-guided-filter
 // Literature: https://arxiv.org/pdf/1505.00996.pdf
 #include "fastguidedfilter.h"
+#include <opencv2/imgproc.hpp>
 
-static cv::Mat boxfilter(const cv::Mat &I, int r)
+using namespace cv;
+
+static void boxfilter(const cv::Mat &I, cv::Mat &result, int r)
 {
-    cv::Mat result;
     cv::blur(I, result, cv::Size(r, r));
-    return result;
 }
 
-static cv::Mat convertTo(const cv::Mat &mat, int depth)
+// dst = boxfilter(a.*b) - mean_a.*mean_b + e, t is scratch
+static void covariance(const cv::Mat &a, const cv::Mat &b, const cv::Mat &mean_a, const cv::Mat &mean_b,
+                       double e, int r, cv::Mat &t, cv::Mat &dst)
 {
-    if (mat.depth() == depth)
-        return mat;
+    cv::multiply(a, b, t);
+    boxfilter(t, dst, r);
+    cv::multiply(mean_a, mean_b, t);
+    cv::subtract(dst, t, dst);
+    if (e != 0)
+        cv::add(dst, cv::Scalar::all(e), dst);
+}
 
-    cv::Mat result;
-    mat.convertTo(result, depth);
-    return result;
+// dst = a.*b - c.*d, t is scratch
+static void mulSub(const cv::Mat &a, const cv::Mat &b, const cv::Mat &c, const cv::Mat &d, cv::Mat &t, cv::Mat &dst)
+{
+    cv::multiply(a, b, dst);
+    cv::multiply(c, d, t);
+    cv::subtract(dst, t, dst);
 }
 
+enum { COEF_A = 8, COEF_B = 11 };
+
 class FastGuidedFilterImpl
 {
 public:
     FastGuidedFilterImpl(int r, double eps,int s):r(r),eps(eps),s(s){}
     virtual ~FastGuidedFilterImpl() {}
 
-    cv::Mat filter(const cv::Mat &p, int depth);
+    virtual void init(const cv::Mat &I) = 0;
+    virtual int channels() const = 0;
+
+    void filter(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws, int depth);
+    void filterSubsampled(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws);
+    void filterSubsampledFold(const cv::Mat &p, int d, cv::Mat &minCost, cv::Mat &dispMap,
+                              FastGuidedFilterWorkspace &ws, int rowStart, int rowEnd);
 
 protected:
     int Idepth,r,s;
     double eps;
 
+    // Bilinear sampling positions of the full resolution grid in the subsampled one
+    void initLinearMaps(cv::Size lo, cv::Size hi);
+
 private:
-    virtual cv::Mat filterSingleChannel(const cv::Mat &p) const = 0;
+    std::vector<int> xofs, yofs;
+    std::vector<float> xalpha, yalpha;
+
+    // p is the subsampled input, the box-filtered coefficients are left in
+    // ws.lo[COEF_A + c] (one per guide channel) and ws.lo[COEF_B]
+    virtual void coefficients(const cv::Mat &p, FastGuidedFilterWorkspace &ws) const = 0;
+    // Full resolution guide channel c
+    virtual const cv::Mat &guide(int c) const = 0;
+
+    // dst receives the full resolution output
+    void filterSingleChannel(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws) const;
 };
 
 class FastGuidedFilterMono : public FastGuidedFilterImpl
@@ -40,12 +72,17 @@ class FastGuidedFilterMono : public FastGuidedFilterImpl
 public:
     FastGuidedFilterMono(const cv::Mat &I, int r, double eps,int s);
 
+    virtual void init(const cv::Mat &I);
+    virtual int channels() const { return 1; }
+
 private:
-    virtual cv::Mat filterSingleChannel(const cv::Mat &p) const;
+    virtual void coefficients(const cv::Mat &p, FastGuidedFilterWorkspace &ws) const;
+    virtual const cv::Mat &guide(int c) const { return origI; }
 
 private:
 
-    cv::Mat I,origI, mean_I, var_I;
+    cv::Mat I,origI, mean_I, mean_II, var_I, var_I_eps;
+    cv::Mat tmp; // scratch of init()
 };
 
 class FastGuidedFilterColor : public FastGuidedFilterImpl
@@ -53,169 +90,401 @@ class FastGuidedFilterColor : public FastGuidedFilterImpl
 public:
     FastGuidedFilterColor(const cv::Mat &I, int r, double eps,int s);
 
+    virtual void init(const cv::Mat &I);
+    virtual int channels() const { return 3; }
+
 private:
-    virtual cv::Mat filterSingleChannel(const cv::Mat &p) const;
+    virtual void coefficients(const cv::Mat &p, FastGuidedFilterWorkspace &ws) const;
+    virtual const cv::Mat &guide(int c) const { return origIchannels[c]; }
 
 private:
     std::vector<cv::Mat> origIchannels,Ichannels;
-    cv::Mat mean_I_r, mean_I_g, mean_I_b;
+    cv::Mat origI, I, mean_I_r, mean_I_g, mean_I_b;
+    cv::Mat var_I_rr, var_I_rg, var_I_rb, var_I_gg, var_I_gb, var_I_bb, covDet;
     cv::Mat invrr, invrg, invrb, invgg, invgb, invbb;
+    cv::Mat tmp; // scratch of init()
 };
 
 
-cv::Mat FastGuidedFilterImpl::filter(const cv::Mat &p, int depth)
+void FastGuidedFilterImpl::filter(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws, int depth)
 {
-    cv::Mat p2 = convertTo(p, Idepth);
-    cv::resize(p2 ,p2,cv::Size(p2.cols/s,p2.rows/s),0,0,CV_INTER_NN);
-    cv::Mat result;
+    const cv::Mat *p2 = &p;
+    if (p.depth() != Idepth)
+    {
+        p.convertTo(ws.in, Idepth);
+        p2 = &ws.in;
+    }
+    cv::resize(*p2 ,ws.p,cv::Size(p2->cols/s,p2->rows/s),0,0,CV_INTER_NN);
+
+    depth = depth == -1 ? p.depth() : depth;
     if (p.channels() == 1)
     {
-        result = filterSingleChannel(p2);
+        if (depth == Idepth)
+            filterSingleChannel(ws.p, dst, ws);
+        else
+        {
+            filterSingleChannel(ws.p, ws.in, ws);
+            ws.in.convertTo(dst, depth);
+        }
     }
     else
     {
         std::vector<cv::Mat> pc;
-        cv::split(p2, pc);
+        cv::split(ws.p, pc);
 
         for (std::size_t i = 0; i < pc.size(); ++i)
-            pc[i] = filterSingleChannel(pc[i]);
+        {
+            cv::Mat q;
+            filterSingleChannel(pc[i], q, ws);
+            pc[i] = q;
+        }
 
+        cv::Mat result;
         cv::merge(pc, result);
+        result.convertTo(dst, depth);
+    }
+}
+
+void FastGuidedFilterImpl::filterSubsampled(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws)
+{
+    CV_Assert(p.channels() == 1);
+
+    if (p.depth() == Idepth)
+        filterSingleChannel(p, dst, ws);
+    else
+    {
+        p.convertTo(ws.p, Idepth);
+        filterSingleChannel(ws.p, ws.in, ws);
+        ws.in.convertTo(dst, p.depth());
     }
+}
 
-    return convertTo(result, depth == -1 ? p.depth() : depth);
+void FastGuidedFilterImpl::filterSingleChannel(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws) const
+{
+    const int n = channels();
+    const cv::Mat &I0 = guide(0);
+    cv::Size size(I0.cols, I0.rows);
+    cv::Mat *up = &ws.hi[0];      // a_0 .. a_n-1, b
+    cv::Mat &th = ws.hi[4];
+
+    coefficients(p, ws);
+    for (int c = 0; c < n; ++c)
+        cv::resize(ws.lo[COEF_A + c], up[c], size, 0, 0, CV_INTER_LINEAR);
+    cv::resize(ws.lo[COEF_B], up[n], size, 0, 0, CV_INTER_LINEAR);
+
+    cv::multiply(up[0], I0, dst);
+    for (int c = 1; c < n; ++c)
+    {
+        cv::multiply(up[c], guide(c), th);
+        cv::add(dst, th, dst);
+    }
+    cv::add(dst, up[n], dst);
+}
+
+// Same source positions and weights as cv::resize INTER_LINEAR
+void FastGuidedFilterImpl::initLinearMaps(cv::Size lo, cv::Size hi)
+{
+    double scale_x = 1. / ((double)hi.width / lo.width);
+    double scale_y = 1. / ((double)hi.height / lo.height);
+
+    xofs.resize(hi.width);
+    xalpha.resize(hi.width);
+    for (int x = 0; x < hi.width; ++x)
+    {
+        float fx = (float)((x + 0.5) * scale_x - 0.5);
+        int sx = cvFloor(fx);
+        fx -= sx;
+        if (sx < 0)
+            fx = 0, sx = 0;
+        if (sx >= lo.width - 1)
+            fx = 0, sx = lo.width - 1;
+        xofs[x] = sx;
+        xalpha[x] = fx;
+    }
+
+    yofs.resize(hi.height);
+    yalpha.resize(hi.height);
+    for (int y = 0; y < hi.height; ++y)
+    {
+        float fy = (float)((y + 0.5) * scale_y - 0.5);
+        int sy = cvFloor(fy);
+        fy -= sy;
+        if (sy < 0)
+            fy = 0, sy = 0;
+        if (sy >= lo.height - 1)
+            fy = 0, sy = lo.height - 1;
+        yofs[y] = sy;
+        yalpha[y] = fy;
+    }
+}
+
+// Upsample the coefficients, evaluate q = a.I + b and fold q into the running
+// min/argmin one row at a time, without materialising q or the upsampled maps
+void FastGuidedFilterImpl::filterSubsampledFold(const cv::Mat &p, int d, cv::Mat &minCost, cv::Mat &dispMap,
+                                                FastGuidedFilterWorkspace &ws, int rowStart, int rowEnd)
+{
+    CV_Assert(p.channels() == 1 && Idepth == CV_32F);
+
+    if (p.depth() == Idepth)
+        coefficients(p, ws);
+    else
+    {
+        p.convertTo(ws.p, Idepth);
+        coefficients(ws.p, ws);
+    }
+
+    const int n = channels();
+    const cv::Mat *coef[4];
+    for (int c = 0; c < n; ++c)
+        coef[c] = &ws.lo[COEF_A + c];
+    coef[n] = &ws.lo[COEF_B];
+
+    const int lw = coef[0]->cols, lh = coef[0]->rows;
+    const int wid = guide(0).cols;
+    ws.row.create(1, (n + 1) * lw, CV_32F);
+    float *rows = ws.row.ptr<float>(0);
+
+    for (int y = rowStart; y < rowEnd; ++y)
+    {
+        // Vertical pass on the subsampled coefficient rows
+        int sy = yofs[y], sy1 = std::min(sy + 1, lh - 1);
+        float by = yalpha[y], by0 = 1.f - by;
+        for (int k = 0; k <= n; ++k)
+        {
+            const float *r0 = coef[k]->ptr<float>(sy), *r1 = coef[k]->ptr<float>(sy1);
+            float *o = rows + k * lw;
+            for (int i = 0; i < lw; ++i)
+                o[i] = r0[i] * by0 + r1[i] * by;
+        }
+
+        // Horizontal pass, evaluation and selection
+        const float *I[3];
+        for (int c = 0; c < n; ++c)
+            I[c] = guide(c).ptr<float>(y);
+        const float *rb = rows + n * lw;
+        float *minData = minCost.ptr<float>(y - rowStart);
+        uchar *dispData = dispMap.ptr<uchar>(y - rowStart);
+
+        for (int x = 0; x < wid; ++x)
+        {
+            int sx = xofs[x], sx1 = std::min(sx + 1, lw - 1);
+            float ax = xalpha[x], ax0 = 1.f - ax;
+
+            float q = (rows[sx] * ax0 + rows[sx1] * ax) * I[0][x];
+            for (int c = 1; c < n; ++c)
+            {
+                const float *ra = rows + c * lw;
+                q += (ra[sx] * ax0 + ra[sx1] * ax) * I[c][x];
+            }
+            q += rb[sx] * ax0 + rb[sx1] * ax;
+
+            if (q < minData[x])
+            {
+                minData[x] = q;
+                dispData[x] = (uchar)d;
+            }
+        }
+    }
 }
 
 FastGuidedFilterMono::FastGuidedFilterMono(const cv::Mat &origI, int r, double eps,int s):FastGuidedFilterImpl(r,eps,s)
 {
+    init(origI);
+}
 
+void FastGuidedFilterMono::init(const cv::Mat &origI)
+{
     if (origI.depth() == CV_32F || origI.depth() == CV_64F)
-        this->origI = origI.clone();
+        origI.copyTo(this->origI);
     else
-        this->origI = convertTo(origI, CV_32F);
+        origI.convertTo(this->origI, CV_32F);
     cv::resize(this->origI ,I,cv::Size(this->origI.cols/s,this->origI.rows/s),0,0,CV_INTER_NN);
     Idepth = I.depth();
 
-    mean_I = boxfilter(I, r);
-    cv::Mat mean_II = boxfilter(I.mul(I), r);
-    var_I = mean_II - mean_I.mul(mean_I);
+    // Written into the existing matrices, so a guide of the same size allocates nothing
+    boxfilter(I, mean_I, r);
+    cv::multiply(I, I, tmp);
+    boxfilter(tmp, mean_II, r);
+    cv::multiply(mean_I, mean_I, tmp);
+    cv::subtract(mean_II, tmp, var_I);
+    cv::add(var_I, cv::Scalar::all(eps), var_I_eps);
+
+    initLinearMaps(I.size(), this->origI.size());
 }
 
-cv::Mat FastGuidedFilterMono::filterSingleChannel(const cv::Mat &p) const
+void FastGuidedFilterMono::coefficients(const cv::Mat &p, FastGuidedFilterWorkspace &ws) const
 {
-
-    cv::Mat mean_p = boxfilter(p, r);
-    cv::Mat mean_Ip = boxfilter(I.mul(p), r);
-    cv::Mat cov_Ip = mean_Ip - mean_I.mul(mean_p); // this is the covariance of (I, p) in each local patch.
-
-    cv::Mat a = cov_Ip / (var_I + eps);
-    cv::Mat b = mean_p - a.mul(mean_I);
-
-    cv::Mat mean_a = boxfilter(a, r);
-    cv::Mat mean_b = boxfilter(b, r);
-    cv::resize(mean_a ,mean_a,cv::Size(origI.cols,origI.rows),0,0,CV_INTER_LINEAR);
-    cv::resize(mean_b ,mean_b,cv::Size(origI.cols,origI.rows),0,0,CV_INTER_LINEAR);
-    return mean_a.mul(origI) + mean_b;
+    cv::Mat &mean_p = ws.lo[0], &cov_Ip = ws.lo[1], &a = ws.lo[2], &b = ws.lo[3];
+    cv::Mat &t = ws.lo[6];
+    cv::Mat &mean_a = ws.lo[COEF_A], &mean_b = ws.lo[COEF_B];
+
+    boxfilter(p, mean_p, r);
+    cv::multiply(I, p, t);
+    boxfilter(t, cov_Ip, r);
+    cv::multiply(mean_I, mean_p, t);
+    cv::subtract(cov_Ip, t, cov_Ip); // this is the covariance of (I, p) in each local patch.
+
+    cv::divide(cov_Ip, var_I_eps, a);
+    cv::multiply(a, mean_I, t);
+    cv::subtract(mean_p, t, b);
+
+    boxfilter(a, mean_a, r);
+    boxfilter(b, mean_b, r);
 }
 
 FastGuidedFilterColor::FastGuidedFilterColor(const cv::Mat &origI, int r, double eps, int s):FastGuidedFilterImpl(r,eps,s)// : r(r), eps(eps)
 {
+    init(origI);
+}
 
-    cv::Mat I;
+void FastGuidedFilterColor::init(const cv::Mat &origI)
+{
     if (origI.depth() == CV_32F || origI.depth() == CV_64F)
-        I = origI.clone();
+        origI.copyTo(this->origI);
     else
-        I = convertTo(origI, CV_32F);
-    Idepth = I.depth();
+        origI.convertTo(this->origI, CV_32F);
+    Idepth = this->origI.depth();
 
-    cv::split(I, origIchannels);
-    cv::resize(I,I,cv::Size(I.cols/s,I.rows/s),0,0,CV_INTER_NN);
+    cv::split(this->origI, origIchannels);
+    cv::resize(this->origI,I,cv::Size(this->origI.cols/s,this->origI.rows/s),0,0,CV_INTER_NN);
     cv::split(I, Ichannels);
 
-    mean_I_r = boxfilter(Ichannels[0], r);
-    mean_I_g = boxfilter(Ichannels[1], r);
-    mean_I_b = boxfilter(Ichannels[2], r);
+    boxfilter(Ichannels[0], mean_I_r, r);
+    boxfilter(Ichannels[1], mean_I_g, r);
+    boxfilter(Ichannels[2], mean_I_b, r);
 
     // variance of I in each local patch: the matrix Sigma.
     // Note the variance in each local patch is a 3x3 symmetric matrix:
     //           rr, rg, rb
     //   Sigma = rg, gg, gb
     //           rb, gb, bb
-    cv::Mat var_I_rr = boxfilter(Ichannels[0].mul(Ichannels[0]), r) - mean_I_r.mul(mean_I_r) + eps;
-    cv::Mat var_I_rg = boxfilter(Ichannels[0].mul(Ichannels[1]), r) - mean_I_r.mul(mean_I_g);
-    cv::Mat var_I_rb = boxfilter(Ichannels[0].mul(Ichannels[2]), r) - mean_I_r.mul(mean_I_b);
-    cv::Mat var_I_gg = boxfilter(Ichannels[1].mul(Ichannels[1]), r) - mean_I_g.mul(mean_I_g) + eps;
-    cv::Mat var_I_gb = boxfilter(Ichannels[1].mul(Ichannels[2]), r) - mean_I_g.mul(mean_I_b);
-    cv::Mat var_I_bb = boxfilter(Ichannels[2].mul(Ichannels[2]), r) - mean_I_b.mul(mean_I_b) + eps;
+    // All written into the existing matrices, so a guide of the same size allocates nothing
+    covariance(Ichannels[0], Ichannels[0], mean_I_r, mean_I_r, eps, r, tmp, var_I_rr);
+    covariance(Ichannels[0], Ichannels[1], mean_I_r, mean_I_g, 0, r, tmp, var_I_rg);
+    covariance(Ichannels[0], Ichannels[2], mean_I_r, mean_I_b, 0, r, tmp, var_I_rb);
+    covariance(Ichannels[1], Ichannels[1], mean_I_g, mean_I_g, eps, r, tmp, var_I_gg);
+    covariance(Ichannels[1], Ichannels[2], mean_I_g, mean_I_b, 0, r, tmp, var_I_gb);
+    covariance(Ichannels[2], Ichannels[2], mean_I_b, mean_I_b, eps, r, tmp, var_I_bb);
 
     // Inverse of Sigma + eps * I
-    invrr = var_I_gg.mul(var_I_bb) - var_I_gb.mul(var_I_gb);
-    invrg = var_I_gb.mul(var_I_rb) - var_I_rg.mul(var_I_bb);
-    invrb = var_I_rg.mul(var_I_gb) - var_I_gg.mul(var_I_rb);
-    invgg = var_I_rr.mul(var_I_bb) - var_I_rb.mul(var_I_rb);
-    invgb = var_I_rb.mul(var_I_rg) - var_I_rr.mul(var_I_gb);
-    invbb = var_I_rr.mul(var_I_gg) - var_I_rg.mul(var_I_rg);
-
-    cv::Mat covDet = invrr.mul(var_I_rr) + invrg.mul(var_I_rg) + invrb.mul(var_I_rb);
-
-    invrr /= covDet;
-    invrg /= covDet;
-    invrb /= covDet;
-    invgg /= covDet;
-    invgb /= covDet;
-    invbb /= covDet;
+    mulSub(var_I_gg, var_I_bb, var_I_gb, var_I_gb, tmp, invrr);
+    mulSub(var_I_gb, var_I_rb, var_I_rg, var_I_bb, tmp, invrg);
+    mulSub(var_I_rg, var_I_gb, var_I_gg, var_I_rb, tmp, invrb);
+    mulSub(var_I_rr, var_I_bb, var_I_rb, var_I_rb, tmp, invgg);
+    mulSub(var_I_rb, var_I_rg, var_I_rr, var_I_gb, tmp, invgb);
+    mulSub(var_I_rr, var_I_gg, var_I_rg, var_I_rg, tmp, invbb);
+
+    cv::multiply(invrr, var_I_rr, covDet);
+    cv::multiply(invrg, var_I_rg, tmp);
+    cv::add(covDet, tmp, covDet);
+    cv::multiply(invrb, var_I_rb, tmp);
+    cv::add(covDet, tmp, covDet);
+
+    cv::divide(invrr, covDet, invrr);
+    cv::divide(invrg, covDet, invrg);
+    cv::divide(invrb, covDet, invrb);
+    cv::divide(invgg, covDet, invgg);
+    cv::divide(invgb, covDet, invgb);
+    cv::divide(invbb, covDet, invbb);
+
+    initLinearMaps(I.size(), this->origI.size());
 }
 
-cv::Mat FastGuidedFilterColor::filterSingleChannel(const cv::Mat &p) const
+void FastGuidedFilterColor::coefficients(const cv::Mat &p, FastGuidedFilterWorkspace &ws) const
 {
-    cv::Mat mean_p = boxfilter(p, r);
-
-    cv::Mat mean_Ip_r = boxfilter(Ichannels[0].mul(p), r);
-    cv::Mat mean_Ip_g = boxfilter(Ichannels[1].mul(p), r);
-    cv::Mat mean_Ip_b = boxfilter(Ichannels[2].mul(p), r);
+    cv::Mat &mean_p = ws.lo[0];
+    cv::Mat *cov_Ip = &ws.lo[1];  // r, g, b
+    cv::Mat *a = &ws.lo[4];       // r, g, b
+    cv::Mat &b = ws.lo[7];
+    cv::Mat *mean_a = &ws.lo[COEF_A];  // r, g, b
+    cv::Mat &mean_b = ws.lo[COEF_B];
+    cv::Mat &t = ws.lo[12], &t2 = ws.lo[13];
+    const cv::Mat *mean_I[3] = {&mean_I_r, &mean_I_g, &mean_I_b};
+    const cv::Mat *inv[3][3] = {{&invrr, &invrg, &invrb}, {&invrg, &invgg, &invgb}, {&invrb, &invgb, &invbb}};
+
+    boxfilter(p, mean_p, r);
 
     // covariance of (I, p) in each local patch.
-    cv::Mat cov_Ip_r = mean_Ip_r - mean_I_r.mul(mean_p);
-    cv::Mat cov_Ip_g = mean_Ip_g - mean_I_g.mul(mean_p);
-    cv::Mat cov_Ip_b = mean_Ip_b - mean_I_b.mul(mean_p);
-
-    cv::Mat a_r = invrr.mul(cov_Ip_r) + invrg.mul(cov_Ip_g) + invrb.mul(cov_Ip_b);
-    cv::Mat a_g = invrg.mul(cov_Ip_r) + invgg.mul(cov_Ip_g) + invgb.mul(cov_Ip_b);
-    cv::Mat a_b = invrb.mul(cov_Ip_r) + invgb.mul(cov_Ip_g) + invbb.mul(cov_Ip_b);
+    for (int c = 0; c < 3; ++c)
+    {
+        cv::multiply(Ichannels[c], p, t);
+        boxfilter(t, cov_Ip[c], r);
+        cv::multiply(*mean_I[c], mean_p, t);
+        cv::subtract(cov_Ip[c], t, cov_Ip[c]);
+    }
 
-    cv::Mat b = mean_p - a_r.mul(mean_I_r) - a_g.mul(mean_I_g) - a_b.mul(mean_I_b);
+    for (int c = 0; c < 3; ++c)
+    {
+        cv::multiply(*inv[c][0], cov_Ip[0], t);
+        cv::multiply(*inv[c][1], cov_Ip[1], t2);
+        cv::add(t, t2, a[c]);
+        cv::multiply(*inv[c][2], cov_Ip[2], t2);
+        cv::add(a[c], t2, a[c]);
+    }
 
-    cv::Mat mean_a_r = boxfilter(a_r, r);
-    cv::Mat mean_a_g = boxfilter(a_g, r);
-    cv::Mat mean_a_b = boxfilter(a_b, r);
-    cv::Mat mean_b = boxfilter(b, r);
-    cv::resize(mean_a_r ,mean_a_r,cv::Size(origIchannels[0].cols,origIchannels[0].rows),0,0,CV_INTER_LINEAR);
-    cv::resize(mean_a_g ,mean_a_g,cv::Size(origIchannels[1].cols,origIchannels[1].rows),0,0,CV_INTER_LINEAR);
-    cv::resize(mean_a_b ,mean_a_b,cv::Size(origIchannels[2].cols,origIchannels[2].rows),0,0,CV_INTER_LINEAR);
-    cv::resize(mean_b,mean_b,cv::Size(origIchannels[2].cols,origIchannels[2].rows),0,0,CV_INTER_LINEAR);
-    return (mean_a_r.mul(origIchannels[0]) +mean_a_g.mul(origIchannels[1]) +mean_a_b.mul(origIchannels[2]) + mean_b);
+    cv::multiply(a[0], mean_I_r, t);
+    cv::subtract(mean_p, t, b);
+    cv::multiply(a[1], mean_I_g, t);
+    cv::subtract(b, t, b);
+    cv::multiply(a[2], mean_I_b, t);
+    cv::subtract(b, t, b);
 
+    for (int c = 0; c < 3; ++c)
+        boxfilter(a[c], mean_a[c], r);
+    boxfilter(b, mean_b, r);
 }
 
 
 FastGuidedFilter::FastGuidedFilter(const cv::Mat &I, int r, double eps,int s)
+    : impl_(NULL), r_(r), s_(s), eps_(eps)
+{
+    setGuide(I);
+}
+
+FastGuidedFilter::~FastGuidedFilter()
+{
+    delete impl_;
+}
+
+void FastGuidedFilter::setGuide(const cv::Mat &I)
 {
     CV_Assert(I.channels() == 1 || I.channels() == 3);
 
+    if (impl_ != NULL && impl_->channels() == I.channels())
+    {
+        impl_->init(I);
+        return;
+    }
+
+    delete impl_;
     if (I.channels() == 1)
-        impl_ = new FastGuidedFilterMono(I, 2 * (r/s) + 1, eps,s);
+        impl_ = new FastGuidedFilterMono(I, 2 * (r_/s_) + 1, eps_,s_);
     else
-        impl_ = new FastGuidedFilterColor(I, 2 * (r/s) + 1, eps,s);
+        impl_ = new FastGuidedFilterColor(I, 2 * (r_/s_) + 1, eps_,s_);
 }
 
-FastGuidedFilter::~FastGuidedFilter()
+cv::Mat FastGuidedFilter::filter(const cv::Mat &p, int depth) const
 {
-    delete impl_;
+    FastGuidedFilterWorkspace ws;
+    cv::Mat result;
+    impl_->filter(p, result, ws, depth);
+    return result;
 }
 
-cv::Mat FastGuidedFilter::filter(const cv::Mat &p, int depth) const
+void FastGuidedFilter::filter(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws, int depth) const
+{
+    impl_->filter(p, dst, ws, depth);
+}
+
+void FastGuidedFilter::filterSubsampled(const cv::Mat &p, cv::Mat &dst, FastGuidedFilterWorkspace &ws) const
+{
+    impl_->filterSubsampled(p, dst, ws);
+}
+
+void FastGuidedFilter::filterSubsampledFold(const cv::Mat &p, int d, cv::Mat &minCost, cv::Mat &dispMap,
+                                            FastGuidedFilterWorkspace &ws, int rowStart, int rowEnd) const
 {
-    return impl_->filter(p, depth);
+    impl_->filterSubsampledFold(p, d, minCost, dispMap, ws, rowStart, rowEnd < 0 ? minCost.rows + rowStart : rowEnd);
 }
 
 cv::Mat fastGuidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int s,int depth)
@@ -7,11 +7,14 @@
   ---------------------------------------------------------------------------*/
 #include "ComFunc.h"
 #include "oclUtil.h"
+#include "OCLRuntime.h"
 #include "StereoMatch.h"
 #include <chrono>
 #include <thread>
 #include <opencv2/highgui.hpp>
 
+using namespace cv;
+
 //Functions in main
 void getDepthMap(StereoMatch *sm);
 void HCI(StereoMatch *sm);
@@ -28,7 +31,7 @@ int main(int argc, const char* argv[])
     //#############################################################################################################
 	nOpenCLDev = openCLdevicepoll();
 #ifdef DISPLAY
-	namedWindow("InputOutput", CV_WINDOW_AUTOSIZE);
+	namedWindow("InputOutput", WINDOW_AUTOSIZE);
 #endif
 	//#############################################################################################################
     //# Start Application Processes
@@ -57,6 +60,7 @@ int main(int argc, const char* argv[])
     de_thread.join();
 
 	delete sm;
+	OCLRuntime::release();
 	printf("MAIN: Disparity Estimation Halted\n");
     return 0;
 }
@@ -14,6 +14,10 @@
    Email: cl19g10 [at] ecs.soton.ac.uk
   ---------------------------------------------------------------------------*/
 #include "oclUtil.h"
+#include <vector>
+#include <iterator>
+#include <errno.h>
+#include <sys/stat.h>
 
 int openCLdevicepoll(void)
 {
@@ -46,6 +50,13 @@ int openCLdevicepoll(void)
 
     for (int i = 0; i < (int)platformCount; i++) {
 
+        // print platform name
+        clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, 0, NULL, &valueSize);
+        value = (char*) malloc(valueSize);
+        clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, valueSize, value, NULL);
+        printf("Platform %d: %s\n", i, value);
+        free(value);
+
         // get all devices
         clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, NULL, &deviceCount);
         devices = (cl_device_id*) malloc(sizeof(cl_device_id) * deviceCount);
@@ -266,14 +277,37 @@ bool cleanUpOpenCL(cl_context context, cl_command_queue commandQueue, cl_program
     return returnValue;
 }
 
+static std::string deviceInfoString(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    if (clGetDeviceInfo(device, param, 0, NULL, &size) != CL_SUCCESS || !size)
+        return "";
+    std::string value(size, '\0');
+    clGetDeviceInfo(device, param, size, &value[0], NULL);
+    return value;
+}
+
+static std::string platformInfoString(cl_platform_id platform, cl_platform_info param)
+{
+    size_t size = 0;
+    if (clGetPlatformInfo(platform, param, 0, NULL, &size) != CL_SUCCESS || !size)
+        return "";
+    std::string value(size - 1, '\0');
+    clGetPlatformInfo(platform, param, size, &value[0], NULL);
+    return value;
+}
+
 bool createContext(cl_context* context)
+{
+    return createContext(context, OCLDeviceConfig());
+}
+
+bool createContext(cl_context* context, const OCLDeviceConfig& config)
 {
     cl_int errorNumber = 0;
     cl_uint numberOfPlatforms = 0;
-    cl_platform_id firstPlatformID = 0;
 
-    /* Retrieve a single platform ID. */
-    if (!checkSuccess(clGetPlatformIDs(1, &firstPlatformID, &numberOfPlatforms)))
+    if (!checkSuccess(clGetPlatformIDs(0, NULL, &numberOfPlatforms)))
     {
         std::cerr << "Retrieving OpenCL platforms failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
         return false;
@@ -285,9 +319,16 @@ bool createContext(cl_context* context)
         return false;
     }
 
-	cl_uint deviceCount;
-	// get all devices
-	clGetDeviceIDs(firstPlatformID, CL_DEVICE_TYPE_ALL, 0, NULL, &deviceCount);
+    if (config.platform >= (int)numberOfPlatforms)
+    {
+        std::cerr << "OpenCL platform " << config.platform << " requested but only " << numberOfPlatforms << " found. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return false;
+    }
+
+    std::vector<cl_platform_id> platforms(numberOfPlatforms);
+    clGetPlatformIDs(numberOfPlatforms, &platforms[0], NULL);
+    cl_platform_id platformID = platforms[config.platform < 0 ? 0 : config.platform];
+    printf("OpenCL platform: %s\n", platformInfoString(platformID, CL_PLATFORM_NAME).c_str());
 
 	struct {cl_device_type type; const char* name; cl_uint dcount; } devices[] =
 	{
@@ -301,7 +342,7 @@ bool createContext(cl_context* context)
 	printf("Number of devices available of each type:\n");
 	for(int i = 0; i < NUM_OF_DEVICE_TYPES; ++i)
 	{
-		errorNumber = clGetDeviceIDs(firstPlatformID, devices[i].type, 0, 0, &devices[i].dcount);
+		errorNumber = clGetDeviceIDs(platformID, devices[i].type, 0, 0, &devices[i].dcount);
 		if(CL_DEVICE_NOT_FOUND == errorNumber)
 		{
 			devices[i].dcount = 0;
@@ -310,84 +351,107 @@ bool createContext(cl_context* context)
 		printf("\t%s: %d\n", devices[i].name, devices[i].dcount);
 	}
 
-    /* Get a context with a device from the platform found above. */
-    cl_context_properties contextProperties [] = {CL_CONTEXT_PLATFORM, (cl_context_properties)firstPlatformID, 0};
-    if(devices[NUM_OF_DEVICE_TYPES-1].dcount > 0) //choose Accelerator as first preference if present
-		*context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_ACCELERATOR, context_notify, NULL, &errorNumber);
-    else if(devices[NUM_OF_DEVICE_TYPES-2].dcount > 0) //choose GPU as second preference if present
-		*context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_GPU, context_notify, NULL, &errorNumber);
-	else //choose CPU as last preference
-		*context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_CPU, context_notify, NULL, &errorNumber);
-    if (!checkSuccess(errorNumber))
+    /* Pick the requested device, else the first of the preferred type: Accelerator > GPU > CPU. */
+    cl_device_id deviceID = 0;
+    if (config.device >= 0)
     {
-        std::cerr << "Creating an OpenCL context failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return false;
+        cl_uint deviceCount = 0;
+        clGetDeviceIDs(platformID, CL_DEVICE_TYPE_ALL, 0, NULL, &deviceCount);
+        if (config.device >= (int)deviceCount)
+        {
+            std::cerr << "OpenCL device " << config.device << " requested but the platform has " << deviceCount << ". " << __FILE__ << ":"<< __LINE__ << std::endl;
+            return false;
+        }
+        std::vector<cl_device_id> all(deviceCount);
+        clGetDeviceIDs(platformID, CL_DEVICE_TYPE_ALL, deviceCount, &all[0], NULL);
+        deviceID = all[config.device];
     }
-
-    return true;
-}
-
-bool createSubDeviceContext(cl_context* context, cl_int numComputeUnits) //work in progress
-{
-    cl_int errorNumber = 0;
-    cl_uint numberOfPlatforms = 0;
-    cl_platform_id firstPlatformID = 0;
-
-    /* Retrieve a single platform ID. */
-    if (!checkSuccess(clGetPlatformIDs(1, &firstPlatformID, &numberOfPlatforms)))
+    else
     {
-        std::cerr << "Retrieving OpenCL platforms failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return false;
+        for(int i = NUM_OF_DEVICE_TYPES-1; i >= 0 && !deviceID; --i)
+            if(devices[i].dcount > 0)
+                clGetDeviceIDs(platformID, devices[i].type, 1, &deviceID, NULL);
+        if (!deviceID)
+        {
+            std::cerr << "No OpenCL devices found on the platform. " << __FILE__ << ":"<< __LINE__ << std::endl;
+            return false;
+        }
     }
 
-    if (numberOfPlatforms <= 0)
+    /* Optionally fission the device & build the context on one of its sub-devices. */
+    cl_device_id subDeviceID = 0;
+    if (config.subUnits > 0 || config.affinity != 0)
     {
-        std::cerr << "No OpenCL platforms found. " << __FILE__ << ":"<< __LINE__ << std::endl;
-        return false;
+        if (!createSubDevice(deviceID, config, &subDeviceID))
+            return false;
+        deviceID = subDeviceID;
     }
 
-    /* Get a context with a GPU device from the platform found above. */
-    cl_context_properties contextProperties [] = {CL_CONTEXT_PLATFORM, (cl_context_properties)firstPlatformID, 0};
+    cl_uint computeUnits = 0;
+    clGetDeviceInfo(deviceID, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+    printf("OpenCL device: %s%s, %d compute units\n", deviceInfoString(deviceID, CL_DEVICE_NAME).c_str(),
+            subDeviceID ? " (sub-device)" : "", computeUnits);
 
-    cl_uint numDevices;
-    cl_device_id device_id;
+    /* Get a context with the device found above. */
+    cl_context_properties contextProperties [] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platformID, 0};
+    *context = clCreateContext(contextProperties, 1, &deviceID, context_notify, NULL, &errorNumber);
+#ifdef CL_VERSION_1_2
+    /* The context holds its own reference to the sub-device. */
+    if (subDeviceID)
+        clReleaseDevice(subDeviceID);
+#endif
+    if (!checkSuccess(errorNumber))
+    {
+        std::cerr << "Creating an OpenCL context failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        return false;
+    }
 
-	// Get Device ID from selected platform:
-	clGetDeviceIDs( firstPlatformID, CL_DEVICE_TYPE_ACCELERATOR, 1, &device_id, &numDevices);
+    return true;
+}
 
-	// Create two sub-device properties: Partition By Counts
+bool createSubDevice(cl_device_id device, const OCLDeviceConfig& config, cl_device_id* subDevice)
+{
+#ifdef CL_VERSION_1_2
 	/* Examples:
 		cl_device_partition_property props[] = { CL_DEVICE_PARTITION_BY_COUNTS, 4, CL_DEVICE_PARTITION_BY_COUNTS_LIST_END, 0};
-		cl_device_partition_property props[] = { CL_DEVICE_PARTITION_EQUALLY, 8, 0};
+		cl_device_partition_property props[] = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
 	*/
-	#ifdef CL_VERSION_1_1
-	//cl_device_partition_property_ext pprops[] = { CL_DEVICE_PARTITION_BY_COUNTS_EXT, 4, 4, CL_PROPERTIES_LIST_END_EXT, 0};
-	#else
-	//cl_device_partition_property pprops[] = { CL_DEVICE_PARTITION_BY_COUNTS, 4, CL_DEVICE_PARTITION_BY_COUNTS_LIST_END, 0};
-	#endif /* CL_VERSION_1_1 */
-
-
+    cl_device_partition_property props[4] = {0, 0, 0, 0};
+    if (config.subUnits > 0)
+    {
+        props[0] = CL_DEVICE_PARTITION_BY_COUNTS;
+        props[1] = (cl_device_partition_property)config.subUnits;
+        props[2] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+    }
+    else
+    {
+        props[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+        props[1] = (cl_device_partition_property)config.affinity;
+    }
 
-	cl_device_id subdevice_id;
-	// Create the sub-devices:
-	#ifdef CL_VERSION_1_1
-	//if (!checkSuccess(clCreateSubDevicesEXT(device_id, pprops, 1, &subdevice_id, &numDevices)))
-	#else
-	//if (!checkSuccess(clCreateSubDevices(device_id, pprops, 1, &subdevice_id, &numDevices)))
-	#endif /* CL_VERSION_1_1 */
+    cl_uint numSubDevices = 0;
+    if (!checkSuccess(clCreateSubDevices(device, props, 0, NULL, &numSubDevices)) || numSubDevices == 0)
     {
-        std::cerr << "Creating an OpenCL Sub Device failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        std::cerr << "Partitioning the OpenCL device failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
         return false;
     }
-	// Create the context:
-	*context = clCreateContext(contextProperties, 1, &subdevice_id, NULL, NULL, &errorNumber);
-    if (!checkSuccess(errorNumber))
+
+    /* All the sub-devices of the partition have to be created, the first is kept. */
+    std::vector<cl_device_id> subDevices(numSubDevices);
+    if (!checkSuccess(clCreateSubDevices(device, props, numSubDevices, &subDevices[0], NULL)))
     {
-        std::cerr << "Creating an OpenCL context failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
+        std::cerr << "Creating the OpenCL sub-devices failed. " << __FILE__ << ":"<< __LINE__ << std::endl;
         return false;
     }
+    *subDevice = subDevices[0];
+    for (cl_uint i = 1; i < numSubDevices; i++)
+        clReleaseDevice(subDevices[i]);
 
     return true;
+#else
+    std::cerr << "OpenCL sub-devices need OpenCL 1.2 headers. " << __FILE__ << ":"<< __LINE__ << std::endl;
+    return false;
+#endif /* CL_VERSION_1_2 */
 }
 
 bool createCommandQueue(cl_context context, cl_command_queue* commandQueue, cl_device_id* device)
@@ -435,26 +499,195 @@ bool createCommandQueue(cl_context context, cl_command_queue* commandQueue, cl_d
     return true;
 }
 
-bool createProgram(cl_context context, cl_device_id device, std::string filename, cl_program* program)
+#ifdef EMBED_CL
+//Kernel sources compiled into the library, generated by cmake/embed_cl.cmake
+const char* embeddedCLSource(const char* name);
+#endif
+
+//64-bit FNV-1a, keys the program binary cache
+static uint64_t fnv1a(const std::string& data, uint64_t hash = 14695981039346656037ULL)
 {
-    cl_int errorNumber = 0;
-    std::ifstream kernelFile(filename.c_str(), std::ios::in);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string clCacheDir(void)
+{
+    const char* dir = getenv("PRIME_CL_CACHE");
+    if (dir)
+        return dir;
+    if ((dir = getenv("XDG_CACHE_HOME")) && *dir)
+        return std::string(dir) + "/primestereo";
+    if ((dir = getenv("HOME")) && *dir)
+        return std::string(dir) + "/.cache/primestereo";
+    return "";
+}
+
+std::string clDeviceKey(cl_device_id device)
+{
+    uint64_t key = fnv1a(deviceInfoString(device, CL_DEVICE_VENDOR));
+    key = fnv1a(deviceInfoString(device, CL_DEVICE_NAME), key);
+    key = fnv1a(deviceInfoString(device, CL_DEVICE_VERSION), key);
+    key = fnv1a(deviceInfoString(device, CL_DRIVER_VERSION), key);
+    //A sub-device shares the other fields with its parent
+    cl_uint computeUnits = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+    key = fnv1a(std::to_string(computeUnits), key);
+
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)key);
+    return hash;
+}
+
+//Cache file of a program: <file name>-<hash of source, device, driver & options>.bin
+static std::string binaryCachePath(const std::string& name, const std::string& source, cl_device_id device, const std::string& options)
+{
+    std::string dir = clCacheDir();
+    if (dir.empty())
+        return "";
+
+    uint64_t key = fnv1a(source);
+    key = fnv1a(clDeviceKey(device), key);
+    key = fnv1a(options, key);
 
-    if(!kernelFile.is_open())
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)key);
+    return dir + "/" + name + "-" + hash + ".bin";
+}
+
+//A stale or foreign binary is not an error, the caller falls back to the source
+static bool loadProgramBinary(cl_context context, cl_device_id device, const std::string& path, const std::string& options, cl_program* program)
+{
+    std::ifstream binaryFile(path.c_str(), std::ios::in | std::ios::binary);
+    if (path.empty() || !binaryFile.is_open())
+        return false;
+    std::string binary((std::istreambuf_iterator<char>(binaryFile)), std::istreambuf_iterator<char>());
+    if (binary.empty())
+        return false;
+
+    const unsigned char* data = (const unsigned char*)binary.data();
+    size_t size = binary.size();
+    cl_int binaryStatus = CL_SUCCESS, errorNumber = CL_SUCCESS;
+    *program = clCreateProgramWithBinary(context, 1, &device, &size, &data, &binaryStatus, &errorNumber);
+    if (errorNumber != CL_SUCCESS || binaryStatus != CL_SUCCESS
+        || clBuildProgram(*program, 1, &device, options.c_str(), NULL, NULL) != CL_SUCCESS)
     {
-        std::cerr << "Unable to open " << filename << ". " << __FILE__ << ":"<< __LINE__ << std::endl;
+        if (*program) clReleaseProgram(*program);
+        *program = NULL;
         return false;
     }
+    return true;
+}
 
-    /*
-     * Read the kernel file into an output stream.
-     * Convert this into a char array for passing to OpenCL.
-     */
-    std::ostringstream outputStringStream;
-    outputStringStream << kernelFile.rdbuf();
-    std::string srcStdStr = outputStringStream.str();
-    const char* charSource = srcStdStr.c_str();
+//mkdir -p
+static bool makeDirs(const std::string& dir)
+{
+    for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1))
+    {
+        std::string sub = dir.substr(0, pos);
+        if (mkdir(sub.c_str(), 0755) && errno != EEXIST)
+            return false;
+        if (pos == std::string::npos)
+            return true;
+    }
+}
+
+//Written to a temporary file first so concurrent runs never read a partial binary
+static void saveProgramBinary(cl_program program, cl_device_id device, const std::string& path)
+{
+    cl_uint numDevices = 0;
+    if (path.empty() || clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &numDevices, NULL) != CL_SUCCESS || !numDevices)
+        return;
+    std::vector<cl_device_id> devices(numDevices);
+    std::vector<size_t> sizes(numDevices);
+    if (clGetProgramInfo(program, CL_PROGRAM_DEVICES, numDevices * sizeof(cl_device_id), &devices[0], NULL) != CL_SUCCESS
+        || clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, numDevices * sizeof(size_t), &sizes[0], NULL) != CL_SUCCESS)
+        return;
+
+    cl_uint index = 0;
+    while (index < numDevices && devices[index] != device)
+        index++;
+    if (index == numDevices || !sizes[index])
+        return;
+
+    std::vector<unsigned char> binary(sizes[index]);
+    std::vector<unsigned char*> binaries(numDevices, (unsigned char*)NULL);
+    binaries[index] = &binary[0];
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, numDevices * sizeof(unsigned char*), &binaries[0], NULL) != CL_SUCCESS)
+        return;
+
+    if (!makeDirs(path.substr(0, path.find_last_of('/'))))
+        return;
+    std::string tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream binaryFile(tmpPath.c_str(), std::ios::out | std::ios::binary);
+    if (!binaryFile.is_open())
+        return;
+    binaryFile.write((const char*)&binary[0], binary.size());
+    binaryFile.close();
+    if (!binaryFile || rename(tmpPath.c_str(), path.c_str()))
+        remove(tmpPath.c_str());
+}
+
+bool writeCacheFile(const std::string& name, const std::string& contents)
+{
+    std::string dir = clCacheDir();
+    if (dir.empty() || !makeDirs(dir))
+        return false;
+    std::string path = dir + "/" + name;
+    std::string tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream cacheFile(tmpPath.c_str(), std::ios::out | std::ios::binary);
+    if (!cacheFile.is_open())
+        return false;
+    cacheFile << contents;
+    cacheFile.close();
+    if (!cacheFile || rename(tmpPath.c_str(), path.c_str()))
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool createProgram(cl_context context, cl_device_id device, std::string filename, cl_program* program, std::string options)
+{
+    cl_int errorNumber = 0;
+    std::string name = filename.substr(filename.find_last_of('/') + 1);
+    std::string srcStdStr;
 
+#ifdef EMBED_CL
+    const char* embeddedSource = embeddedCLSource(name.c_str());
+    if (embeddedSource)
+        srcStdStr = embeddedSource;
+#endif
+    if (srcStdStr.empty())
+    {
+        std::ifstream kernelFile(filename.c_str(), std::ios::in);
+
+        if(!kernelFile.is_open())
+        {
+            std::cerr << "Unable to open " << filename << ". " << __FILE__ << ":"<< __LINE__ << std::endl;
+            return false;
+        }
+
+        /*
+         * Read the kernel file into an output stream.
+         * Convert this into a char array for passing to OpenCL.
+         */
+        std::ostringstream outputStringStream;
+        outputStringStream << kernelFile.rdbuf();
+        srcStdStr = outputStringStream.str();
+    }
+
+    /* A binary cached by an earlier run skips the compilation. */
+    std::string cachePath = binaryCachePath(name, srcStdStr, device, options);
+    if (loadProgramBinary(context, device, cachePath, options, program))
+        return true;
+
+    const char* charSource = srcStdStr.c_str();
     *program = clCreateProgramWithSource(context, 1, &charSource, NULL, &errorNumber);
     if (!checkSuccess(errorNumber) || program == NULL)
     {
@@ -463,7 +696,7 @@ bool createProgram(cl_context context, cl_device_id device, std::string filename
     }
 
     /* Try to build the OpenCL program. */
-    bool buildSuccess = checkSuccess(clBuildProgram(*program, 0, NULL, NULL, NULL, NULL));
+    bool buildSuccess = checkSuccess(clBuildProgram(*program, 0, NULL, options.c_str(), NULL, NULL));
 
     /* Get the size of the build log. */
     size_t logSize = 0;
@@ -492,6 +725,7 @@ bool createProgram(cl_context context, cl_device_id device, std::string filename
         return false;
     }
 
+    saveProgramBinary(*program, device, cachePath);
     return true;
 }
 